@@ -28,11 +28,23 @@
 #include <gst/gst.h>
 #include <string.h>
 
+#ifdef HAVE_DMA_HEAP
+#include <errno.h>
+#include <fcntl.h>
+#include <sys/ioctl.h>
+#include <sys/mman.h>
+#include <unistd.h>
+#include <linux/dma-buf.h>
+#include <linux/dma-heap.h>
+#endif
+
 #include "gstomx.h"
+#include "gstomxvideo.h"
 #include "gstomxmjpegdec.h"
 #include "gstomxmpeg2videodec.h"
 #include "gstomxmpeg4videodec.h"
 #include "gstomxh264dec.h"
+#include "gstomxparalleldec.h"
 #include "gstomxh263dec.h"
 #include "gstomxh265dec.h"
 #include "gstomxvp8dec.h"
@@ -294,11 +306,24 @@ gst_omx_component_handle_messages (GstOMXComponent * comp)
       case GST_OMX_MESSAGE_PORT_SETTINGS_CHANGED:{
         gint i, n;
         OMX_U32 index = msg->content.port_settings_changed.port;
+        OMX_U32 param = msg->content.port_settings_changed.param;
         GList *outports = NULL, *l, *k;
 
         GST_DEBUG_OBJECT (comp->parent, "%s settings changed (port %u)",
             comp->name, (guint) index);
 
+        /* A new crop rectangle leaves the buffers as they are */
+        if (param == OMX_IndexConfigCommonOutputCrop) {
+          GstOMXPort *port = gst_omx_component_get_port (comp, index);
+
+          if (port) {
+            GST_DEBUG_OBJECT (comp->parent, "%s port %u crop changed",
+                comp->name, port->index);
+            port->crop_cookie++;
+          }
+          break;
+        }
+
         /* FIXME: This probably can be done better */
 
         /* Now update the ports' states */
@@ -388,6 +413,7 @@ gst_omx_component_handle_messages (GstOMXComponent * comp)
         }
 
         buf->used = FALSE;
+        port->last_buffer_done = g_get_monotonic_time ();
 
         g_queue_push_tail (&port->pending_buffers, buf);
 
@@ -538,13 +564,15 @@ EventHandler (OMX_HANDLETYPE hComponent, OMX_PTR pAppData, OMX_EVENTTYPE eEvent,
     case OMX_EventPortSettingsChanged:
     {
       GstOMXMessage *msg = g_slice_new (GstOMXMessage);
-      OMX_U32 index;
+      OMX_U32 index, param;
 
       if (!(comp->hacks &
               GST_OMX_HACK_EVENT_PORT_SETTINGS_CHANGED_NDATA_PARAMETER_SWAP)) {
         index = nData1;
+        param = nData2;
       } else {
         index = nData2;
+        param = nData1;
       }
 
 
@@ -556,6 +584,7 @@ EventHandler (OMX_HANDLETYPE hComponent, OMX_PTR pAppData, OMX_EVENTTYPE eEvent,
 
       msg->type = GST_OMX_MESSAGE_PORT_SETTINGS_CHANGED;
       msg->content.port_settings_changed.port = index;
+      msg->content.port_settings_changed.param = param;
       GST_DEBUG_OBJECT (comp->parent, "%s settings changed (port index: %u)",
           comp->name, (guint) msg->content.port_settings_changed.port);
 
@@ -1580,6 +1609,40 @@ gst_omx_port_is_flushing (GstOMXPort * port)
   return flushing;
 }
 
+/* Returns the number of buffers owned by the component and the monotonic
+ * time at which it last returned one, 0 if never.
+ *
+ * NOTE: Uses comp->lock and comp->messages_lock */
+guint
+gst_omx_port_get_used_buffers (GstOMXPort * port, gint64 * last_buffer_done)
+{
+  GstOMXComponent *comp;
+  guint i, used = 0;
+
+  g_return_val_if_fail (port != NULL, 0);
+
+  comp = port->comp;
+
+  g_mutex_lock (&comp->lock);
+  gst_omx_component_handle_messages (port->comp);
+  if (port->buffers) {
+    for (i = 0; i < port->buffers->len; i++) {
+      GstOMXBuffer *buf = g_ptr_array_index (port->buffers, i);
+
+      if (buf->used)
+        used++;
+    }
+  }
+  if (last_buffer_done)
+    *last_buffer_done = port->last_buffer_done;
+  g_mutex_unlock (&comp->lock);
+
+  GST_LOG_OBJECT (comp->parent, "%s port %u has %u buffers in use",
+      comp->name, port->index, used);
+
+  return used;
+}
+
 static OMX_ERRORTYPE gst_omx_port_deallocate_buffers_unlocked (GstOMXPort *
     port);
 
@@ -1636,6 +1699,7 @@ gst_omx_port_allocate_buffers_unlocked (GstOMXPort * port,
     buf->port = port;
     buf->used = FALSE;
     buf->settings_cookie = port->settings_cookie;
+    buf->dmabuf_fd = -1;
     g_ptr_array_add (port->buffers, buf);
 
     if (buffers) {
@@ -1734,6 +1798,146 @@ gst_omx_port_use_eglimages (GstOMXPort * port, const GList * images)
   return err;
 }
 
+/* NOTE: Uses comp->lock and comp->messages_lock */
+OMX_ERRORTYPE
+gst_omx_port_allocate_dmabufs (GstOMXPort * port, const gchar * heap)
+{
+#ifdef HAVE_DMA_HEAP
+  GstOMXComponent *comp;
+  OMX_ERRORTYPE err = OMX_ErrorNone;
+  GList *buffers = NULL;
+  gint *fds;
+  gchar *path;
+  gint heap_fd;
+  gsize size;
+  guint i, n;
+
+  g_return_val_if_fail (port != NULL, OMX_ErrorUndefined);
+
+  comp = port->comp;
+
+  path = g_strdup_printf ("/dev/dma_heap/%s", heap ? heap : "system");
+  heap_fd = open (path, O_RDWR | O_CLOEXEC);
+  if (heap_fd < 0) {
+    GST_ERROR_OBJECT (comp->parent, "Failed to open %s: %s", path,
+        g_strerror (errno));
+    g_free (path);
+    return OMX_ErrorInsufficientResources;
+  }
+
+  g_mutex_lock (&comp->lock);
+
+  /* Get the buffer count and size after the port configuration */
+  gst_omx_port_update_port_definition (port, NULL);
+  n = port->port_def.nBufferCountActual;
+  size = GST_ROUND_UP_N (port->port_def.nBufferSize, getpagesize ());
+  fds = g_new (gint, n);
+
+  GST_INFO_OBJECT (comp->parent,
+      "Allocating %u dmabufs of size %" G_GSIZE_FORMAT " from %s for %s "
+      "port %u", n, size, path, comp->name, (guint) port->index);
+
+  for (i = 0; i < n; i++) {
+    struct dma_heap_allocation_data data = { 0, };
+    gpointer mem;
+
+    data.len = size;
+    data.fd_flags = O_RDWR | O_CLOEXEC;
+    if (ioctl (heap_fd, DMA_HEAP_IOCTL_ALLOC, &data) < 0) {
+      GST_ERROR_OBJECT (comp->parent, "Failed to allocate dmabuf: %s",
+          g_strerror (errno));
+      err = OMX_ErrorInsufficientResources;
+      break;
+    }
+
+    mem = mmap (NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, data.fd, 0);
+    if (mem == MAP_FAILED) {
+      GST_ERROR_OBJECT (comp->parent, "Failed to map dmabuf: %s",
+          g_strerror (errno));
+      close (data.fd);
+      err = OMX_ErrorInsufficientResources;
+      break;
+    }
+
+    fds[i] = data.fd;
+    buffers = g_list_append (buffers, mem);
+  }
+
+  if (err == OMX_ErrorNone)
+    err = gst_omx_port_allocate_buffers_unlocked (port, buffers, NULL, n);
+
+  if (err == OMX_ErrorNone) {
+    /* The OMX buffers now own the dmabufs and release them on
+     * deallocation */
+    for (i = 0; i < n; i++) {
+      GstOMXBuffer *buf = g_ptr_array_index (port->buffers, i);
+
+      buf->dmabuf_fd = fds[i];
+    }
+  } else {
+    GList *l;
+
+    for (l = buffers, i = 0; l; l = l->next, i++) {
+      munmap (l->data, size);
+      close (fds[i]);
+    }
+  }
+
+  g_mutex_unlock (&comp->lock);
+
+  g_list_free (buffers);
+  g_free (fds);
+  close (heap_fd);
+  g_free (path);
+
+  return err;
+#else
+  GST_ERROR_OBJECT (port->comp->parent, "dma-heap support is not available");
+
+  return OMX_ErrorNotImplemented;
+#endif
+}
+
+#ifdef HAVE_DMA_HEAP
+static void
+gst_omx_buffer_dmabuf_sync (GstOMXBuffer * buf, guint64 flags)
+{
+  struct dma_buf_sync sync = { 0, };
+
+  sync.flags = flags;
+  while (ioctl (buf->dmabuf_fd, DMA_BUF_IOCTL_SYNC, &sync) < 0) {
+    if (errno == EINTR || errno == EAGAIN)
+      continue;
+    GST_WARNING_OBJECT (buf->port->comp->parent,
+        "Failed to sync dmabuf %d: %s", buf->dmabuf_fd, g_strerror (errno));
+    break;
+  }
+}
+#endif
+
+/* Brackets CPU access to the memory of a buffer from
+ * gst_omx_port_allocate_dmabufs(), so that the caches are kept coherent
+ * with the devices using the dmabuf. No-op for other buffers */
+void
+gst_omx_buffer_sync_start (GstOMXBuffer * buf, gboolean write)
+{
+#ifdef HAVE_DMA_HEAP
+  if (buf->dmabuf_fd >= 0)
+    gst_omx_buffer_dmabuf_sync (buf, DMA_BUF_SYNC_START |
+        (write ? DMA_BUF_SYNC_RW : DMA_BUF_SYNC_READ));
+#endif
+}
+
+void
+gst_omx_buffer_sync_end (GstOMXBuffer * buf, gboolean write)
+{
+#ifdef HAVE_DMA_HEAP
+  if (buf->dmabuf_fd >= 0)
+    gst_omx_buffer_dmabuf_sync (buf, DMA_BUF_SYNC_END |
+        (write ? DMA_BUF_SYNC_RW : DMA_BUF_SYNC_READ));
+#endif
+}
+
 /* NOTE: Must be called while holding comp->lock, uses comp->messages_lock */
 static OMX_ERRORTYPE
 gst_omx_port_deallocate_buffers_unlocked (GstOMXPort * port)
@@ -1784,6 +1988,11 @@ gst_omx_port_deallocate_buffers_unlocked (GstOMXPort * port)
      * to deallocate as much as possible.
      */
     if (buf->omx_buf) {
+#ifdef HAVE_DMA_HEAP
+      gpointer data = buf->omx_buf->pBuffer;
+      gsize size = buf->omx_buf->nAllocLen;
+#endif
+
       g_assert (buf == buf->omx_buf->pAppPrivate);
       buf->omx_buf->pAppPrivate = NULL;
       GST_DEBUG_OBJECT (comp->parent, "%s: deallocating buffer %p (%p)",
@@ -1791,6 +2000,13 @@ gst_omx_port_deallocate_buffers_unlocked (GstOMXPort * port)
 
       tmp = OMX_FreeBuffer (comp->handle, port->index, buf->omx_buf);
 
+#ifdef HAVE_DMA_HEAP
+      if (buf->dmabuf_fd >= 0) {
+        munmap (data, size);
+        close (buf->dmabuf_fd);
+      }
+#endif
+
       if (tmp != OMX_ErrorNone) {
         GST_ERROR_OBJECT (comp->parent,
             "Failed to deallocate buffer %d of %s port %u: %s (0x%08x)", i,
@@ -2477,6 +2693,10 @@ gst_omx_parse_hacks (gchar ** hacks)
       hacks_flags |= GST_OMX_HACK_SKIP_HANDLE_CODEC_DATA;
     else if (g_str_equal (*hacks, "renesas-encmc-stride-align"))
       hacks_flags |= GST_OMX_HACK_RENESAS_ENCMC_STRIDE_ALIGN;
+    else if (g_str_equal (*hacks, "flush-in-executing"))
+      hacks_flags |= GST_OMX_HACK_FLUSH_IN_EXECUTING;
+    else if (g_str_equal (*hacks, "adaptive-playback"))
+      hacks_flags |= GST_OMX_HACK_ADAPTIVE_PLAYBACK;
     else
       GST_WARNING ("Unknown hack: %s", *hacks);
     hacks++;
@@ -2503,11 +2723,12 @@ _class_init (gpointer g_class, gpointer data)
   const gchar *element_name = data;
   GError *err;
   gchar *core_name, *component_name, *component_role;
-  gint in_port_index, out_port_index;
+  gint in_port_index, out_port_index, preview_port_index;
   gchar *template_caps;
   GstPadTemplate *templ;
   GstCaps *caps;
   gchar **hacks;
+  gchar **vendor_formats;
   int i;
 
   if (!element_name)
@@ -2570,6 +2791,32 @@ _class_init (gpointer g_class, gpointer data)
   }
   class_data->out_port_index = out_port_index;
 
+  /* Video decoders may output downscaled pictures on a second port */
+  class_data->preview_port_index = -1;
+  if (G_TYPE_CHECK_CLASS_TYPE (g_class, GST_TYPE_OMX_VIDEO_DEC)) {
+    err = NULL;
+    preview_port_index =
+        g_key_file_get_integer (config, element_name, "preview-port-index",
+        &err);
+    if (err != NULL) {
+      preview_port_index = -1;
+      g_error_free (err);
+    } else {
+      GST_DEBUG ("Using preview port %d for element '%s'", preview_port_index,
+          element_name);
+      class_data->preview_port_index = preview_port_index;
+      class_data->preview_component_name =
+          g_key_file_get_string (config, element_name,
+          "preview-component-name", NULL);
+
+      caps = gst_caps_new_empty_simple ("video/x-raw");
+      templ = gst_pad_template_new ("preview", GST_PAD_SRC, GST_PAD_SOMETIMES,
+          caps);
+      gst_caps_unref (caps);
+      gst_element_class_add_pad_template (element_class, templ);
+    }
+  }
+
   /* Add pad templates */
   err = NULL;
   if (class_data->type != GST_OMX_COMPONENT_TYPE_SOURCE) {
@@ -2638,6 +2885,14 @@ _class_init (gpointer g_class, gpointer data)
 
     class_data->hacks = gst_omx_parse_hacks (hacks);
   }
+
+  if ((vendor_formats =
+          g_key_file_get_string_list (config, element_name,
+              "vendor-color-formats", NULL, NULL))) {
+    class_data->vendor_formats =
+        gst_omx_video_parse_vendor_formats (vendor_formats);
+    g_strfreev (vendor_formats);
+  }
 }
 
 static gboolean
@@ -2796,6 +3051,12 @@ plugin_init (GstPlugin * plugin)
   }
   g_strfreev (elements);
 
+  /* This bin distributes the GOPs to several configured decoders */
+  if (g_key_file_has_group (config, "omxh264dec")) {
+    ret |= gst_element_register (plugin, "omxh264paralleldec", GST_RANK_NONE,
+        GST_TYPE_OMX_PARALLEL_DEC);
+  }
+
 done:
   g_free (env_config_dir);
   g_free (config_dirs);
@@ -144,6 +144,17 @@ G_BEGIN_DECLS
  */
 #define GST_OMX_HACK_RENESAS_ENCMC_STRIDE_ALIGN                   G_GUINT64_CONSTANT (0x0000000000002000)
 
+/* If the component can flush its ports in Executing state, so that a flush
+ * doesn't need a transition to Pause and back.
+ */
+#define GST_OMX_HACK_FLUSH_IN_EXECUTING                               G_GUINT64_CONSTANT (0x0000000000004000)
+
+/* If the component handles resolution changes within the buffers allocated
+ * for a bigger size (adaptive playback), so that only the output caps have
+ * to be updated when the port settings change.
+ */
+#define GST_OMX_HACK_ADAPTIVE_PLAYBACK                                G_GUINT64_CONSTANT (0x0000000000008000)
+
 typedef struct _GstOMXCore GstOMXCore;
 typedef struct _GstOMXPort GstOMXPort;
 typedef enum _GstOMXPortDirection GstOMXPortDirection;
@@ -218,6 +229,7 @@ struct _GstOMXMessage {
     } port_enable;
     struct {
       OMX_U32 port;
+      OMX_U32 param;
     } port_settings_changed;
     struct {
       OMX_U32 port;
@@ -253,6 +265,14 @@ struct _GstOMXPort {
    */
   gint settings_cookie;
   gint configured_settings_cookie;
+
+  /* Increased whenever only the output crop rectangle of this port
+   * changes, which does not need a reconfiguration.
+   */
+  gint crop_cookie;
+
+  /* Monotonic time at which the component last returned a buffer */
+  gint64 last_buffer_done;
 };
 
 struct _GstOMXComponent {
@@ -302,6 +322,10 @@ struct _GstOMXBuffer {
 
   /* TRUE if this is an EGLImage */
   gboolean eglimage;
+
+  /* dmabuf backing the buffer memory, -1 if the memory was
+   * not allocated by gst_omx_port_allocate_dmabufs() */
+  gint dmabuf_fd;
 };
 
 struct _GstOMXClassData {
@@ -314,8 +338,16 @@ struct _GstOMXClassData {
 
   guint32 in_port_index, out_port_index;
 
+  /* Second output port of video decoders with downscaled pictures, -1 if
+   * there is none, and the scaler component tunnelled to it if any */
+  guint32 preview_port_index;
+  const gchar *preview_component_name;
+
   guint64 hacks;
 
+  /* Vendor specific color formats, GstOMXVideoVendorFormat, or NULL */
+  GArray *vendor_formats;
+
   GstOmxComponentType type;
 };
 
@@ -361,10 +393,14 @@ OMX_ERRORTYPE     gst_omx_port_release_buffer (GstOMXPort *port, GstOMXBuffer *b
 
 OMX_ERRORTYPE     gst_omx_port_set_flushing (GstOMXPort *port, GstClockTime timeout, gboolean flush);
 gboolean          gst_omx_port_is_flushing (GstOMXPort *port);
+guint             gst_omx_port_get_used_buffers (GstOMXPort *port, gint64 *last_buffer_done);
 
 OMX_ERRORTYPE     gst_omx_port_allocate_buffers (GstOMXPort *port);
 OMX_ERRORTYPE     gst_omx_port_use_buffers (GstOMXPort *port, const GList *buffers);
 OMX_ERRORTYPE     gst_omx_port_use_eglimages (GstOMXPort *port, const GList *images);
+OMX_ERRORTYPE     gst_omx_port_allocate_dmabufs (GstOMXPort *port, const gchar *heap);
+void              gst_omx_buffer_sync_start (GstOMXBuffer *buf, gboolean write);
+void              gst_omx_buffer_sync_end (GstOMXBuffer *buf, gboolean write);
 OMX_ERRORTYPE     gst_omx_port_deallocate_buffers (GstOMXPort *port);
 OMX_ERRORTYPE     gst_omx_port_populate (GstOMXPort *port);
 OMX_ERRORTYPE     gst_omx_port_wait_buffers_released (GstOMXPort * port, GstClockTime timeout);
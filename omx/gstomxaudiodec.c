@@ -1033,6 +1033,15 @@ gst_omx_audio_dec_handle_frame (GstAudioDecoder * decoder, GstBuffer * inbuf)
   if (inbuf == NULL)
     return gst_omx_audio_dec_drain (self);
 
+#if GST_CHECK_VERSION(1,6,0)
+  /* Audio is not played during this trick mode, don't decode it at all */
+  if (decoder->input_segment.flags & GST_SEGMENT_FLAG_TRICKMODE_NO_AUDIO) {
+    GST_LOG_OBJECT (self, "Skipping buffer in no-audio trick mode");
+    gst_buffer_unref (inbuf);
+    return gst_audio_decoder_finish_frame (decoder, NULL, 1);
+  }
+#endif
+
   timestamp = GST_BUFFER_TIMESTAMP (inbuf);
   duration = GST_BUFFER_DURATION (inbuf);
 
@@ -348,24 +348,132 @@ wrong_video_caps:
   }
 }
 
+/* Referenced by the cache while it is in there and by each memory
+ * wrapping it, ended with the last reference */
+typedef struct
+{
+  gint refcount;
+  gint id;
+  gint fd;
+  guint generation;
+} GstOMXDmabufExport;
+
+static GQuark gst_omx_dmabuf_export_quark = 0;
+
+static void
+gst_omx_dmabuf_export_unref (GstOMXDmabufExport * export)
+{
+  if (!g_atomic_int_dec_and_test (&export->refcount))
+    return;
+
+#ifdef HAVE_MMNGRBUF
+  GST_DEBUG ("mmngr_export_end_in_user (%d)", export->id);
+  close (export->fd);
+  mmngr_export_end_in_user_ext (export->id);
+#endif
+  g_slice_free (GstOMXDmabufExport, export);
+}
+
+GstOMXDmabufCache *
+gst_omx_dmabuf_cache_new (void)
+{
+  GstOMXDmabufCache *cache = g_slice_new0 (GstOMXDmabufCache);
+
+  cache->exports = g_hash_table_new_full (g_int64_hash, g_int64_equal,
+      g_free, (GDestroyNotify) gst_omx_dmabuf_export_unref);
+
+  return cache;
+}
+
+static gboolean
+gst_omx_dmabuf_cache_is_stale (gpointer key, gpointer value,
+    gpointer user_data)
+{
+  GstOMXDmabufExport *export = value;
+  GstOMXDmabufCache *cache = user_data;
+
+  return export->generation != cache->generation;
+}
+
+/* Called after all buffers of a pool were allocated. Exports still used
+ * by buffers of older pools end once those are freed */
+void
+gst_omx_dmabuf_cache_trim (GstOMXDmabufCache * cache)
+{
+  g_hash_table_foreach_remove (cache->exports,
+      gst_omx_dmabuf_cache_is_stale, cache);
+  cache->generation++;
+}
+
+/* Exports still wrapped by buffers end once those are freed */
+void
+gst_omx_dmabuf_cache_clear (GstOMXDmabufCache * cache)
+{
+  g_hash_table_remove_all (cache->exports);
+}
+
+void
+gst_omx_dmabuf_cache_free (GstOMXDmabufCache * cache)
+{
+  g_hash_table_unref (cache->exports);
+  g_slice_free (GstOMXDmabufCache, cache);
+}
+
 #if defined (HAVE_MMNGRBUF) && defined (HAVE_VIDEODEC_EXT)
+/* Returns a new fd for the physical memory and the export, which the
+ * caller has to unref. The export itself is kept in the cache of the
+ * element and reused by later pools */
 static gboolean
 gst_omx_buffer_pool_export_dmabuf (GstOMXBufferPool * pool,
-    guint phys_addr, gint size, gint * id_export, gint * dmabuf_fd)
+    guint phys_addr, gint size, gint * dmabuf_fd,
+    GstOMXDmabufExport ** export_out)
 {
+  GstOMXDmabufCache *cache =
+      GST_OMX_VIDEO_DEC (pool->element)->dmabuf_cache;
+  GstOMXDmabufExport *export;
+  gint64 key, *key_copy;
   gint res;
 
-  res =
-      mmngr_export_start_in_user_ext (id_export,
-      (gsize) size, phys_addr, dmabuf_fd, NULL);
-  if (res != R_MM_OK) {
-    GST_ERROR_OBJECT (pool,
-        "mmngr_export_start_in_user failed (phys_addr:0x%08x)", phys_addr);
+  key = ((gint64) phys_addr << 32) | (guint32) size;
+  export = g_hash_table_lookup (cache->exports, &key);
+  if (export) {
+    GST_DEBUG_OBJECT (pool, "Reusing dmabuf:%d id_export:%d "
+        "(phys_addr:0x%08x)", export->fd, export->id, phys_addr);
+    GST_OBJECT_LOCK (pool->element);
+    cache->n_reused++;
+    GST_OBJECT_UNLOCK (pool->element);
+  } else {
+    export = g_slice_new0 (GstOMXDmabufExport);
+    export->refcount = 1;
+    res =
+        mmngr_export_start_in_user_ext (&export->id,
+        (gsize) size, phys_addr, &export->fd, NULL);
+    if (res != R_MM_OK) {
+      GST_ERROR_OBJECT (pool,
+          "mmngr_export_start_in_user failed (phys_addr:0x%08x)", phys_addr);
+      g_slice_free (GstOMXDmabufExport, export);
+      return FALSE;
+    }
+    GST_DEBUG_OBJECT (pool,
+        "Export dmabuf:%d id_export:%d (phys_addr:0x%08x)", export->fd,
+        export->id, phys_addr);
+    key_copy = g_new (gint64, 1);
+    *key_copy = key;
+    g_hash_table_insert (cache->exports, key_copy, export);
+    GST_OBJECT_LOCK (pool->element);
+    cache->n_exports++;
+    GST_OBJECT_UNLOCK (pool->element);
+  }
+  export->generation = cache->generation;
+
+  /* The memory takes ownership of the returned fd */
+  *dmabuf_fd = dup (export->fd);
+  if (*dmabuf_fd < 0) {
+    GST_ERROR_OBJECT (pool, "Failed to duplicate dmabuf:%d", export->fd);
     return FALSE;
   }
-  GST_DEBUG_OBJECT (pool,
-      "Export dmabuf:%d id_export:%d (phys_addr:0x%08x)", *dmabuf_fd,
-      *id_export, phys_addr);
+  g_atomic_int_inc (&export->refcount);
+  *export_out = export;
 
   return TRUE;
 }
@@ -380,7 +488,6 @@ gst_omx_buffer_pool_create_buffer_contain_dmabuf (GstOMXBufferPool * self,
   gint dmabuf_fd[GST_VIDEO_MAX_PLANES];
   gint plane_size[GST_VIDEO_MAX_PLANES];
   gint plane_size_ext[GST_VIDEO_MAX_PLANES];
-  gint dmabuf_id[GST_VIDEO_MAX_PLANES];
   gint page_offset[GST_VIDEO_MAX_PLANES];
   GstBuffer *new_buf;
   gint i;
@@ -393,6 +500,7 @@ gst_omx_buffer_pool_create_buffer_contain_dmabuf (GstOMXBufferPool * self,
       omx_buf->omx_buf->pBuffer);
 
   for (i = 0; i < GST_VIDEO_INFO_N_PLANES (&self->video_info); i++) {
+    GstOMXDmabufExport *export;
     guint phys_addr;
     GstMemory *mem;
 
@@ -403,7 +511,15 @@ gst_omx_buffer_pool_create_buffer_contain_dmabuf (GstOMXBufferPool * self,
     /* Calculate offset between physical address and page boundary */
     page_offset[i] = phys_addr & (page_size - 1);
 
-    plane_size[i] = stride[i] * slice[i];
+#if GST_CHECK_VERSION(1,4,0)
+    if (GST_VIDEO_INFO_IS_TILED (&self->video_info))
+      plane_size[i] = (GST_VIDEO_TILE_X_TILES (stride[i]) *
+          GST_VIDEO_TILE_Y_TILES (stride[i])) <<
+          (GST_VIDEO_FORMAT_INFO_TILE_WS (self->video_info.finfo) +
+          GST_VIDEO_FORMAT_INFO_TILE_HS (self->video_info.finfo));
+    else
+#endif
+      plane_size[i] = stride[i] * slice[i];
     GST_DEBUG_OBJECT (self, "Plane size %d: %d", i, plane_size[i]);
 
     /* When downstream plugins do mapping from dmabuf fd it requires
@@ -414,15 +530,17 @@ gst_omx_buffer_pool_create_buffer_contain_dmabuf (GstOMXBufferPool * self,
     GST_DEBUG_OBJECT (self, "Plane size extend %d: %d", i, plane_size_ext[i]);
 
     if (!gst_omx_buffer_pool_export_dmabuf (self, phys_addr,
-            plane_size_ext[i], &dmabuf_id[i], &dmabuf_fd[i])) {
+            plane_size_ext[i], &dmabuf_fd[i], &export)) {
       GST_ERROR_OBJECT (self, "dmabuf exporting failed");
       return NULL;
     }
-
-    g_array_append_val (self->id_array, dmabuf_id[i]);
     /* Set offset's information */
     mem = gst_dmabuf_allocator_alloc (self->allocator, dmabuf_fd[i],
         plane_size_ext[i]);
+    /* The export ends after the last memory wrapping it */
+    gst_mini_object_set_qdata (GST_MINI_OBJECT_CAST (mem),
+        gst_omx_dmabuf_export_quark, export,
+        (GDestroyNotify) gst_omx_dmabuf_export_unref);
     mem->offset = page_offset[i];
     /* Only allow to access plane size */
     mem->size = plane_size[i];
@@ -508,6 +626,7 @@ gst_omx_buffer_pool_alloc_buffer (GstBufferPool * bpool,
       case GST_VIDEO_FORMAT_GRAY8:
         break;
       case GST_VIDEO_FORMAT_I420:
+      case GST_VIDEO_FORMAT_I420_10LE:
         stride[1] = nstride / 2;
         slice[1] = nslice / 2;
         offset[1] = offset[0] + stride[0] * nslice;
@@ -517,16 +636,59 @@ gst_omx_buffer_pool_alloc_buffer (GstBufferPool * bpool,
         break;
       case GST_VIDEO_FORMAT_NV12:
       case GST_VIDEO_FORMAT_NV16:
+#if GST_CHECK_VERSION(1, 10, 0)
+      case GST_VIDEO_FORMAT_P010_10LE:
+#endif
         stride[1] = nstride;
         slice[1] = nslice / 2;
         offset[1] = offset[0] + stride[0] * nslice;
         break;
+#if GST_CHECK_VERSION(1, 4, 0)
+      case GST_VIDEO_FORMAT_NV12_64Z32:
+        /* The strides of tiled formats are the number of tiles */
+        stride[0] = GST_VIDEO_TILE_MAKE_STRIDE (nstride / 64,
+            GST_ROUND_UP_32 (nslice) / 32);
+        stride[1] = GST_VIDEO_TILE_MAKE_STRIDE (nstride / 64,
+            GST_ROUND_UP_32 (nslice / 2) / 32);
+        slice[1] = nslice / 2;
+        offset[1] = offset[0] + nstride * nslice;
+        break;
+#endif
       default:
         g_assert_not_reached ();
         break;
     }
 
-    if (GST_IS_OMX_VIDEO_DEC (pool->element) &&
+    if (omx_buf->dmabuf_fd >= 0) {
+      /* Memory was allocated from a dma-heap, see
+       * gst_omx_port_allocate_dmabufs() */
+      if (pool->allocator && GST_IS_OMX_MEMORY_ALLOCATOR (pool->allocator)) {
+        gst_object_unref (pool->allocator);
+        pool->allocator = gst_dmabuf_allocator_new ();
+      }
+      GST_DEBUG_OBJECT (pool, "DMABUF - Using %s allocator for fd %d",
+          pool->allocator->mem_type, omx_buf->dmabuf_fd);
+
+      /* The OMX buffer keeps its own fd until it is deallocated. CPU
+       * access downstream goes through the dmabuf allocator's map, which
+       * does the DMA_BUF_IOCTL_SYNC bracketing since GStreamer 1.12 */
+      mem = gst_dmabuf_allocator_alloc (pool->allocator,
+          dup (omx_buf->dmabuf_fd), omx_buf->omx_buf->nAllocLen);
+      if (!mem) {
+        GST_ERROR_OBJECT (pool, "Can not wrap dmabuf %d", omx_buf->dmabuf_fd);
+        return GST_FLOW_ERROR;
+      }
+
+      buf = gst_buffer_new ();
+      gst_buffer_append_memory (buf, mem);
+      g_ptr_array_add (pool->buffers, buf);
+      gst_buffer_add_video_meta_full (buf, GST_VIDEO_FRAME_FLAG_NONE,
+          GST_VIDEO_INFO_FORMAT (&pool->video_info),
+          GST_VIDEO_INFO_WIDTH (&pool->video_info),
+          GST_VIDEO_INFO_HEIGHT (&pool->video_info),
+          GST_VIDEO_INFO_N_PLANES (&pool->video_info), offset, stride);
+      pool->need_copy = FALSE;
+    } else if (GST_IS_OMX_VIDEO_DEC (pool->element) &&
         GST_OMX_VIDEO_DEC (pool->element)->use_dmabuf == TRUE &&
         (omx_buf->omx_buf->pOutputPortPrivate)) {
 #if defined (HAVE_MMNGRBUF) && defined (HAVE_VIDEODEC_EXT)
@@ -642,6 +804,7 @@ gst_omx_buffer_pool_acquire_buffer (GstBufferPool * bpool,
 
   if (pool->port->port_def.eDir == OMX_DirOutput) {
     GstBuffer *buf;
+    GstVideoMeta *meta;
 
     g_return_val_if_fail (pool->current_buffer_index != -1, GST_FLOW_ERROR);
 
@@ -649,6 +812,15 @@ gst_omx_buffer_pool_acquire_buffer (GstBufferPool * bpool,
     g_return_val_if_fail (buf != NULL, GST_FLOW_ERROR);
     *buffer = buf;
     ret = GST_FLOW_OK;
+    g_atomic_int_inc (&pool->outstanding);
+
+    /* The frame size might have changed since the buffer was allocated,
+     * see gst_omx_buffer_pool_resize() */
+    meta = gst_buffer_get_video_meta (buf);
+    if (meta) {
+      meta->width = GST_VIDEO_INFO_WIDTH (&pool->video_info);
+      meta->height = GST_VIDEO_INFO_HEIGHT (&pool->video_info);
+    }
 
     /* If it's our own memory we have to set the sizes */
     if ((!pool->other_pool) &&
@@ -714,6 +886,9 @@ gst_omx_buffer_pool_release_buffer (GstBufferPool * bpool, GstBuffer * buffer)
 
   g_assert (pool->component && pool->port);
 
+  if (!pool->allocating && pool->port->port_def.eDir == OMX_DirOutput)
+    g_atomic_int_add (&pool->outstanding, -1);
+
   if (!pool->allocating && !pool->deactivated) {
     omx_buf =
         gst_mini_object_get_qdata (GST_MINI_OBJECT_CAST (buffer),
@@ -755,24 +930,6 @@ gst_omx_buffer_pool_finalize (GObject * object)
 {
   GstOMXBufferPool *pool = GST_OMX_BUFFER_POOL (object);
 
-#ifdef HAVE_MMNGRBUF
-  if (GST_OMX_VIDEO_DEC (pool->element)->use_dmabuf) {
-    gint i;
-    gint dmabuf_id;
-
-    for (i = 0; i < pool->id_array->len; i++) {
-      dmabuf_id = g_array_index (pool->id_array, gint, i);
-      if (dmabuf_id >= 0) {
-        GST_DEBUG_OBJECT (pool, "mmngr_export_end_in_user (%d)", dmabuf_id);
-        mmngr_export_end_in_user_ext (dmabuf_id);
-      } else {
-        GST_WARNING_OBJECT (pool, "Invalid dmabuf_id");
-      }
-    }
-  }
-  g_array_free (pool->id_array, TRUE);
-#endif
-
   if (pool->element)
     gst_object_unref (pool->element);
   pool->element = NULL;
@@ -803,6 +960,8 @@ gst_omx_buffer_pool_class_init (GstOMXBufferPoolClass * klass)
   GstBufferPoolClass *gstbufferpool_class = (GstBufferPoolClass *) klass;
 
   gst_omx_buffer_data_quark = g_quark_from_static_string ("GstOMXBufferData");
+  gst_omx_dmabuf_export_quark =
+      g_quark_from_static_string ("GstOMXDmabufExport");
 
   gobject_class->finalize = gst_omx_buffer_pool_finalize;
   gstbufferpool_class->start = gst_omx_buffer_pool_start;
@@ -820,9 +979,6 @@ gst_omx_buffer_pool_init (GstOMXBufferPool * pool)
 {
   pool->buffers = g_ptr_array_new ();
   pool->allocator = g_object_new (gst_omx_memory_allocator_get_type (), NULL);
-#ifdef HAVE_MMNGRBUF
-  pool->id_array = g_array_new (FALSE, FALSE, sizeof (gint));
-#endif
   pool->enc_buffer_index = 0;
 }
 
@@ -839,3 +995,41 @@ gst_omx_buffer_pool_new (GstElement * element, GstOMXComponent * component,
 
   return GST_BUFFER_POOL (pool);
 }
+
+/* Change the size of the frames in the buffers of an output pool without
+ * reallocating them, e.g. after a resolution change in adaptive playback.
+ * Only possible if the memory layout of the planes is unchanged */
+gboolean
+gst_omx_buffer_pool_resize (GstBufferPool * bpool, guint width, guint height)
+{
+  GstOMXBufferPool *pool = GST_OMX_BUFFER_POOL (bpool);
+  GstVideoMeta *meta;
+  GstBuffer *buf;
+  guint nstride, nslice;
+
+  g_return_val_if_fail (pool->port != NULL, FALSE);
+
+  if (!pool->buffers || pool->buffers->len == 0)
+    return FALSE;
+
+  buf = g_ptr_array_index (pool->buffers, 0);
+  meta = gst_buffer_get_video_meta (buf);
+  if (!meta)
+    return FALSE;
+
+  nstride = pool->port->port_def.format.video.nStride;
+  nslice = pool->port->port_def.format.video.nSliceHeight;
+  if (meta->stride[0] != (gint) nstride)
+    return FALSE;
+  if (meta->n_planes > 1 && meta->offset[1] != (gsize) nstride * nslice)
+    return FALSE;
+
+  GST_DEBUG_OBJECT (pool, "Resizing frames to %ux%u", width, height);
+
+  GST_OBJECT_LOCK (pool);
+  gst_video_info_set_format (&pool->video_info,
+      GST_VIDEO_INFO_FORMAT (&pool->video_info), width, height);
+  GST_OBJECT_UNLOCK (pool);
+
+  return TRUE;
+}
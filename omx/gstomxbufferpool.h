@@ -43,6 +43,7 @@ G_BEGIN_DECLS
 
 typedef struct _GstOMXBufferPool GstOMXBufferPool;
 typedef struct _GstOMXBufferPoolClass GstOMXBufferPoolClass;
+typedef struct _GstOMXDmabufCache GstOMXDmabufCache;
 
 struct _GstOMXBufferPool
 {
@@ -82,10 +83,25 @@ struct _GstOMXBufferPool
 
   /* Used during acquire for input port */
   gint enc_buffer_index;
-#ifdef HAVE_MMNGRBUF
-  /* Array use to contain dma_id. It is used in export_end dmabuf area */
-  GArray *id_array;
-#endif
+
+  /* Output buffers acquired and not released yet, atomic */
+  gint outstanding;
+};
+
+/* Keeps dmabuf exports of physical memory alive across the recreation of
+ * output pools. Owned by the element */
+struct _GstOMXDmabufCache
+{
+  /* physical address and size -> export */
+  GHashTable *exports;
+
+  /* Incremented after each pool allocation, exports not used by the
+   * latest allocation are released */
+  guint generation;
+
+  /* Statistics, OBJECT_LOCK of the element */
+  guint64 n_exports;
+  guint64 n_reused;
 };
 
 struct _GstOMXBufferPoolClass
@@ -96,6 +112,12 @@ struct _GstOMXBufferPoolClass
 GType gst_omx_buffer_pool_get_type (void);
 
 GstBufferPool *gst_omx_buffer_pool_new (GstElement * element, GstOMXComponent * component, GstOMXPort * port);
+gboolean gst_omx_buffer_pool_resize (GstBufferPool * bpool, guint width, guint height);
+
+GstOMXDmabufCache *gst_omx_dmabuf_cache_new (void);
+void gst_omx_dmabuf_cache_trim (GstOMXDmabufCache * cache);
+void gst_omx_dmabuf_cache_clear (GstOMXDmabufCache * cache);
+void gst_omx_dmabuf_cache_free (GstOMXDmabufCache * cache);
 
 G_END_DECLS
 
@@ -25,6 +25,7 @@
 #include <gst/gst.h>
 
 #include "gstomxh264dec.h"
+#include "gstomxvideo.h"
 
 GST_DEBUG_CATEGORY_STATIC (gst_omx_h264_dec_debug_category);
 #define GST_CAT_DEFAULT gst_omx_h264_dec_debug_category
@@ -34,6 +35,8 @@ static gboolean gst_omx_h264_dec_is_format_change (GstOMXVideoDec * dec,
     GstOMXPort * port, GstVideoCodecState * state);
 static gboolean gst_omx_h264_dec_set_format (GstOMXVideoDec * dec,
     GstOMXPort * port, GstVideoCodecState * state);
+static GstFlowReturn gst_omx_h264_dec_prepare_frame (GstOMXVideoDec * dec,
+    GstVideoCodecFrame * frame);
 
 enum
 {
@@ -58,6 +61,8 @@ gst_omx_h264_dec_class_init (GstOMXH264DecClass * klass)
   videodec_class->is_format_change =
       GST_DEBUG_FUNCPTR (gst_omx_h264_dec_is_format_change);
   videodec_class->set_format = GST_DEBUG_FUNCPTR (gst_omx_h264_dec_set_format);
+  videodec_class->prepare_frame =
+      GST_DEBUG_FUNCPTR (gst_omx_h264_dec_prepare_frame);
 
   videodec_class->cdata.default_sink_template_caps = "video/x-h264, "
       "parsed=(boolean) true, "
@@ -99,3 +104,243 @@ gst_omx_h264_dec_set_format (GstOMXVideoDec * dec, GstOMXPort * port,
 
   return ret;
 }
+
+/* MaxDpbMbs of Table A-1 */
+static const struct
+{
+  guint8 level_idc;
+  guint32 max_dpb_mbs;
+} h264_levels[] = {
+  {9, 396}, {10, 396}, {11, 900}, {12, 2376}, {13, 2376}, {20, 2376},
+  {21, 4752}, {22, 8100}, {30, 8100}, {31, 18000}, {32, 20480}, {40, 32768},
+  {41, 32768}, {42, 34816}, {50, 110400}, {51, 184320}, {52, 184320},
+  {60, 696320}, {61, 696320}, {62, 696320}
+};
+
+static gboolean
+gst_omx_h264_dec_skip_scaling_list (GstBitReader * br, guint size)
+{
+  gint32 last = 8, next = 8, delta;
+  guint i;
+
+  for (i = 0; i < size && next != 0; i++) {
+    if (!gst_omx_video_read_se (br, &delta))
+      return FALSE;
+    next = (last + delta + 256) % 256;
+    if (next != 0)
+      last = next;
+  }
+
+  return TRUE;
+}
+
+static gboolean
+gst_omx_h264_dec_skip_hrd_parameters (GstBitReader * br)
+{
+  guint32 cpb_cnt_minus1, v, i;
+
+  if (!gst_omx_video_read_ue (br, &cpb_cnt_minus1) || cpb_cnt_minus1 > 31
+      || !gst_bit_reader_skip (br, 8))
+    return FALSE;
+
+  for (i = 0; i <= cpb_cnt_minus1; i++) {
+    if (!gst_omx_video_read_ue (br, &v) || !gst_omx_video_read_ue (br, &v)
+        || !gst_bit_reader_skip (br, 1))
+      return FALSE;
+  }
+
+  return gst_bit_reader_skip (br, 20);
+}
+
+/* Number of frames that can precede a frame in decoding order and follow it
+ * in output order: max_num_reorder_frames of the VUI, or else inferred from
+ * the profile and the DPB size of the level. -1 if the SPS can't be parsed */
+static gint
+gst_omx_h264_dec_parse_reorder_depth (const guint8 * data, gsize size)
+{
+  GstBitReader br;
+  guint8 *rbsp;
+  gsize rbsp_size;
+  guint32 profile_idc, constraints, level_idc, chroma_format_idc = 1;
+  guint32 poc_type, width_mbs, height_map_units, frame_mbs_only;
+  guint32 flag, nal_hrd, vcl_hrd, v, n, i;
+  guint32 max_dpb_mbs = 0;
+  gint32 sv;
+  gint depth = -1;
+
+  rbsp = gst_omx_video_nal_to_rbsp (data, MIN (size, MAX_SPS_SIZE),
+      &rbsp_size);
+  gst_bit_reader_init (&br, rbsp, rbsp_size);
+
+  READ_BITS (profile_idc, 8);
+  READ_BITS (constraints, 8);
+  READ_BITS (level_idc, 8);
+  READ_UE (v);                  /* seq_parameter_set_id */
+  if (profile_idc == 100 || profile_idc == 110 || profile_idc == 122
+      || profile_idc == 244 || profile_idc == 44 || profile_idc == 83
+      || profile_idc == 86 || profile_idc == 118 || profile_idc == 128
+      || profile_idc == 138 || profile_idc == 139 || profile_idc == 134
+      || profile_idc == 135) {
+    READ_UE (chroma_format_idc);
+    if (chroma_format_idc == 3)
+      SKIP_BITS (1);
+    READ_UE (v);                /* bit_depth_luma_minus8 */
+    READ_UE (v);                /* bit_depth_chroma_minus8 */
+    SKIP_BITS (1);
+    READ_BITS (flag, 1);        /* seq_scaling_matrix_present_flag */
+    if (flag) {
+      n = chroma_format_idc != 3 ? 8 : 12;
+      for (i = 0; i < n; i++) {
+        READ_BITS (flag, 1);
+        if (flag && !gst_omx_h264_dec_skip_scaling_list (&br, i < 6 ? 16 : 64))
+          goto done;
+      }
+    }
+  }
+  READ_UE (v);                  /* log2_max_frame_num_minus4 */
+  READ_UE (poc_type);
+  if (poc_type == 0) {
+    READ_UE (v);
+  } else if (poc_type == 1) {
+    SKIP_BITS (1);
+    READ_SE (sv);
+    READ_SE (sv);
+    READ_UE (n);
+    if (n > 255)
+      goto done;
+    for (i = 0; i < n; i++) {
+      READ_SE (sv);
+    }
+  }
+  READ_UE (v);                  /* max_num_ref_frames */
+  SKIP_BITS (1);
+  READ_UE (width_mbs);
+  READ_UE (height_map_units);
+  READ_BITS (frame_mbs_only, 1);
+  if (!frame_mbs_only)
+    SKIP_BITS (1);
+  SKIP_BITS (1);
+  READ_BITS (flag, 1);          /* frame_cropping_flag */
+  if (flag) {
+    READ_UE (v);
+    READ_UE (v);
+    READ_UE (v);
+    READ_UE (v);
+  }
+
+  /* Inferred value: Baseline and the intra profiles have no reordering,
+   * otherwise all of the DPB may be used for it */
+  if (profile_idc == 66 || ((constraints & 0x10) && (profile_idc == 44
+              || profile_idc == 86 || profile_idc == 100 || profile_idc == 110
+              || profile_idc == 122 || profile_idc == 244))) {
+    depth = 0;
+  } else {
+    guint64 frame_mbs = (guint64) (width_mbs + 1) * (height_map_units + 1) *
+        (2 - frame_mbs_only);
+
+    for (i = 0; i < G_N_ELEMENTS (h264_levels); i++) {
+      if (h264_levels[i].level_idc == level_idc)
+        max_dpb_mbs = h264_levels[i].max_dpb_mbs;
+    }
+    depth = max_dpb_mbs ? MIN (max_dpb_mbs / frame_mbs, 16) : 16;
+  }
+
+  READ_BITS (flag, 1);          /* vui_parameters_present_flag */
+  if (!flag)
+    goto done;
+  READ_BITS (flag, 1);          /* aspect_ratio_info_present_flag */
+  if (flag) {
+    READ_BITS (v, 8);
+    if (v == 255)
+      SKIP_BITS (32);
+  }
+  READ_BITS (flag, 1);          /* overscan_info_present_flag */
+  if (flag)
+    SKIP_BITS (1);
+  READ_BITS (flag, 1);          /* video_signal_type_present_flag */
+  if (flag) {
+    SKIP_BITS (4);
+    READ_BITS (flag, 1);
+    if (flag)
+      SKIP_BITS (24);
+  }
+  READ_BITS (flag, 1);          /* chroma_loc_info_present_flag */
+  if (flag) {
+    READ_UE (v);
+    READ_UE (v);
+  }
+  READ_BITS (flag, 1);          /* timing_info_present_flag */
+  if (flag)
+    SKIP_BITS (65);
+  READ_BITS (nal_hrd, 1);
+  if (nal_hrd && !gst_omx_h264_dec_skip_hrd_parameters (&br))
+    goto done;
+  READ_BITS (vcl_hrd, 1);
+  if (vcl_hrd && !gst_omx_h264_dec_skip_hrd_parameters (&br))
+    goto done;
+  if (nal_hrd || vcl_hrd)
+    SKIP_BITS (1);
+  SKIP_BITS (1);
+  READ_BITS (flag, 1);          /* bitstream_restriction_flag */
+  if (flag) {
+    SKIP_BITS (1);
+    READ_UE (v);
+    READ_UE (v);
+    READ_UE (v);
+    READ_UE (v);
+    READ_UE (v);                /* max_num_reorder_frames */
+    depth = MIN (v, 16);
+  }
+
+done:
+  g_free (rbsp);
+
+  return depth;
+}
+
+/* A frame is disposable when its slices have nal_ref_idc == 0, so no other
+ * picture is predicted from it. All slices of a picture share the value, the
+ * first one decides. Input is byte-stream, one AU per buffer. The reorder
+ * depth is taken from the SPS, which precede the slices */
+static GstFlowReturn
+gst_omx_h264_dec_prepare_frame (GstOMXVideoDec * dec,
+    GstVideoCodecFrame * frame)
+{
+  GstMapInfo map;
+  gboolean has_slice = FALSE, has_ref = FALSE;
+  gsize i;
+
+  if (!gst_buffer_map (frame->input_buffer, &map, GST_MAP_READ))
+    return GST_FLOW_OK;
+
+  for (i = 0; i + 3 < map.size && !has_slice; i++) {
+    guint8 nal_ref_idc, nal_type;
+
+    if (map.data[i] != 0 || map.data[i + 1] != 0 || map.data[i + 2] != 1)
+      continue;
+
+    nal_ref_idc = (map.data[i + 3] >> 5) & 0x3;
+    nal_type = map.data[i + 3] & 0x1f;
+
+    if (nal_type == 1 || nal_type == 5) {
+      has_slice = TRUE;
+      has_ref = nal_ref_idc != 0;
+    } else if (nal_type == 7) {
+      gint depth = gst_omx_h264_dec_parse_reorder_depth (map.data + i + 4,
+          map.size - i - 4);
+
+      if (depth >= 0 && depth != dec->stream_reorder_depth) {
+        GST_DEBUG_OBJECT (dec, "Stream reorder depth %d", depth);
+        dec->stream_reorder_depth = depth;
+      }
+    }
+    i += 3;
+  }
+
+  gst_buffer_unmap (frame->input_buffer, &map);
+
+  if (has_slice && !has_ref)
+    GST_OMX_VIDEO_DEC_FRAME_SET_DISPOSABLE (frame);
+
+  return GST_FLOW_OK;
+}
@@ -24,6 +24,7 @@
 #include <gst/gst.h>
 
 #include "gstomxh265dec.h"
+#include "gstomxvideo.h"
 #ifdef HAVE_H265DEC_EXT
 #include "OMXR_Extension_h265d.h"
 #endif
@@ -36,6 +37,8 @@ static gboolean gst_omx_h265_dec_is_format_change (GstOMXVideoDec * dec,
     GstOMXPort * port, GstVideoCodecState * state);
 static gboolean gst_omx_h265_dec_set_format (GstOMXVideoDec * dec,
     GstOMXPort * port, GstVideoCodecState * state);
+static GstFlowReturn gst_omx_h265_dec_prepare_frame (GstOMXVideoDec * dec,
+    GstVideoCodecFrame * frame);
 
 enum
 {
@@ -60,6 +63,8 @@ gst_omx_h265_dec_class_init (GstOMXH265DecClass * klass)
   videodec_class->is_format_change =
       GST_DEBUG_FUNCPTR (gst_omx_h265_dec_is_format_change);
   videodec_class->set_format = GST_DEBUG_FUNCPTR (gst_omx_h265_dec_set_format);
+  videodec_class->prepare_frame =
+      GST_DEBUG_FUNCPTR (gst_omx_h265_dec_prepare_frame);
 
   videodec_class->cdata.default_sink_template_caps = "video/x-h265, "
       "parsed=(boolean) true, "
@@ -102,3 +107,109 @@ gst_omx_h265_dec_set_format (GstOMXVideoDec * dec, GstOMXPort * port,
 
   return ret;
 }
+
+/* sps_max_num_reorder_pics of the highest temporal sub-layer, -1 if the SPS
+ * can't be parsed */
+static gint
+gst_omx_h265_dec_parse_reorder_depth (const guint8 * data, gsize size)
+{
+  GstBitReader br;
+  guint8 *rbsp;
+  gsize rbsp_size;
+  guint32 max_sub_layers_minus1, flag, v, reorder = 0, i;
+  guint32 profile_present[8], level_present[8];
+  gint depth = -1;
+
+  rbsp = gst_omx_video_nal_to_rbsp (data, MIN (size, MAX_SPS_SIZE),
+      &rbsp_size);
+  gst_bit_reader_init (&br, rbsp, rbsp_size);
+
+  SKIP_BITS (4);                /* sps_video_parameter_set_id */
+  READ_BITS (max_sub_layers_minus1, 3);
+  SKIP_BITS (1);
+
+  /* profile_tier_level () */
+  SKIP_BITS (96);
+  for (i = 0; i < max_sub_layers_minus1; i++) {
+    READ_BITS (profile_present[i], 1);
+    READ_BITS (level_present[i], 1);
+  }
+  if (max_sub_layers_minus1 > 0)
+    SKIP_BITS (2 * (8 - max_sub_layers_minus1));
+  for (i = 0; i < max_sub_layers_minus1; i++) {
+    if (profile_present[i])
+      SKIP_BITS (88);
+    if (level_present[i])
+      SKIP_BITS (8);
+  }
+
+  READ_UE (v);                  /* sps_seq_parameter_set_id */
+  READ_UE (v);                  /* chroma_format_idc */
+  if (v == 3)
+    SKIP_BITS (1);
+  READ_UE (v);                  /* pic_width_in_luma_samples */
+  READ_UE (v);                  /* pic_height_in_luma_samples */
+  READ_BITS (flag, 1);          /* conformance_window_flag */
+  if (flag) {
+    READ_UE (v);
+    READ_UE (v);
+    READ_UE (v);
+    READ_UE (v);
+  }
+  READ_UE (v);                  /* bit_depth_luma_minus8 */
+  READ_UE (v);                  /* bit_depth_chroma_minus8 */
+  READ_UE (v);                  /* log2_max_pic_order_cnt_lsb_minus4 */
+  READ_BITS (flag, 1);          /* sps_sub_layer_ordering_info_present_flag */
+  for (i = flag ? 0 : max_sub_layers_minus1; i <= max_sub_layers_minus1; i++) {
+    READ_UE (v);                /* sps_max_dec_pic_buffering_minus1 */
+    READ_UE (reorder);          /* sps_max_num_reorder_pics */
+    READ_UE (v);                /* sps_max_latency_increase_plus1 */
+  }
+  depth = MIN (reorder, 16);
+
+done:
+  g_free (rbsp);
+
+  return depth;
+}
+
+/* Take the reorder depth from the SPS. Input is byte-stream, one AU per
+ * buffer */
+static GstFlowReturn
+gst_omx_h265_dec_prepare_frame (GstOMXVideoDec * dec,
+    GstVideoCodecFrame * frame)
+{
+  GstMapInfo map;
+  gsize i;
+
+  if (!gst_buffer_map (frame->input_buffer, &map, GST_MAP_READ))
+    return GST_FLOW_OK;
+
+  for (i = 0; i + 4 < map.size; i++) {
+    guint8 nal_type;
+
+    if (map.data[i] != 0 || map.data[i + 1] != 0 || map.data[i + 2] != 1)
+      continue;
+
+    nal_type = (map.data[i + 3] >> 1) & 0x3f;
+
+    /* The parameter sets precede the first slice */
+    if (nal_type < 32)
+      break;
+
+    if (nal_type == 33) {
+      gint depth = gst_omx_h265_dec_parse_reorder_depth (map.data + i + 5,
+          map.size - i - 5);
+
+      if (depth >= 0 && depth != dec->stream_reorder_depth) {
+        GST_DEBUG_OBJECT (dec, "Stream reorder depth %d", depth);
+        dec->stream_reorder_depth = depth;
+      }
+    }
+    i += 4;
+  }
+
+  gst_buffer_unmap (frame->input_buffer, &map);
+
+  return GST_FLOW_OK;
+}
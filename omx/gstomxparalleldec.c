@@ -0,0 +1,993 @@
+/*
+ * Copyright (C) 2017, Renesas Electronics Corporation
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation
+ * version 2.1 of the License.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301 USA
+ *
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <gst/gst.h>
+#include <string.h>
+
+#include "gstomxparalleldec.h"
+
+GST_DEBUG_CATEGORY_STATIC (gst_omx_parallel_dec_debug_category);
+#define GST_CAT_DEFAULT gst_omx_parallel_dec_debug_category
+
+/* prototypes */
+static void gst_omx_parallel_dec_finalize (GObject * object);
+static void gst_omx_parallel_dec_set_property (GObject * object,
+    guint prop_id, const GValue * value, GParamSpec * pspec);
+static void gst_omx_parallel_dec_get_property (GObject * object,
+    guint prop_id, GValue * value, GParamSpec * pspec);
+static GstStateChangeReturn
+gst_omx_parallel_dec_change_state (GstElement * element,
+    GstStateChange transition);
+
+static GstFlowReturn gst_omx_parallel_dec_chain (GstPad * pad,
+    GstObject * parent, GstBuffer * buffer);
+static gboolean gst_omx_parallel_dec_sink_event (GstPad * pad,
+    GstObject * parent, GstEvent * event);
+static gboolean gst_omx_parallel_dec_sink_query (GstPad * pad,
+    GstObject * parent, GstQuery * query);
+static gboolean gst_omx_parallel_dec_src_event (GstPad * pad,
+    GstObject * parent, GstEvent * event);
+static gboolean gst_omx_parallel_dec_src_query (GstPad * pad,
+    GstObject * parent, GstQuery * query);
+
+enum
+{
+  PROP_0,
+  PROP_DECODER,
+  PROP_N_DECODERS
+};
+
+#define DEFAULT_DECODER "omxh264dec"
+#define DEFAULT_N_DECODERS 2
+/* GOPs in flight for each decoder. A decoder only outputs the last
+ * pictures of a GOP once it got the IDR picture of its next one */
+#define GOPS_PER_DECODER 2
+
+static GstStaticPadTemplate sink_template = GST_STATIC_PAD_TEMPLATE ("sink",
+    GST_PAD_SINK,
+    GST_PAD_ALWAYS,
+    GST_STATIC_CAPS ("video/x-h264, "
+        "alignment=(string) au, " "stream-format=(string) byte-stream"));
+
+static GstStaticPadTemplate src_template = GST_STATIC_PAD_TEMPLATE ("src",
+    GST_PAD_SRC,
+    GST_PAD_ALWAYS,
+    GST_STATIC_CAPS_ANY);
+
+/* class initialization */
+
+#define DEBUG_INIT \
+  GST_DEBUG_CATEGORY_INIT (gst_omx_parallel_dec_debug_category, \
+      "omxparalleldec", 0, "debug category for gst-omx parallel video decoder");
+
+G_DEFINE_TYPE_WITH_CODE (GstOMXParallelDec, gst_omx_parallel_dec, GST_TYPE_BIN,
+    DEBUG_INIT);
+
+static void
+gst_omx_parallel_dec_class_init (GstOMXParallelDecClass * klass)
+{
+  GObjectClass *gobject_class = G_OBJECT_CLASS (klass);
+  GstElementClass *element_class = GST_ELEMENT_CLASS (klass);
+
+  gobject_class->finalize = gst_omx_parallel_dec_finalize;
+  gobject_class->set_property = gst_omx_parallel_dec_set_property;
+  gobject_class->get_property = gst_omx_parallel_dec_get_property;
+
+  g_object_class_install_property (gobject_class, PROP_DECODER,
+      g_param_spec_string ("decoder", "Decoder",
+          "Factory name of the decoders", DEFAULT_DECODER,
+          G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS |
+          GST_PARAM_MUTABLE_READY));
+  g_object_class_install_property (gobject_class, PROP_N_DECODERS,
+      g_param_spec_uint ("n-decoders", "Number of decoders",
+          "Number of decoders the GOPs are distributed to, usually the "
+          "number of hardware decoding engines", 1, 16, DEFAULT_N_DECODERS,
+          G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS |
+          GST_PARAM_MUTABLE_READY));
+
+  element_class->change_state =
+      GST_DEBUG_FUNCPTR (gst_omx_parallel_dec_change_state);
+
+  gst_element_class_add_pad_template (element_class,
+      gst_static_pad_template_get (&sink_template));
+  gst_element_class_add_pad_template (element_class,
+      gst_static_pad_template_get (&src_template));
+
+  gst_element_class_set_static_metadata (element_class,
+      "OpenMAX H.264 Parallel Video Decoder",
+      "Codec/Decoder/Video",
+      "Decode the GOPs of an H.264 video stream on several decoders",
+      "Renesas Electronics Corporation");
+}
+
+static void
+gst_omx_parallel_dec_init (GstOMXParallelDec * self)
+{
+  self->sinkpad = gst_pad_new_from_static_template (&sink_template, "sink");
+  gst_pad_set_chain_function (self->sinkpad,
+      GST_DEBUG_FUNCPTR (gst_omx_parallel_dec_chain));
+  gst_pad_set_event_function (self->sinkpad,
+      GST_DEBUG_FUNCPTR (gst_omx_parallel_dec_sink_event));
+  gst_pad_set_query_function (self->sinkpad,
+      GST_DEBUG_FUNCPTR (gst_omx_parallel_dec_sink_query));
+  gst_element_add_pad (GST_ELEMENT_CAST (self), self->sinkpad);
+
+  self->srcpad = gst_pad_new_from_static_template (&src_template, "src");
+  gst_pad_set_event_function (self->srcpad,
+      GST_DEBUG_FUNCPTR (gst_omx_parallel_dec_src_event));
+  gst_pad_set_query_function (self->srcpad,
+      GST_DEBUG_FUNCPTR (gst_omx_parallel_dec_src_query));
+  gst_pad_use_fixed_caps (self->srcpad);
+  gst_element_add_pad (GST_ELEMENT_CAST (self), self->srcpad);
+
+  self->decoder_name = g_strdup (DEFAULT_DECODER);
+  self->n_decoders = DEFAULT_N_DECODERS;
+  self->streams = g_ptr_array_new ();
+
+  g_mutex_init (&self->lock);
+  g_cond_init (&self->cond);
+  g_mutex_init (&self->push_lock);
+  g_queue_init (&self->gops);
+  self->flow_ret = GST_FLOW_OK;
+}
+
+static void
+gst_omx_parallel_dec_finalize (GObject * object)
+{
+  GstOMXParallelDec *self = GST_OMX_PARALLEL_DEC (object);
+
+  g_free (self->decoder_name);
+  g_ptr_array_free (self->streams, TRUE);
+  if (self->sps)
+    g_byte_array_unref (self->sps);
+  if (self->pps)
+    g_byte_array_unref (self->pps);
+  g_mutex_clear (&self->lock);
+  g_cond_clear (&self->cond);
+  g_mutex_clear (&self->push_lock);
+
+  G_OBJECT_CLASS (gst_omx_parallel_dec_parent_class)->finalize (object);
+}
+
+static void
+gst_omx_parallel_dec_gop_free (GstOMXParallelDecGop * gop)
+{
+  GstBuffer *buf;
+
+  while ((buf = g_queue_pop_head (&gop->buffers)))
+    gst_buffer_unref (buf);
+  g_free (gop);
+}
+
+/* Takes the pictures of the first GOPs as far as they are decoded. Called
+ * with the lock */
+static void
+gst_omx_parallel_dec_advance (GstOMXParallelDec * self, GQueue * ready)
+{
+  GstOMXParallelDecGop *gop;
+  GstBuffer *buf;
+
+  while ((gop = g_queue_peek_head (&self->gops))) {
+    while ((buf = g_queue_pop_head (&gop->buffers))) {
+      if (self->flow_ret == GST_FLOW_OK)
+        g_queue_push_tail (ready, buf);
+      else
+        gst_buffer_unref (buf);
+    }
+
+    if (!gop->complete)
+      break;
+
+    GST_LOG_OBJECT (self, "GOP %u output", gop->index);
+    g_queue_pop_head (&self->gops);
+    gst_omx_parallel_dec_gop_free (gop);
+    g_cond_broadcast (&self->cond);
+  }
+}
+
+/* Pushes the pictures that are ready. The push lock keeps the pushes from
+ * the decoder threads in order, the lock is only held to take the pictures
+ * so that a flush isn't blocked by downstream. Called with the push lock */
+static GstFlowReturn
+gst_omx_parallel_dec_push_ready (GstOMXParallelDec * self)
+{
+  GQueue ready = G_QUEUE_INIT;
+  GstFlowReturn ret;
+  GstBuffer *buf;
+
+  g_mutex_lock (&self->lock);
+  gst_omx_parallel_dec_advance (self, &ready);
+  ret = self->flow_ret;
+  g_mutex_unlock (&self->lock);
+
+  while ((buf = g_queue_pop_head (&ready))) {
+    if (ret == GST_FLOW_OK)
+      ret = gst_pad_push (self->srcpad, buf);
+    else
+      gst_buffer_unref (buf);
+  }
+
+  if (ret != GST_FLOW_OK) {
+    g_mutex_lock (&self->lock);
+    if (self->flow_ret == GST_FLOW_OK && !self->flushing)
+      self->flow_ret = ret;
+    g_cond_broadcast (&self->cond);
+    g_mutex_unlock (&self->lock);
+  }
+
+  return ret;
+}
+
+static void
+gst_omx_parallel_dec_complete_gop (GstOMXParallelDec * self,
+    GstOMXParallelDecGop * gop)
+{
+  GST_LOG_OBJECT (self, "GOP %u decoded, %u of %u pictures", gop->index,
+      gop->n_decoded, gop->n_frames);
+
+  gop->complete = TRUE;
+  g_queue_remove (&gop->stream->gops, gop);
+}
+
+/* Called with the lock when the next IDR picture or EOS arrives. The
+ * pictures this makes ready are pushed by the next push_ready() */
+static void
+gst_omx_parallel_dec_close_gop (GstOMXParallelDec * self)
+{
+  GstOMXParallelDecGop *gop = self->current_gop;
+
+  if (!gop)
+    return;
+
+  gop->closed = TRUE;
+  if (gop->n_decoded >= gop->n_frames)
+    gst_omx_parallel_dec_complete_gop (self, gop);
+  self->current_gop = NULL;
+}
+
+/* Called with the lock */
+static void
+gst_omx_parallel_dec_reset (GstOMXParallelDec * self)
+{
+  GstOMXParallelDecGop *gop;
+  guint i;
+
+  while ((gop = g_queue_pop_head (&self->gops)))
+    gst_omx_parallel_dec_gop_free (gop);
+  for (i = 0; i < self->streams->len; i++) {
+    GstOMXParallelDecStream *stream = g_ptr_array_index (self->streams, i);
+
+    g_queue_clear (&stream->gops);
+    stream->eos = FALSE;
+    /* The decoders may forget the parameter sets when flushing */
+    stream->param_sets_cookie = 0;
+  }
+
+  self->current_gop = NULL;
+  self->next_gop_index = 0;
+  self->n_eos = 0;
+  self->flow_ret = GST_FLOW_OK;
+}
+
+static void
+gst_omx_parallel_dec_set_flushing (GstOMXParallelDec * self,
+    gboolean flushing)
+{
+  g_mutex_lock (&self->lock);
+  self->flushing = flushing;
+  if (!flushing)
+    gst_omx_parallel_dec_reset (self);
+  g_cond_broadcast (&self->cond);
+  g_mutex_unlock (&self->lock);
+}
+
+/* Only forwards the sticky events of the first decoder, the others output
+ * the same ones */
+static gboolean
+gst_omx_parallel_dec_is_new_event (GstOMXParallelDec * self,
+    GstEvent * event)
+{
+  GstEvent *current;
+  gboolean ret;
+
+  current = gst_pad_get_sticky_event (self->srcpad, GST_EVENT_TYPE (event), 0);
+  if (!current)
+    return TRUE;
+
+  switch (GST_EVENT_TYPE (event)) {
+    case GST_EVENT_CAPS:{
+      GstCaps *caps, *current_caps;
+
+      gst_event_parse_caps (event, &caps);
+      gst_event_parse_caps (current, &current_caps);
+      ret = !gst_caps_is_equal (caps, current_caps);
+      break;
+    }
+    case GST_EVENT_SEGMENT:{
+      const GstSegment *segment, *current_segment;
+
+      gst_event_parse_segment (event, &segment);
+      gst_event_parse_segment (current, &current_segment);
+      ret = segment->format != current_segment->format
+          || segment->rate != current_segment->rate
+          || segment->base != current_segment->base
+          || segment->start != current_segment->start
+          || segment->stop != current_segment->stop
+          || segment->time != current_segment->time;
+      break;
+    }
+    default:
+      ret = !gst_structure_is_equal (gst_event_get_structure (event),
+          gst_event_get_structure (current));
+      break;
+  }
+  gst_event_unref (current);
+
+  return ret;
+}
+
+static GstFlowReturn
+gst_omx_parallel_dec_stream_chain (GstPad * pad, GstObject * parent,
+    GstBuffer * buffer)
+{
+  GstOMXParallelDecStream *stream = gst_pad_get_element_private (pad);
+  GstOMXParallelDec *self = stream->dec;
+  GstOMXParallelDecGop *gop;
+  GstClockTime pts = GST_BUFFER_PTS (buffer);
+  GstFlowReturn ret;
+
+  g_mutex_lock (&self->lock);
+  if (self->flushing) {
+    g_mutex_unlock (&self->lock);
+    gst_buffer_unref (buffer);
+    return GST_FLOW_FLUSHING;
+  }
+
+  /* A picture after the end of the oldest GOP means that the decoder
+   * dropped some of its pictures */
+  while ((gop = g_queue_peek_head (&stream->gops)) && gop->closed
+      && GST_CLOCK_TIME_IS_VALID (pts)
+      && GST_CLOCK_TIME_IS_VALID (gop->max_pts) && pts > gop->max_pts)
+    gst_omx_parallel_dec_complete_gop (self, gop);
+
+  if (!gop) {
+    GST_WARNING_OBJECT (self, "Dropping picture outside of any GOP");
+    gst_buffer_unref (buffer);
+  } else {
+    gop->n_decoded++;
+    g_queue_push_tail (&gop->buffers, buffer);
+    if (gop->closed && gop->n_decoded >= gop->n_frames)
+      gst_omx_parallel_dec_complete_gop (self, gop);
+  }
+  g_mutex_unlock (&self->lock);
+
+  g_mutex_lock (&self->push_lock);
+  ret = gst_omx_parallel_dec_push_ready (self);
+  g_mutex_unlock (&self->push_lock);
+
+  return ret;
+}
+
+static gboolean
+gst_omx_parallel_dec_stream_sink_event (GstPad * pad, GstObject * parent,
+    GstEvent * event)
+{
+  GstOMXParallelDecStream *stream = gst_pad_get_element_private (pad);
+  GstOMXParallelDec *self = stream->dec;
+  GstOMXParallelDecGop *gop;
+  gboolean ret = TRUE;
+
+  switch (GST_EVENT_TYPE (event)) {
+    case GST_EVENT_EOS:{
+      gboolean all_eos;
+
+      g_mutex_lock (&self->push_lock);
+      g_mutex_lock (&self->lock);
+      while ((gop = g_queue_peek_head (&stream->gops)))
+        gst_omx_parallel_dec_complete_gop (self, gop);
+      if (!stream->eos) {
+        stream->eos = TRUE;
+        self->n_eos++;
+      }
+      all_eos = self->n_eos == self->streams->len;
+      g_mutex_unlock (&self->lock);
+
+      gst_omx_parallel_dec_push_ready (self);
+      if (all_eos)
+        ret = gst_pad_push_event (self->srcpad, event);
+      else
+        gst_event_unref (event);
+      g_mutex_unlock (&self->push_lock);
+      break;
+    }
+    case GST_EVENT_STREAM_START:
+    case GST_EVENT_CAPS:
+    case GST_EVENT_SEGMENT:
+      g_mutex_lock (&self->push_lock);
+      if (gst_omx_parallel_dec_is_new_event (self, event))
+        ret = gst_pad_push_event (self->srcpad, event);
+      else
+        gst_event_unref (event);
+      g_mutex_unlock (&self->push_lock);
+      break;
+    default:
+      /* Flushes are forwarded from the sink pad */
+      gst_event_unref (event);
+      break;
+  }
+
+  return ret;
+}
+
+static gboolean
+gst_omx_parallel_dec_stream_sink_query (GstPad * pad, GstObject * parent,
+    GstQuery * query)
+{
+  GstOMXParallelDecStream *stream = gst_pad_get_element_private (pad);
+
+  return gst_pad_peer_query (stream->dec->srcpad, query);
+}
+
+static gboolean
+gst_omx_parallel_dec_stream_src_event (GstPad * pad, GstObject * parent,
+    GstEvent * event)
+{
+  /* Seeks come from downstream, and there is no QoS for offline
+   * decoding */
+  gst_event_unref (event);
+  return TRUE;
+}
+
+static gboolean
+gst_omx_parallel_dec_stream_src_query (GstPad * pad, GstObject * parent,
+    GstQuery * query)
+{
+  GstOMXParallelDecStream *stream = gst_pad_get_element_private (pad);
+
+  return gst_pad_peer_query (stream->dec->sinkpad, query);
+}
+
+static void
+gst_omx_parallel_dec_stream_free (GstOMXParallelDec * self,
+    GstOMXParallelDecStream * stream)
+{
+  gst_element_set_state (stream->decoder, GST_STATE_NULL);
+  gst_element_set_state (stream->queue, GST_STATE_NULL);
+  gst_bin_remove (GST_BIN_CAST (self), stream->decoder);
+  gst_bin_remove (GST_BIN_CAST (self), stream->queue);
+  gst_object_unref (stream->srcpad);
+  gst_object_unref (stream->sinkpad);
+  g_queue_clear (&stream->gops);
+  g_free (stream);
+}
+
+static GstOMXParallelDecStream *
+gst_omx_parallel_dec_stream_new (GstOMXParallelDec * self, guint index)
+{
+  GstOMXParallelDecStream *stream;
+  GstElement *queue, *decoder;
+  GstPad *pad;
+  gchar *name;
+
+  name = g_strdup_printf ("dec_%u", index);
+  decoder = gst_element_factory_make (self->decoder_name, name);
+  g_free (name);
+  if (!decoder)
+    return NULL;
+
+  name = g_strdup_printf ("queue_%u", index);
+  queue = gst_element_factory_make ("queue", name);
+  g_free (name);
+  if (!queue) {
+    gst_object_unref (decoder);
+    return NULL;
+  }
+  /* The input is already bounded to GOPS_PER_DECODER GOPs for each
+   * decoder, the queue must hold them without blocking the others */
+  g_object_set (queue, "max-size-buffers", 0, "max-size-bytes", 0,
+      "max-size-time", G_GUINT64_CONSTANT (0), NULL);
+
+  stream = g_new0 (GstOMXParallelDecStream, 1);
+  stream->dec = self;
+  stream->queue = queue;
+  stream->decoder = decoder;
+  g_queue_init (&stream->gops);
+
+  /* The internal pads have no parent, they are found from their private
+   * data */
+  stream->srcpad = gst_pad_new ("src", GST_PAD_SRC);
+  gst_pad_set_element_private (stream->srcpad, stream);
+  gst_pad_set_event_function (stream->srcpad,
+      GST_DEBUG_FUNCPTR (gst_omx_parallel_dec_stream_src_event));
+  gst_pad_set_query_function (stream->srcpad,
+      GST_DEBUG_FUNCPTR (gst_omx_parallel_dec_stream_src_query));
+
+  stream->sinkpad = gst_pad_new ("sink", GST_PAD_SINK);
+  gst_pad_set_element_private (stream->sinkpad, stream);
+  gst_pad_set_chain_function (stream->sinkpad,
+      GST_DEBUG_FUNCPTR (gst_omx_parallel_dec_stream_chain));
+  gst_pad_set_event_function (stream->sinkpad,
+      GST_DEBUG_FUNCPTR (gst_omx_parallel_dec_stream_sink_event));
+  gst_pad_set_query_function (stream->sinkpad,
+      GST_DEBUG_FUNCPTR (gst_omx_parallel_dec_stream_sink_query));
+
+  gst_bin_add (GST_BIN_CAST (self), queue);
+  gst_bin_add (GST_BIN_CAST (self), decoder);
+  gst_element_link (queue, decoder);
+
+  pad = gst_element_get_static_pad (queue, "sink");
+  gst_pad_link (stream->srcpad, pad);
+  gst_object_unref (pad);
+  pad = gst_element_get_static_pad (decoder, "src");
+  gst_pad_link (pad, stream->sinkpad);
+  gst_object_unref (pad);
+
+  return stream;
+}
+
+static gboolean
+gst_omx_parallel_dec_create_streams (GstOMXParallelDec * self)
+{
+  guint i;
+
+  for (i = 0; i < self->n_decoders; i++) {
+    GstOMXParallelDecStream *stream;
+
+    stream = gst_omx_parallel_dec_stream_new (self, i);
+    if (!stream) {
+      GST_ELEMENT_ERROR (self, CORE, MISSING_PLUGIN, (NULL),
+          ("Could not create decoder '%s'", self->decoder_name));
+      return FALSE;
+    }
+    g_ptr_array_add (self->streams, stream);
+  }
+
+  return TRUE;
+}
+
+static void
+gst_omx_parallel_dec_destroy_streams (GstOMXParallelDec * self)
+{
+  guint i;
+
+  for (i = 0; i < self->streams->len; i++)
+    gst_omx_parallel_dec_stream_free (self,
+        g_ptr_array_index (self->streams, i));
+  g_ptr_array_set_size (self->streams, 0);
+}
+
+static void
+gst_omx_parallel_dec_activate_streams (GstOMXParallelDec * self,
+    gboolean active)
+{
+  guint i;
+
+  for (i = 0; i < self->streams->len; i++) {
+    GstOMXParallelDecStream *stream = g_ptr_array_index (self->streams, i);
+
+    gst_pad_set_active (stream->srcpad, active);
+    gst_pad_set_active (stream->sinkpad, active);
+  }
+}
+
+static GstStateChangeReturn
+gst_omx_parallel_dec_change_state (GstElement * element,
+    GstStateChange transition)
+{
+  GstOMXParallelDec *self = GST_OMX_PARALLEL_DEC (element);
+  GstStateChangeReturn ret;
+
+  switch (transition) {
+    case GST_STATE_CHANGE_NULL_TO_READY:
+      if (!gst_omx_parallel_dec_create_streams (self)) {
+        gst_omx_parallel_dec_destroy_streams (self);
+        return GST_STATE_CHANGE_FAILURE;
+      }
+      break;
+    case GST_STATE_CHANGE_READY_TO_PAUSED:
+      gst_omx_parallel_dec_set_flushing (self, FALSE);
+      gst_omx_parallel_dec_activate_streams (self, TRUE);
+      break;
+    case GST_STATE_CHANGE_PAUSED_TO_READY:
+      gst_omx_parallel_dec_set_flushing (self, TRUE);
+      break;
+    default:
+      break;
+  }
+
+  ret =
+      GST_ELEMENT_CLASS (gst_omx_parallel_dec_parent_class)->change_state
+      (element, transition);
+
+  if (ret == GST_STATE_CHANGE_FAILURE)
+    return ret;
+
+  switch (transition) {
+    case GST_STATE_CHANGE_PAUSED_TO_READY:
+      gst_omx_parallel_dec_activate_streams (self, FALSE);
+      g_mutex_lock (&self->lock);
+      gst_omx_parallel_dec_reset (self);
+      g_mutex_unlock (&self->lock);
+      if (self->sps)
+        g_byte_array_unref (self->sps);
+      self->sps = NULL;
+      if (self->pps)
+        g_byte_array_unref (self->pps);
+      self->pps = NULL;
+      break;
+    case GST_STATE_CHANGE_READY_TO_NULL:
+      gst_omx_parallel_dec_destroy_streams (self);
+      break;
+    default:
+      break;
+  }
+
+  return ret;
+}
+
+static const guint8 start_code[] = { 0, 0, 0, 1 };
+
+/* Offset of the next 3 byte start code from offset on, size if none */
+static gsize
+gst_omx_parallel_dec_find_start_code (const guint8 * data, gsize size,
+    gsize offset)
+{
+  for (; offset + 3 <= size; offset++) {
+    if (data[offset] == 0 && data[offset + 1] == 0 && data[offset + 2] == 1)
+      return offset;
+  }
+
+  return size;
+}
+
+/* Replaces the stored parameter sets of one kind, called with the NALs of
+ * that kind found in an AU */
+static void
+gst_omx_parallel_dec_update_param_sets (GstOMXParallelDec * self,
+    GByteArray ** stored, GByteArray * found)
+{
+  if (*stored && (*stored)->len == found->len
+      && memcmp ((*stored)->data, found->data, found->len) == 0) {
+    g_byte_array_unref (found);
+    return;
+  }
+
+  if (*stored)
+    g_byte_array_unref (*stored);
+  *stored = found;
+  self->param_sets_cookie++;
+}
+
+/* Only an IDR picture starts a GOP that decodes on its own, other
+ * keyframes may be followed by pictures referencing the previous GOP. The
+ * input is byte-stream, one AU per buffer, the first slice decides. The
+ * SPS and PPS NALs before it are stored, has_param_sets is set if the AU
+ * carries both */
+static gboolean
+gst_omx_parallel_dec_scan (GstOMXParallelDec * self, GstBuffer * buffer,
+    gboolean * has_param_sets)
+{
+  GByteArray *sps = NULL, *pps = NULL;
+  GstMapInfo map;
+  gboolean ret = FALSE;
+  gsize i;
+
+  *has_param_sets = FALSE;
+
+  if (!gst_buffer_map (buffer, &map, GST_MAP_READ))
+    return FALSE;
+
+  i = gst_omx_parallel_dec_find_start_code (map.data, map.size, 0);
+  while (i + 3 < map.size) {
+    gsize nal = i + 3, end;
+    guint8 nal_type;
+
+    end = gst_omx_parallel_dec_find_start_code (map.data, map.size, nal);
+    nal_type = map.data[nal] & 0x1f;
+
+    if (nal_type >= 1 && nal_type <= 5) {
+      ret = nal_type == 5;
+      break;
+    } else if (nal_type == 7 || nal_type == 8) {
+      GByteArray **sets = nal_type == 7 ? &sps : &pps;
+      gsize len = end - nal;
+
+      /* Leading zero of the next 4 byte start code */
+      while (len > 1 && map.data[nal + len - 1] == 0)
+        len--;
+
+      if (!*sets)
+        *sets = g_byte_array_new ();
+      g_byte_array_append (*sets, start_code, sizeof (start_code));
+      g_byte_array_append (*sets, map.data + nal, len);
+    }
+    i = end;
+  }
+
+  gst_buffer_unmap (buffer, &map);
+
+  *has_param_sets = sps && pps;
+  if (sps)
+    gst_omx_parallel_dec_update_param_sets (self, &self->sps, sps);
+  if (pps)
+    gst_omx_parallel_dec_update_param_sets (self, &self->pps, pps);
+
+  return ret;
+}
+
+/* Puts the stored parameter sets in front of an IDR picture for a decoder
+ * that didn't get them yet */
+static GstBuffer *
+gst_omx_parallel_dec_prepend_param_sets (GstOMXParallelDec * self,
+    GstBuffer * buffer)
+{
+  GstMemory *mem;
+  GstMapInfo map;
+
+  mem = gst_allocator_alloc (NULL, self->sps->len + self->pps->len, NULL);
+  if (!mem || !gst_memory_map (mem, &map, GST_MAP_WRITE)) {
+    if (mem)
+      gst_memory_unref (mem);
+    return buffer;
+  }
+  memcpy (map.data, self->sps->data, self->sps->len);
+  memcpy (map.data + self->sps->len, self->pps->data, self->pps->len);
+  gst_memory_unmap (mem, &map);
+
+  buffer = gst_buffer_make_writable (buffer);
+  gst_buffer_prepend_memory (buffer, mem);
+
+  return buffer;
+}
+
+static GstFlowReturn
+gst_omx_parallel_dec_chain (GstPad * pad, GstObject * parent,
+    GstBuffer * buffer)
+{
+  GstOMXParallelDec *self = GST_OMX_PARALLEL_DEC (parent);
+  GstOMXParallelDecStream *stream;
+  GstOMXParallelDecGop *gop;
+  GstClockTime pts;
+  GstFlowReturn ret;
+  gboolean is_idr, has_param_sets;
+
+  /* The decoders output the DTS if there is no PTS */
+  pts = GST_BUFFER_PTS (buffer);
+  if (!GST_CLOCK_TIME_IS_VALID (pts))
+    pts = GST_BUFFER_DTS (buffer);
+
+  is_idr = gst_omx_parallel_dec_scan (self, buffer, &has_param_sets);
+
+  g_mutex_lock (&self->lock);
+  if (is_idr) {
+    guint max_gops = GOPS_PER_DECODER * self->streams->len;
+
+    /* Bounds the pictures held back until the previous GOPs are output */
+    while (g_queue_get_length (&self->gops) >= max_gops && !self->flushing
+        && self->flow_ret == GST_FLOW_OK)
+      g_cond_wait (&self->cond, &self->lock);
+
+    if (self->flushing || self->flow_ret != GST_FLOW_OK) {
+      ret = self->flushing ? GST_FLOW_FLUSHING : self->flow_ret;
+      g_mutex_unlock (&self->lock);
+      gst_buffer_unref (buffer);
+      return ret;
+    }
+
+    gst_omx_parallel_dec_close_gop (self);
+
+    gop = g_new0 (GstOMXParallelDecGop, 1);
+    gop->index = self->next_gop_index++;
+    gop->stream =
+        g_ptr_array_index (self->streams, gop->index % self->streams->len);
+    gop->max_pts = GST_CLOCK_TIME_NONE;
+    g_queue_init (&gop->buffers);
+    g_queue_push_tail (&self->gops, gop);
+    g_queue_push_tail (&gop->stream->gops, gop);
+    self->current_gop = gop;
+
+    GST_LOG_OBJECT (self, "GOP %u on %s", gop->index,
+        GST_ELEMENT_NAME (gop->stream->decoder));
+  } else if (!self->current_gop) {
+    GST_DEBUG_OBJECT (self, "Dropping frame before the first IDR picture");
+    g_mutex_unlock (&self->lock);
+    gst_buffer_unref (buffer);
+    return GST_FLOW_OK;
+  }
+
+  gop = self->current_gop;
+  gop->n_frames++;
+  if (GST_CLOCK_TIME_IS_VALID (pts) && (!GST_CLOCK_TIME_IS_VALID (gop->max_pts)
+          || pts > gop->max_pts))
+    gop->max_pts = pts;
+  stream = gop->stream;
+  g_mutex_unlock (&self->lock);
+
+  if (is_idr && stream->param_sets_cookie != self->param_sets_cookie) {
+    /* Only the decoder of the GOP with the parameter sets got them from
+     * upstream */
+    if (!has_param_sets && self->sps && self->pps) {
+      GST_LOG_OBJECT (self, "Sending parameter sets to %s",
+          GST_ELEMENT_NAME (stream->decoder));
+      buffer = gst_omx_parallel_dec_prepend_param_sets (self, buffer);
+    }
+    stream->param_sets_cookie = self->param_sets_cookie;
+  }
+
+  if (is_idr) {
+    /* Closing the previous GOP may have completed it */
+    g_mutex_lock (&self->push_lock);
+    ret = gst_omx_parallel_dec_push_ready (self);
+    g_mutex_unlock (&self->push_lock);
+    if (ret != GST_FLOW_OK) {
+      gst_buffer_unref (buffer);
+      return ret;
+    }
+  }
+
+  ret = gst_pad_push (stream->srcpad, buffer);
+  if (ret != GST_FLOW_OK)
+    return ret;
+
+  g_mutex_lock (&self->lock);
+  ret = self->flow_ret;
+  g_mutex_unlock (&self->lock);
+
+  return ret;
+}
+
+static void
+gst_omx_parallel_dec_forward_event (GstOMXParallelDec * self,
+    GstEvent * event)
+{
+  guint i;
+
+  for (i = 0; i < self->streams->len; i++) {
+    GstOMXParallelDecStream *stream = g_ptr_array_index (self->streams, i);
+
+    gst_pad_push_event (stream->srcpad, gst_event_ref (event));
+  }
+  gst_event_unref (event);
+}
+
+static gboolean
+gst_omx_parallel_dec_sink_event (GstPad * pad, GstObject * parent,
+    GstEvent * event)
+{
+  GstOMXParallelDec *self = GST_OMX_PARALLEL_DEC (parent);
+
+  switch (GST_EVENT_TYPE (event)) {
+    case GST_EVENT_FLUSH_START:
+      gst_omx_parallel_dec_set_flushing (self, TRUE);
+      gst_omx_parallel_dec_forward_event (self, gst_event_ref (event));
+      return gst_pad_push_event (self->srcpad, event);
+    case GST_EVENT_FLUSH_STOP:
+      gst_omx_parallel_dec_forward_event (self, gst_event_ref (event));
+      gst_omx_parallel_dec_set_flushing (self, FALSE);
+      return gst_pad_push_event (self->srcpad, event);
+    case GST_EVENT_EOS:
+      /* EOS goes downstream once all decoders are drained */
+      g_mutex_lock (&self->lock);
+      gst_omx_parallel_dec_close_gop (self);
+      g_mutex_unlock (&self->lock);
+      g_mutex_lock (&self->push_lock);
+      gst_omx_parallel_dec_push_ready (self);
+      g_mutex_unlock (&self->push_lock);
+      gst_omx_parallel_dec_forward_event (self, event);
+      return TRUE;
+    default:
+      if (GST_EVENT_IS_SERIALIZED (event)) {
+        gst_omx_parallel_dec_forward_event (self, event);
+        return TRUE;
+      }
+      return gst_pad_event_default (pad, parent, event);
+  }
+}
+
+static gboolean
+gst_omx_parallel_dec_sink_query (GstPad * pad, GstObject * parent,
+    GstQuery * query)
+{
+  GstOMXParallelDec *self = GST_OMX_PARALLEL_DEC (parent);
+  GstOMXParallelDecStream *stream;
+
+  switch (GST_QUERY_TYPE (query)) {
+    case GST_QUERY_CAPS:
+    case GST_QUERY_ACCEPT_CAPS:
+      if (self->streams->len == 0)
+        break;
+      stream = g_ptr_array_index (self->streams, 0);
+      return gst_pad_peer_query (stream->srcpad, query);
+    default:
+      break;
+  }
+
+  return gst_pad_query_default (pad, parent, query);
+}
+
+static gboolean
+gst_omx_parallel_dec_src_event (GstPad * pad, GstObject * parent,
+    GstEvent * event)
+{
+  GstOMXParallelDec *self = GST_OMX_PARALLEL_DEC (parent);
+
+  return gst_pad_push_event (self->sinkpad, event);
+}
+
+static gboolean
+gst_omx_parallel_dec_src_query (GstPad * pad, GstObject * parent,
+    GstQuery * query)
+{
+  GstOMXParallelDec *self = GST_OMX_PARALLEL_DEC (parent);
+  GstOMXParallelDecStream *stream;
+
+  switch (GST_QUERY_TYPE (query)) {
+    case GST_QUERY_CAPS:
+    case GST_QUERY_ACCEPT_CAPS:
+      if (self->streams->len == 0)
+        return gst_pad_query_default (pad, parent, query);
+      stream = g_ptr_array_index (self->streams, 0);
+      return gst_pad_peer_query (stream->sinkpad, query);
+    default:
+      return gst_pad_peer_query (self->sinkpad, query);
+  }
+}
+
+static void
+gst_omx_parallel_dec_set_property (GObject * object, guint prop_id,
+    const GValue * value, GParamSpec * pspec)
+{
+  GstOMXParallelDec *self = GST_OMX_PARALLEL_DEC (object);
+
+  switch (prop_id) {
+    case PROP_DECODER:
+      g_free (self->decoder_name);
+      self->decoder_name = g_value_dup_string (value);
+      break;
+    case PROP_N_DECODERS:
+      self->n_decoders = g_value_get_uint (value);
+      break;
+    default:
+      G_OBJECT_WARN_INVALID_PROPERTY_ID (object, prop_id, pspec);
+      break;
+  }
+}
+
+static void
+gst_omx_parallel_dec_get_property (GObject * object, guint prop_id,
+    GValue * value, GParamSpec * pspec)
+{
+  GstOMXParallelDec *self = GST_OMX_PARALLEL_DEC (object);
+
+  switch (prop_id) {
+    case PROP_DECODER:
+      g_value_set_string (value, self->decoder_name);
+      break;
+    case PROP_N_DECODERS:
+      g_value_set_uint (value, self->n_decoders);
+      break;
+    default:
+      G_OBJECT_WARN_INVALID_PROPERTY_ID (object, prop_id, pspec);
+      break;
+  }
+}
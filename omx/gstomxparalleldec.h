@@ -0,0 +1,127 @@
+/*
+ * Copyright (C) 2017, Renesas Electronics Corporation
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation
+ * version 2.1 of the License.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301 USA
+ *
+ */
+
+#ifndef __GST_OMX_PARALLEL_DEC_H__
+#define __GST_OMX_PARALLEL_DEC_H__
+
+#include <gst/gst.h>
+
+G_BEGIN_DECLS
+
+#define GST_TYPE_OMX_PARALLEL_DEC \
+  (gst_omx_parallel_dec_get_type())
+#define GST_OMX_PARALLEL_DEC(obj) \
+  (G_TYPE_CHECK_INSTANCE_CAST((obj),GST_TYPE_OMX_PARALLEL_DEC,GstOMXParallelDec))
+#define GST_OMX_PARALLEL_DEC_CLASS(klass) \
+  (G_TYPE_CHECK_CLASS_CAST((klass),GST_TYPE_OMX_PARALLEL_DEC,GstOMXParallelDecClass))
+#define GST_OMX_PARALLEL_DEC_GET_CLASS(obj) \
+  (G_TYPE_INSTANCE_GET_CLASS((obj),GST_TYPE_OMX_PARALLEL_DEC,GstOMXParallelDecClass))
+#define GST_IS_OMX_PARALLEL_DEC(obj) \
+  (G_TYPE_CHECK_INSTANCE_TYPE((obj),GST_TYPE_OMX_PARALLEL_DEC))
+#define GST_IS_OMX_PARALLEL_DEC_CLASS(obj) \
+  (G_TYPE_CHECK_CLASS_TYPE((klass),GST_TYPE_OMX_PARALLEL_DEC))
+
+typedef struct _GstOMXParallelDec GstOMXParallelDec;
+typedef struct _GstOMXParallelDecClass GstOMXParallelDecClass;
+typedef struct _GstOMXParallelDecGop GstOMXParallelDecGop;
+typedef struct _GstOMXParallelDecStream GstOMXParallelDecStream;
+
+/* A group of pictures, from a keyframe up to the next one */
+struct _GstOMXParallelDecGop
+{
+  guint index;
+  GstOMXParallelDecStream *stream;
+  /* Frames passed to the decoder */
+  guint n_frames;
+  GstClockTime max_pts;
+  /* Frames received from the decoder */
+  guint n_decoded;
+  /* TRUE once the next keyframe or EOS was reached */
+  gboolean closed;
+  /* TRUE once the decoder output all pictures of the GOP */
+  gboolean complete;
+  /* Decoded pictures waiting for the previous GOPs */
+  GQueue buffers;
+};
+
+/* One of the decoders, with the internal pads linked to it */
+struct _GstOMXParallelDecStream
+{
+  GstOMXParallelDec *dec;
+  /* Decouples the decoder from the input, so that all decoders work at
+   * the same time */
+  GstElement *queue;
+  GstElement *decoder;
+  /* Feeds the decoder */
+  GstPad *srcpad;
+  /* Receives the decoded pictures */
+  GstPad *sinkpad;
+  /* GOPs whose pictures are still expected, oldest first */
+  GQueue gops;
+  gboolean eos;
+  /* Parameter sets the decoder got, see GstOMXParallelDec, 0 if none */
+  guint param_sets_cookie;
+};
+
+/* Splits the input at IDR pictures and decodes the GOPs on several decoders
+ * in parallel. The pictures are output in the input order */
+struct _GstOMXParallelDec
+{
+  GstBin parent;
+
+  GstPad *sinkpad;
+  GstPad *srcpad;
+
+  /* Factory name and number of the decoders */
+  gchar *decoder_name;
+  guint n_decoders;
+
+  GPtrArray *streams;
+
+  GMutex lock;
+  GCond cond;
+  /* Serializes the pushes downstream, taken before the lock */
+  GMutex push_lock;
+  /* GOPs not output completely yet, the first one is being output */
+  GQueue gops;
+  GstOMXParallelDecGop *current_gop;
+  guint next_gop_index;
+  guint n_eos;
+  gboolean flushing;
+  GstFlowReturn flow_ret;
+
+  /* Most recent SPS and PPS NALs of the input with start codes, sent to
+   * every decoder before its first IDR picture and after they changed.
+   * Streaming thread */
+  GByteArray *sps;
+  GByteArray *pps;
+  /* Incremented when they change */
+  guint param_sets_cookie;
+};
+
+struct _GstOMXParallelDecClass
+{
+  GstBinClass parent_class;
+};
+
+GType gst_omx_parallel_dec_get_type (void);
+
+G_END_DECLS
+
+#endif /* __GST_OMX_PARALLEL_DEC_H__ */
@@ -31,6 +31,122 @@
 GST_DEBUG_CATEGORY (gst_omx_video_debug_category);
 #define GST_CAT_DEFAULT gst_omx_video_debug_category
 
+static gboolean
+gst_omx_video_get_vendor_format (GArray * vendor_formats,
+    OMX_COLOR_FORMATTYPE omx_colorformat, GstOMXVideoVendorFormat * format)
+{
+  guint i;
+
+  for (i = 0; vendor_formats && i < vendor_formats->len; i++) {
+    GstOMXVideoVendorFormat *f =
+        &g_array_index (vendor_formats, GstOMXVideoVendorFormat, i);
+
+    if (f->type == omx_colorformat) {
+      *format = *f;
+      return TRUE;
+    }
+  }
+
+  return FALSE;
+}
+
+/* "<OMX color format>:<GStreamer format>[:<packing or tiling>]", e.g.
+ * "0x7f000100:P010_10LE:packed40" or "0x7f000200:NV12:tiled32x32" */
+static gboolean
+gst_omx_video_parse_vendor_format (const gchar * str,
+    GstOMXVideoVendorFormat * format)
+{
+  gchar **fields;
+  gchar *end;
+  gboolean ret = FALSE;
+
+  fields = g_strsplit (str, ":", 3);
+  if (g_strv_length (fields) < 2)
+    goto done;
+
+  format->type = (OMX_COLOR_FORMATTYPE) g_ascii_strtoull (fields[0], &end, 0);
+  if (end == fields[0] || *end != '\0')
+    goto done;
+
+  format->format = gst_video_format_from_string (fields[1]);
+  if (format->format == GST_VIDEO_FORMAT_UNKNOWN)
+    goto done;
+
+  format->packing = GST_OMX_VIDEO_PACKING_NONE;
+  format->tiling = gst_omx_video_convert_get_tiling (format->format);
+  if (fields[2]) {
+    /* Packed pictures are unpacked to P010 and tiled ones detiled to NV12 */
+    if (g_str_equal (fields[1], "P010_10LE")
+        && g_str_equal (fields[2], "packed40"))
+      format->packing = GST_OMX_VIDEO_PACKING_10BIT_40;
+    else if (g_str_equal (fields[1], "P010_10LE")
+        && g_str_equal (fields[2], "packed32"))
+      format->packing = GST_OMX_VIDEO_PACKING_10BIT_32;
+    else if (g_str_equal (fields[1], "NV12")
+        && g_str_equal (fields[2], "tiled16x16"))
+      format->tiling = GST_OMX_VIDEO_TILING_LINEAR_16X16;
+    else if (g_str_equal (fields[1], "NV12")
+        && g_str_equal (fields[2], "tiled32x32"))
+      format->tiling = GST_OMX_VIDEO_TILING_LINEAR_32X32;
+    else
+      goto done;
+  }
+
+  ret = TRUE;
+
+done:
+  g_strfreev (fields);
+
+  return ret;
+}
+
+/* Returns the vendor specific color formats of the class data, or NULL if
+ * there are none */
+GArray *
+gst_omx_video_parse_vendor_formats (gchar ** formats)
+{
+  GstOMXVideoVendorFormat format;
+  GArray *vendor_formats = NULL;
+
+  for (; *formats; formats++) {
+    if (!gst_omx_video_parse_vendor_format (*formats, &format)) {
+      GST_WARNING ("Invalid vendor color format '%s'", *formats);
+      continue;
+    }
+
+    GST_DEBUG ("Vendor color format 0x%08x is %s (packing %d, tiling %d)",
+        format.type, gst_video_format_to_string (format.format),
+        format.packing, format.tiling);
+
+    if (!vendor_formats)
+      vendor_formats =
+          g_array_new (FALSE, FALSE, sizeof (GstOMXVideoVendorFormat));
+    g_array_append_val (vendor_formats, format);
+  }
+
+  return vendor_formats;
+}
+
+/* Resolves a color format, also a vendor specific one of @vendor_formats,
+ * into the GStreamer format and how its samples are packed and tiled.
+ * Vendor specific packings and tilings are reported as the unpacked and
+ * detiled format */
+gboolean
+gst_omx_video_resolve_format (GArray * vendor_formats,
+    OMX_COLOR_FORMATTYPE omx_colorformat, GstOMXVideoVendorFormat * format)
+{
+  if (gst_omx_video_get_vendor_format (vendor_formats, omx_colorformat,
+          format))
+    return TRUE;
+
+  format->type = omx_colorformat;
+  format->format = gst_omx_video_get_format_from_omx (omx_colorformat);
+  format->packing = GST_OMX_VIDEO_PACKING_NONE;
+  format->tiling = gst_omx_video_convert_get_tiling (format->format);
+
+  return format->format != GST_VIDEO_FORMAT_UNKNOWN;
+}
+
 GstVideoFormat
 gst_omx_video_get_format_from_omx (OMX_COLOR_FORMATTYPE omx_colorformat)
 {
@@ -85,7 +201,7 @@ gst_omx_video_get_format_from_omx (OMX_COLOR_FORMATTYPE omx_colorformat)
 
 GList *
 gst_omx_video_get_supported_colorformats (GstOMXPort * port,
-    GstVideoCodecState * state)
+    GstVideoCodecState * state, GArray * vendor_formats)
 {
   GstOMXComponent *comp = port->comp;
   OMX_VIDEO_PARAM_PORTFORMATTYPE param;
@@ -93,6 +209,7 @@ gst_omx_video_get_supported_colorformats (GstOMXPort * port,
   GList *negotiation_map = NULL;
   gint old_index;
   GstOMXVideoNegotiationMap *m;
+  GstOMXVideoVendorFormat vf;
   GstVideoFormat f;
 
   GST_OMX_INIT_STRUCT (&param);
@@ -117,7 +234,8 @@ gst_omx_video_get_supported_colorformats (GstOMXPort * port,
       break;
 
     if (err == OMX_ErrorNone || err == OMX_ErrorNoMore) {
-      f = gst_omx_video_get_format_from_omx (param.eColorFormat);
+      gst_omx_video_resolve_format (vendor_formats, param.eColorFormat, &vf);
+      f = vf.format;
 
       if (f != GST_VIDEO_FORMAT_UNKNOWN) {
         m = g_slice_new (GstOMXVideoNegotiationMap);
@@ -196,3 +314,65 @@ gst_omx_video_find_nearest_frame (GstOMXBuffer * buf, GList * frames)
 
   return best;
 }
+
+/* Copy of the payload of a NAL unit without its emulation prevention bytes,
+ * free with g_free() */
+guint8 *
+gst_omx_video_nal_to_rbsp (const guint8 * data, gsize size, gsize * rbsp_size)
+{
+  guint8 *rbsp = g_malloc (size);
+  guint zeros = 0;
+  gsize i, n = 0;
+
+  for (i = 0; i < size; i++) {
+    if (zeros >= 2 && data[i] == 0x03) {
+      zeros = 0;
+      continue;
+    }
+    zeros = data[i] == 0 ? zeros + 1 : 0;
+    rbsp[n++] = data[i];
+  }
+
+  *rbsp_size = n;
+
+  return rbsp;
+}
+
+/* Exp-Golomb coded unsigned integer */
+gboolean
+gst_omx_video_read_ue (GstBitReader * br, guint32 * value)
+{
+  guint zeros = 0;
+  guint32 suffix;
+  guint8 bit;
+
+  for (;;) {
+    if (!gst_bit_reader_get_bits_uint8 (br, &bit, 1))
+      return FALSE;
+    if (bit)
+      break;
+    if (++zeros > 31)
+      return FALSE;
+  }
+
+  if (!gst_bit_reader_get_bits_uint32 (br, &suffix, zeros))
+    return FALSE;
+
+  *value = ((1U << zeros) - 1) + suffix;
+
+  return TRUE;
+}
+
+/* Exp-Golomb coded signed integer */
+gboolean
+gst_omx_video_read_se (GstBitReader * br, gint32 * value)
+{
+  guint32 v;
+
+  if (!gst_omx_video_read_ue (br, &v))
+    return FALSE;
+
+  *value = (v & 1) ? (gint32) ((v + 1) / 2) : -(gint32) (v / 2);
+
+  return TRUE;
+}
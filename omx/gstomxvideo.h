@@ -29,8 +29,10 @@
 #include <gst/video/video.h>
 #include <gst/video/gstvideodecoder.h>
 #include <gst/video/gstvideoencoder.h>
+#include <gst/base/gstbitreader.h>
 
 #include "gstomx.h"
+#include "gstomxvideoconvert.h"
 
 G_BEGIN_DECLS
 
@@ -40,12 +42,29 @@ typedef struct
   OMX_COLOR_FORMATTYPE type;
 } GstOMXVideoNegotiationMap;
 
+/* Vendor specific color formats, see the vendor-color-formats key of the
+ * configuration file */
+typedef struct
+{
+  OMX_COLOR_FORMATTYPE type;
+  GstVideoFormat format;
+  GstOMXVideoPacking packing;
+  GstOMXVideoTiling tiling;
+} GstOMXVideoVendorFormat;
+
 GstVideoFormat
 gst_omx_video_get_format_from_omx (OMX_COLOR_FORMATTYPE omx_colorformat);
 
+GArray *
+gst_omx_video_parse_vendor_formats (gchar ** formats);
+
+gboolean
+gst_omx_video_resolve_format (GArray * vendor_formats,
+    OMX_COLOR_FORMATTYPE omx_colorformat, GstOMXVideoVendorFormat * format);
+
 GList *
 gst_omx_video_get_supported_colorformats (GstOMXPort * port,
-    GstVideoCodecState * state);
+    GstVideoCodecState * state, GArray * vendor_formats);
 
 GstCaps * gst_omx_video_get_caps_for_map(GList * map);
 
@@ -55,6 +74,29 @@ gst_omx_video_negotiation_map_free (GstOMXVideoNegotiationMap * m);
 GstVideoCodecFrame *
 gst_omx_video_find_nearest_frame (GstOMXBuffer * buf, GList * frames);
 
+/* SPS are much smaller, but the AU is not split into NAL units first */
+#define MAX_SPS_SIZE 1024
+
+/* For parsers reading from a GstBitReader br, which jump to a done label
+ * once the data ends */
+#define READ_BITS(v, n) \
+  if (!gst_bit_reader_get_bits_uint32 (&br, &(v), (n))) goto done
+#define SKIP_BITS(n) \
+  if (!gst_bit_reader_skip (&br, (n))) goto done
+#define READ_UE(v) \
+  if (!gst_omx_video_read_ue (&br, &(v))) goto done
+#define READ_SE(v) \
+  if (!gst_omx_video_read_se (&br, &(v))) goto done
+
+guint8 *
+gst_omx_video_nal_to_rbsp (const guint8 * data, gsize size, gsize * rbsp_size);
+
+gboolean
+gst_omx_video_read_ue (GstBitReader * br, guint32 * value);
+
+gboolean
+gst_omx_video_read_se (GstBitReader * br, gint32 * value);
+
 G_END_DECLS
 
 #endif /* __GST_OMX_VIDEO_H__ */
@@ -0,0 +1,649 @@
+/*
+ * Copyright (C) 2017, Renesas Electronics Corporation
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation
+ * version 2.1 of the License.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301 USA
+ *
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <string.h>
+
+#include "gstomx.h"
+#include "gstomxvideoconvert.h"
+
+#define GST_CAT_DEFAULT gst_omx_video_debug_category
+
+/* Colour conversion, downscaling, unpacking and detiling done while copying
+ * the decoded picture out of the OMX buffer, so that every frame is only
+ * read once. The row kernels are plain fixed-point C with the pixel layout
+ * passed as constants, which lets the compiler specialise and vectorise
+ * them for the target. The tiled GStreamer formats need GStreamer 1.4. */
+
+#define CONVERT_SHIFT 13
+#define CONVERT_ROUND (1 << (CONVERT_SHIFT - 1))
+#define CONVERT_FIX(x) ((gint) ((x) * (1 << CONVERT_SHIFT) + 0.5))
+
+typedef struct
+{
+  gint y_offset;
+  gint y;
+  gint r_cr;
+  gint g_cb;
+  gint g_cr;
+  gint b_cb;
+} GstOMXVideoConvertMatrix;
+
+static void
+gst_omx_video_convert_matrix_init (GstOMXVideoConvertMatrix * m,
+    const GstVideoColorimetry * colorimetry, guint height)
+{
+  GstVideoColorMatrix matrix = GST_VIDEO_COLOR_MATRIX_UNKNOWN;
+  gboolean full_range = FALSE;
+  gdouble kr, kb, kg;
+  gdouble y_scale = 255.0 / 219.0, c_scale = 255.0 / 224.0;
+
+  if (colorimetry) {
+    matrix = colorimetry->matrix;
+    full_range = colorimetry->range == GST_VIDEO_COLOR_RANGE_0_255;
+  }
+
+  /* Streams without colour description: SD is BT.601, HD is BT.709 */
+  if (matrix != GST_VIDEO_COLOR_MATRIX_BT709 &&
+      matrix != GST_VIDEO_COLOR_MATRIX_BT601)
+    matrix = height > 576 ? GST_VIDEO_COLOR_MATRIX_BT709 :
+        GST_VIDEO_COLOR_MATRIX_BT601;
+
+  if (matrix == GST_VIDEO_COLOR_MATRIX_BT709) {
+    kr = 0.2126;
+    kb = 0.0722;
+  } else {
+    kr = 0.299;
+    kb = 0.114;
+  }
+  kg = 1.0 - kr - kb;
+
+  if (full_range) {
+    y_scale = 1.0;
+    c_scale = 1.0;
+  }
+
+  m->y_offset = full_range ? 0 : 16;
+  m->y = CONVERT_FIX (y_scale);
+  m->r_cr = CONVERT_FIX (c_scale * 2.0 * (1.0 - kr));
+  m->g_cb = CONVERT_FIX (c_scale * 2.0 * (1.0 - kb) * kb / kg);
+  m->g_cr = CONVERT_FIX (c_scale * 2.0 * (1.0 - kr) * kr / kg);
+  m->b_cb = CONVERT_FIX (c_scale * 2.0 * (1.0 - kb));
+
+  GST_DEBUG ("Converting with %s matrix, %s range",
+      matrix == GST_VIDEO_COLOR_MATRIX_BT709 ? "BT.709" : "BT.601",
+      full_range ? "full" : "limited");
+}
+
+static inline guint8
+gst_omx_video_convert_clamp (gint v)
+{
+  v >>= CONVERT_SHIFT;
+
+  return v < 0 ? 0 : (v > 255 ? 255 : v);
+}
+
+static inline void
+gst_omx_video_convert_put_pixel (guint8 * d, gint y, gint dr, gint dg,
+    gint db, const guint r, const guint g, const guint b, const guint pstride)
+{
+  d[r] = gst_omx_video_convert_clamp (y + dr);
+  d[g] = gst_omx_video_convert_clamp (y + dg);
+  d[b] = gst_omx_video_convert_clamp (y + db);
+  if (pstride == 4)
+    d[3] = 0xff;
+}
+
+/* One output row of 4:2:0 YUV to RGB. Two horizontally neighbouring pixels
+ * share the chroma contribution. */
+static inline void
+gst_omx_video_convert_row (const GstOMXVideoConvertMatrix * m, guint8 * d,
+    const guint8 * y, const guint8 * u, const guint8 * v, guint width,
+    const guint uv_pstride, const guint r, const guint g, const guint b,
+    const guint pstride)
+{
+  guint i;
+
+  for (i = 0; i < width; i += 2) {
+    gint cb = u[(i / 2) * uv_pstride] - 128;
+    gint cr = v[(i / 2) * uv_pstride] - 128;
+    gint dr = m->r_cr * cr;
+    gint dg = -m->g_cb * cb - m->g_cr * cr;
+    gint db = m->b_cb * cb;
+
+    gst_omx_video_convert_put_pixel (d + i * pstride,
+        (y[i] - m->y_offset) * m->y + CONVERT_ROUND, dr, dg, db, r, g, b,
+        pstride);
+    if (i + 1 < width)
+      gst_omx_video_convert_put_pixel (d + (i + 1) * pstride,
+          (y[i + 1] - m->y_offset) * m->y + CONVERT_ROUND, dr, dg, db, r, g,
+          b, pstride);
+  }
+}
+
+/* Box filter for one plane of @comps interleaved 8-bit components. Each
+ * output pixel is the average of the source pixels it covers. */
+typedef struct
+{
+  guint src_width;
+  guint src_height;
+  guint dst_width;
+  guint dst_height;
+  guint comps;
+  guint *x_start;
+  guint32 *acc;
+} GstOMXVideoScaler;
+
+static void
+gst_omx_video_scaler_init (GstOMXVideoScaler * s, guint src_width,
+    guint src_height, guint dst_width, guint dst_height, guint comps)
+{
+  guint x;
+
+  s->src_width = src_width;
+  s->src_height = src_height;
+  s->dst_width = dst_width;
+  s->dst_height = dst_height;
+  s->comps = comps;
+  s->x_start = g_new (guint, dst_width + 1);
+  for (x = 0; x <= dst_width; x++)
+    s->x_start[x] = x * src_width / dst_width;
+  s->acc = g_new (guint32, src_width * comps);
+}
+
+static void
+gst_omx_video_scaler_clear (GstOMXVideoScaler * s)
+{
+  g_free (s->x_start);
+  g_free (s->acc);
+}
+
+static void
+gst_omx_video_scaler_row (GstOMXVideoScaler * s, const guint8 * plane,
+    guint stride, guint y, guint8 * out)
+{
+  const guint n = s->src_width * s->comps;
+  const guint y0 = y * s->src_height / s->dst_height;
+  const guint y1 = (y + 1) * s->src_height / s->dst_height;
+  const guint8 *row = plane + y0 * stride;
+  guint i, j, x, c;
+
+  /* Sum the covered source rows first, then the covered columns */
+  for (i = 0; i < n; i++)
+    s->acc[i] = row[i];
+  for (j = y0 + 1; j < y1; j++) {
+    row += stride;
+    for (i = 0; i < n; i++)
+      s->acc[i] += row[i];
+  }
+
+  for (x = 0; x < s->dst_width; x++) {
+    const guint x0 = s->x_start[x];
+    const guint x1 = s->x_start[x + 1];
+    const guint area = (x1 - x0) * (y1 - y0);
+
+    for (c = 0; c < s->comps; c++) {
+      guint32 sum = 0;
+
+      for (i = x0; i < x1; i++)
+        sum += s->acc[i * s->comps + c];
+      out[x * s->comps + c] = (sum + area / 2) / area;
+    }
+  }
+}
+
+/* Copy a 4:2:0 picture, e.g. the visible region of a larger one */
+static void
+gst_omx_video_convert_copy_yuv420 (const GstOMXVideoConvertSource * src,
+    GstVideoFrame * dest)
+{
+  const guint bps = GST_VIDEO_FRAME_COMP_DEPTH (dest, 0) > 8 ? 2 : 1;
+  const gboolean semi_planar = GST_VIDEO_FRAME_N_PLANES (dest) == 2;
+  guint p, h;
+
+  for (p = 0; p < GST_VIDEO_FRAME_N_PLANES (dest); p++) {
+    guint8 *d = GST_VIDEO_FRAME_PLANE_DATA (dest, p);
+    const gint d_stride = GST_VIDEO_FRAME_PLANE_STRIDE (dest, p);
+    const guint8 *s = src->data[p];
+    guint width = src->width, height = src->height;
+
+    if (p > 0) {
+      width = semi_planar ? GST_ROUND_UP_2 (width) : (width + 1) / 2;
+      height = (height + 1) / 2;
+    }
+
+    for (h = 0; h < height; h++) {
+      memcpy (d, s, width * bps);
+      d += d_stride;
+      s += src->stride[p];
+    }
+  }
+}
+
+static inline void
+gst_omx_video_convert_write_10bit (guint8 * d, guint v)
+{
+  /* P010: the 10 bits are the most significant ones */
+  GST_WRITE_UINT16_LE (d, v << 6);
+}
+
+/* Unpack @n 10-bit samples of one row, after the first @skip ones */
+static void
+gst_omx_video_convert_unpack_row (const guint8 * s, guint8 * d, guint skip,
+    guint n, GstOMXVideoPacking packing)
+{
+  guint v[4];
+  guint i, j;
+
+  n += skip;
+  if (packing == GST_OMX_VIDEO_PACKING_10BIT_40) {
+    for (i = 0; i < n; i += 4, s += 5) {
+      v[0] = s[0] | (s[1] & 0x03) << 8;
+      v[1] = s[1] >> 2 | (s[2] & 0x0f) << 6;
+      v[2] = s[2] >> 4 | (s[3] & 0x3f) << 4;
+      v[3] = s[3] >> 6 | s[4] << 2;
+      for (j = 0; j < 4 && i + j < n; j++)
+        if (i + j >= skip)
+          gst_omx_video_convert_write_10bit (d + (i + j - skip) * 2, v[j]);
+    }
+  } else {
+    for (i = 0; i < n; i += 3, s += 4) {
+      guint32 w = GST_READ_UINT32_LE (s);
+
+      v[0] = w & 0x3ff;
+      v[1] = (w >> 10) & 0x3ff;
+      v[2] = (w >> 20) & 0x3ff;
+      for (j = 0; j < 3 && i + j < n; j++)
+        if (i + j >= skip)
+          gst_omx_video_convert_write_10bit (d + (i + j - skip) * 2, v[j]);
+    }
+  }
+}
+
+/* Unpack a semi-planar 4:2:0 picture with packed 10-bit samples */
+static void
+gst_omx_video_convert_unpack_yuv420 (const GstOMXVideoConvertSource * src,
+    GstVideoFrame * dest)
+{
+  guint p, h;
+
+  for (p = 0; p < 2; p++) {
+    guint8 *d = GST_VIDEO_FRAME_PLANE_DATA (dest, p);
+    const gint d_stride = GST_VIDEO_FRAME_PLANE_STRIDE (dest, p);
+    const guint8 *s = src->data[p];
+    guint width = src->width, height = src->height;
+
+    if (p > 0) {
+      width = GST_ROUND_UP_2 (width);
+      height = (height + 1) / 2;
+    }
+
+    for (h = 0; h < height; h++) {
+      gst_omx_video_convert_unpack_row (s, d, src->skip, width,
+          src->packing);
+      d += d_stride;
+      s += src->stride[p];
+    }
+  }
+}
+
+/* Detile one plane tile by tile, so that each tile is read sequentially
+ * while its rows are written. @x and @width are in bytes. The tile size is
+ * passed as constants so that whole tile rows are copied with fixed size
+ * vector moves */
+static inline void
+gst_omx_video_convert_detile_plane (const guint8 * s, guint stride,
+    guint slice, guint8 * d, gint d_stride, guint x, guint y, guint width,
+    guint height, const guint tile_width, const guint tile_height,
+    const GstOMXVideoTiling tiling)
+{
+  const guint x_tiles = stride / tile_width;
+#if GST_CHECK_VERSION(1,4,0)
+  const guint y_tiles = (slice + tile_height - 1) / tile_height;
+#endif
+  guint tx, ty, h;
+
+  for (ty = y / tile_height; ty * tile_height < y + height; ty++) {
+    const guint y0 = MAX (y, ty * tile_height);
+    const guint y1 = MIN (y + height, (ty + 1) * tile_height);
+
+    for (tx = x / tile_width; tx * tile_width < x + width; tx++) {
+      const guint x0 = MAX (x, tx * tile_width);
+      const guint x1 = MIN (x + width, (tx + 1) * tile_width);
+      const guint8 *t;
+      guint8 *o;
+      guint index;
+
+#if GST_CHECK_VERSION(1,4,0)
+      if (tiling == GST_OMX_VIDEO_TILING_ZFLIPZ_64X32)
+        index = gst_video_tile_get_index (GST_VIDEO_TILE_MODE_ZFLIPZ_2X2,
+            tx, ty, x_tiles, y_tiles);
+      else
+#endif
+        index = ty * x_tiles + tx;
+
+      t = s + index * tile_width * tile_height +
+          (y0 - ty * tile_height) * tile_width + (x0 - tx * tile_width);
+      o = d + (y0 - y) * d_stride + (x0 - x);
+      if (x1 - x0 == tile_width) {
+        for (h = y0; h < y1; h++, t += tile_width, o += d_stride)
+          memcpy (o, t, tile_width);
+      } else {
+        for (h = y0; h < y1; h++, t += tile_width, o += d_stride)
+          memcpy (o, t, x1 - x0);
+      }
+    }
+  }
+}
+
+/* Detile a semi-planar 4:2:0 picture to NV12 */
+static void
+gst_omx_video_convert_detile_nv12 (const GstOMXVideoConvertSource * src,
+    GstVideoFrame * dest)
+{
+  guint p;
+
+  for (p = 0; p < 2; p++) {
+    guint8 *d = GST_VIDEO_FRAME_PLANE_DATA (dest, p);
+    const gint d_stride = GST_VIDEO_FRAME_PLANE_STRIDE (dest, p);
+    guint width = src->width, height = src->height, y = src->y;
+
+    if (p > 0) {
+      width = GST_ROUND_UP_2 (width);
+      height = (height + 1) / 2;
+      y /= 2;
+    }
+
+    switch (src->tiling) {
+      case GST_OMX_VIDEO_TILING_LINEAR_16X16:
+        gst_omx_video_convert_detile_plane (src->data[p], src->stride[p],
+            src->slice[p], d, d_stride, src->x, y, width, height, 16, 16,
+            GST_OMX_VIDEO_TILING_LINEAR_16X16);
+        break;
+      case GST_OMX_VIDEO_TILING_LINEAR_32X32:
+        gst_omx_video_convert_detile_plane (src->data[p], src->stride[p],
+            src->slice[p], d, d_stride, src->x, y, width, height, 32, 32,
+            GST_OMX_VIDEO_TILING_LINEAR_32X32);
+        break;
+#if GST_CHECK_VERSION(1,4,0)
+      case GST_OMX_VIDEO_TILING_ZFLIPZ_64X32:
+        gst_omx_video_convert_detile_plane (src->data[p], src->stride[p],
+            src->slice[p], d, d_stride, src->x, y, width, height, 64, 32,
+            GST_OMX_VIDEO_TILING_ZFLIPZ_64X32);
+        break;
+#endif
+      default:
+        g_assert_not_reached ();
+        break;
+    }
+  }
+}
+
+/* Downscale a 4:2:0 picture without changing its format */
+static void
+gst_omx_video_convert_scale_yuv420 (const GstOMXVideoConvertSource * src,
+    GstVideoFrame * dest)
+{
+  GstOMXVideoScaler scaler;
+  guint p, h;
+
+  for (p = 0; p < GST_VIDEO_FRAME_N_PLANES (dest); p++) {
+    guint8 *d = GST_VIDEO_FRAME_PLANE_DATA (dest, p);
+    const gint d_stride = GST_VIDEO_FRAME_PLANE_STRIDE (dest, p);
+
+    if (p == 0)
+      gst_omx_video_scaler_init (&scaler, src->width, src->height,
+          GST_VIDEO_FRAME_WIDTH (dest), GST_VIDEO_FRAME_HEIGHT (dest), 1);
+    else
+      gst_omx_video_scaler_init (&scaler, (src->width + 1) / 2,
+          (src->height + 1) / 2, (GST_VIDEO_FRAME_WIDTH (dest) + 1) / 2,
+          (GST_VIDEO_FRAME_HEIGHT (dest) + 1) / 2,
+          src->format == GST_VIDEO_FORMAT_NV12 ? 2 : 1);
+
+    for (h = 0; h < scaler.dst_height; h++) {
+      gst_omx_video_scaler_row (&scaler, src->data[p], src->stride[p], h, d);
+      d += d_stride;
+    }
+    gst_omx_video_scaler_clear (&scaler);
+  }
+}
+
+static inline void
+gst_omx_video_convert_yuv420_rgb (const GstOMXVideoConvertMatrix * m,
+    const GstOMXVideoConvertSource * src, GstVideoFrame * dest,
+    const guint r, const guint g, const guint b, const guint pstride)
+{
+  guint8 *d = GST_VIDEO_FRAME_PLANE_DATA (dest, 0);
+  const gint d_stride = GST_VIDEO_FRAME_PLANE_STRIDE (dest, 0);
+  guint h;
+
+  for (h = 0; h < src->height; h++) {
+    const guint8 *y = src->data[0] + h * src->stride[0];
+    const guint8 *u = src->data[1] + (h / 2) * src->stride[1];
+
+    if (src->format == GST_VIDEO_FORMAT_NV12)
+      gst_omx_video_convert_row (m, d, y, u, u + 1, src->width, 2, r, g, b,
+          pstride);
+    else
+      gst_omx_video_convert_row (m, d, y, u,
+          src->data[2] + (h / 2) * src->stride[2], src->width, 1, r, g, b,
+          pstride);
+    d += d_stride;
+  }
+}
+
+/* Downscale and convert one output row at a time, so that the scaled
+ * picture never exists as a whole */
+static inline void
+gst_omx_video_convert_scale_yuv420_rgb (const GstOMXVideoConvertMatrix * m,
+    const GstOMXVideoConvertSource * src, GstVideoFrame * dest,
+    const guint r, const guint g, const guint b, const guint pstride)
+{
+  GstOMXVideoScaler y_scaler, uv_scaler;
+  const gboolean nv12 = src->format == GST_VIDEO_FORMAT_NV12;
+  const guint width = GST_VIDEO_FRAME_WIDTH (dest);
+  const guint height = GST_VIDEO_FRAME_HEIGHT (dest);
+  const guint uv_width = (width + 1) / 2;
+  guint8 *d = GST_VIDEO_FRAME_PLANE_DATA (dest, 0);
+  const gint d_stride = GST_VIDEO_FRAME_PLANE_STRIDE (dest, 0);
+  guint8 *y, *u, *v;
+  guint h;
+
+  gst_omx_video_scaler_init (&y_scaler, src->width, src->height, width,
+      height, 1);
+  gst_omx_video_scaler_init (&uv_scaler, (src->width + 1) / 2,
+      (src->height + 1) / 2, uv_width, (height + 1) / 2, nv12 ? 2 : 1);
+  y = g_malloc (width + 2 * uv_width);
+  u = y + width;
+  v = nv12 ? u + 1 : u + uv_width;
+
+  for (h = 0; h < height; h++) {
+    gst_omx_video_scaler_row (&y_scaler, src->data[0], src->stride[0], h, y);
+    if (h % 2 == 0) {
+      gst_omx_video_scaler_row (&uv_scaler, src->data[1], src->stride[1],
+          h / 2, u);
+      if (!nv12)
+        gst_omx_video_scaler_row (&uv_scaler, src->data[2], src->stride[2],
+            h / 2, v);
+    }
+
+    if (nv12)
+      gst_omx_video_convert_row (m, d, y, u, v, width, 2, r, g, b, pstride);
+    else
+      gst_omx_video_convert_row (m, d, y, u, v, width, 1, r, g, b, pstride);
+    d += d_stride;
+  }
+
+  g_free (y);
+  gst_omx_video_scaler_clear (&y_scaler);
+  gst_omx_video_scaler_clear (&uv_scaler);
+}
+
+gboolean
+gst_omx_video_convert_is_supported (GstVideoFormat in_format,
+    GstVideoFormat out_format)
+{
+  switch (in_format) {
+    case GST_VIDEO_FORMAT_NV12:
+    case GST_VIDEO_FORMAT_I420:
+      break;
+#if GST_CHECK_VERSION(1,10,0)
+    case GST_VIDEO_FORMAT_P010_10LE:
+#endif
+    case GST_VIDEO_FORMAT_I420_10LE:
+      /* Cropping and unpacking only */
+      return out_format == in_format;
+#if GST_CHECK_VERSION(1,4,0)
+    case GST_VIDEO_FORMAT_NV12_64Z32:
+      /* Detiling only */
+      return out_format == GST_VIDEO_FORMAT_NV12;
+#endif
+    default:
+      return FALSE;
+  }
+
+  if (out_format == in_format)
+    return TRUE;
+
+  switch (out_format) {
+    case GST_VIDEO_FORMAT_RGB:
+    case GST_VIDEO_FORMAT_BGR:
+    case GST_VIDEO_FORMAT_RGBx:
+    case GST_VIDEO_FORMAT_BGRx:
+      return TRUE;
+    default:
+      return FALSE;
+  }
+}
+
+gboolean
+gst_omx_video_convert_can_scale (GstVideoFormat format)
+{
+  return format == GST_VIDEO_FORMAT_NV12 || format == GST_VIDEO_FORMAT_I420;
+}
+
+/* Tile layout of the tiled GStreamer formats */
+GstOMXVideoTiling
+gst_omx_video_convert_get_tiling (GstVideoFormat format)
+{
+#if GST_CHECK_VERSION(1,4,0)
+  if (format == GST_VIDEO_FORMAT_NV12_64Z32)
+    return GST_OMX_VIDEO_TILING_ZFLIPZ_64X32;
+#endif
+
+  return GST_OMX_VIDEO_TILING_NONE;
+}
+
+/* Convert @src into the mapped @dest frame, which may be smaller than
+ * @src. @colorimetry describes the source and may be NULL. */
+gboolean
+gst_omx_video_convert_frame (const GstOMXVideoConvertSource * src,
+    GstVideoFrame * dest, const GstVideoColorimetry * colorimetry)
+{
+  GstOMXVideoConvertMatrix m;
+  gboolean scale;
+
+  if (!gst_omx_video_convert_is_supported (src->format,
+          GST_VIDEO_FRAME_FORMAT (dest))) {
+    GST_ERROR ("Unsupported conversion %s -> %s",
+        gst_video_format_to_string (src->format),
+        gst_video_format_to_string (GST_VIDEO_FRAME_FORMAT (dest)));
+    return FALSE;
+  }
+
+  if (GST_VIDEO_FRAME_WIDTH (dest) > (gint) src->width ||
+      GST_VIDEO_FRAME_HEIGHT (dest) > (gint) src->height) {
+    GST_ERROR ("Can't upscale: %ux%u -> %dx%d", src->width, src->height,
+        GST_VIDEO_FRAME_WIDTH (dest), GST_VIDEO_FRAME_HEIGHT (dest));
+    return FALSE;
+  }
+
+  scale = GST_VIDEO_FRAME_WIDTH (dest) != (gint) src->width ||
+      GST_VIDEO_FRAME_HEIGHT (dest) != (gint) src->height;
+
+  if (src->tiling != GST_OMX_VIDEO_TILING_NONE) {
+    if (GST_VIDEO_FRAME_FORMAT (dest) != GST_VIDEO_FORMAT_NV12 || scale) {
+      GST_ERROR ("Can only detile to NV12 of the same size");
+      return FALSE;
+    }
+    gst_omx_video_convert_detile_nv12 (src, dest);
+    return TRUE;
+  }
+
+  if (scale && !gst_omx_video_convert_can_scale (src->format)) {
+    GST_ERROR ("Can't scale %s", gst_video_format_to_string (src->format));
+    return FALSE;
+  }
+
+  if (src->packing != GST_OMX_VIDEO_PACKING_NONE) {
+    if (GST_VIDEO_FRAME_FORMAT (dest) != src->format ||
+        GST_VIDEO_FRAME_N_PLANES (dest) != 2) {
+      GST_ERROR ("Can't unpack to %s",
+          gst_video_format_to_string (GST_VIDEO_FRAME_FORMAT (dest)));
+      return FALSE;
+    }
+    gst_omx_video_convert_unpack_yuv420 (src, dest);
+    return TRUE;
+  }
+
+  if (GST_VIDEO_FRAME_FORMAT (dest) == src->format) {
+    if (scale)
+      gst_omx_video_convert_scale_yuv420 (src, dest);
+    else
+      gst_omx_video_convert_copy_yuv420 (src, dest);
+    return TRUE;
+  }
+
+  gst_omx_video_convert_matrix_init (&m, colorimetry, src->height);
+
+  switch (GST_VIDEO_FRAME_FORMAT (dest)) {
+    case GST_VIDEO_FORMAT_RGB:
+      if (scale)
+        gst_omx_video_convert_scale_yuv420_rgb (&m, src, dest, 0, 1, 2, 3);
+      else
+        gst_omx_video_convert_yuv420_rgb (&m, src, dest, 0, 1, 2, 3);
+      break;
+    case GST_VIDEO_FORMAT_BGR:
+      if (scale)
+        gst_omx_video_convert_scale_yuv420_rgb (&m, src, dest, 2, 1, 0, 3);
+      else
+        gst_omx_video_convert_yuv420_rgb (&m, src, dest, 2, 1, 0, 3);
+      break;
+    case GST_VIDEO_FORMAT_RGBx:
+      if (scale)
+        gst_omx_video_convert_scale_yuv420_rgb (&m, src, dest, 0, 1, 2, 4);
+      else
+        gst_omx_video_convert_yuv420_rgb (&m, src, dest, 0, 1, 2, 4);
+      break;
+    case GST_VIDEO_FORMAT_BGRx:
+      if (scale)
+        gst_omx_video_convert_scale_yuv420_rgb (&m, src, dest, 2, 1, 0, 4);
+      else
+        gst_omx_video_convert_yuv420_rgb (&m, src, dest, 2, 1, 0, 4);
+      break;
+    default:
+      g_assert_not_reached ();
+      break;
+  }
+
+  return TRUE;
+}
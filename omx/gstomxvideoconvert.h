@@ -0,0 +1,90 @@
+/*
+ * Copyright (C) 2017, Renesas Electronics Corporation
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation
+ * version 2.1 of the License.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301 USA
+ *
+ */
+
+#ifndef __GST_OMX_VIDEO_CONVERT_H__
+#define __GST_OMX_VIDEO_CONVERT_H__
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <gst/gst.h>
+#include <gst/video/video.h>
+
+G_BEGIN_DECLS
+
+/* Sample packings of vendor specific color formats that have no GStreamer
+ * equivalent. Such pictures are unpacked to @format */
+typedef enum
+{
+  GST_OMX_VIDEO_PACKING_NONE,
+  /* 10-bit samples, 4 in each 5 bytes, little endian */
+  GST_OMX_VIDEO_PACKING_10BIT_40,
+  /* 10-bit samples, 3 in the low 30 bits of each little endian 32-bit word */
+  GST_OMX_VIDEO_PACKING_10BIT_32
+} GstOMXVideoPacking;
+
+/* Tile layouts of 8-bit semi-planar pictures, which are detiled to NV12 */
+typedef enum
+{
+  GST_OMX_VIDEO_TILING_NONE,
+  /* 16x16 byte tiles in raster order */
+  GST_OMX_VIDEO_TILING_LINEAR_16X16,
+  /* 32x32 byte tiles in raster order */
+  GST_OMX_VIDEO_TILING_LINEAR_32X32,
+  /* 64x32 byte tiles in Z-flipped 2x2 groups, see NV12_64Z32 */
+  GST_OMX_VIDEO_TILING_ZFLIPZ_64X32
+} GstOMXVideoTiling;
+
+/* A decoded picture as laid out in an OMX output buffer */
+typedef struct
+{
+  GstVideoFormat format;
+  GstOMXVideoPacking packing;
+  /* Samples to skip at the start of each packed row */
+  guint skip;
+  GstOMXVideoTiling tiling;
+  /* Visible region of tiled pictures, whose @data point to the start of
+   * the planes, and the number of rows of each plane */
+  guint x;
+  guint y;
+  guint slice[GST_VIDEO_MAX_PLANES];
+  guint width;
+  guint height;
+  const guint8 *data[GST_VIDEO_MAX_PLANES];
+  guint stride[GST_VIDEO_MAX_PLANES];
+} GstOMXVideoConvertSource;
+
+gboolean
+gst_omx_video_convert_is_supported (GstVideoFormat in_format,
+    GstVideoFormat out_format);
+
+gboolean
+gst_omx_video_convert_can_scale (GstVideoFormat format);
+
+GstOMXVideoTiling
+gst_omx_video_convert_get_tiling (GstVideoFormat format);
+
+gboolean
+gst_omx_video_convert_frame (const GstOMXVideoConvertSource * src,
+    GstVideoFrame * dest, const GstVideoColorimetry * colorimetry);
+
+G_END_DECLS
+
+#endif /* __GST_OMX_VIDEO_CONVERT_H__ */
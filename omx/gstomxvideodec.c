@@ -51,8 +51,8 @@
 
 #include "gstomxbufferpool.h"
 #include "gstomxvideo.h"
+#include "gstomxvideoconvert.h"
 #include "gstomxvideodec.h"
-#include "gstomxwmvdec.h"
 #ifdef HAVE_VIDEODEC_EXT
 #include "OMXR_Extension_vdcmn.h"
 #endif
@@ -61,6 +61,28 @@
 GST_DEBUG_CATEGORY_STATIC (gst_omx_video_dec_debug_category);
 #define GST_CAT_DEFAULT gst_omx_video_dec_debug_category
 
+#define GST_TYPE_OMX_VIDEO_DEC_IN_FLIGHT_POLICY (gst_omx_video_dec_in_flight_policy_get_type ())
+static GType
+gst_omx_video_dec_in_flight_policy_get_type (void)
+{
+  static GType qtype = 0;
+
+  if (qtype == 0) {
+    static const GEnumValue values[] = {
+      {GST_OMX_VIDEO_DEC_IN_FLIGHT_WAIT, "Wait for frames to be output",
+          "wait"},
+      {GST_OMX_VIDEO_DEC_IN_FLIGHT_DROP_OLDEST, "Drop the oldest frame",
+          "drop-oldest"},
+      {GST_OMX_VIDEO_DEC_IN_FLIGHT_DROP_NEW, "Drop the new frame",
+          "drop-new"},
+      {0, NULL, NULL}
+    };
+
+    qtype = g_enum_register_static ("GstOMXVideoDecInFlightPolicy", values);
+  }
+  return qtype;
+}
+
 /* prototypes */
 static void gst_omx_video_dec_finalize (GObject * object);
 
@@ -82,6 +104,20 @@ static gboolean gst_omx_video_dec_decide_allocation (GstVideoDecoder * bdec,
     GstQuery * query);
 
 static GstFlowReturn gst_omx_video_dec_drain (GstOMXVideoDec * self);
+static GstFlowReturn gst_omx_video_dec_feed_frame (GstOMXVideoDec * self,
+    GstVideoCodecFrame * frame);
+static void gst_omx_video_dec_calibrate_latency (GstOMXVideoDec * self,
+    GstVideoCodecFrame * frame);
+static gboolean gst_omx_video_dec_sink_event (GstVideoDecoder * decoder,
+    GstEvent * event);
+static gboolean gst_omx_video_dec_preview_open (GstOMXVideoDec * self);
+static gboolean gst_omx_video_dec_preview_wait_released (GstOMXVideoDec *
+    self);
+static void gst_omx_video_dec_preview_close (GstOMXVideoDec * self);
+static void gst_omx_video_dec_preview_set_flushing (GstOMXVideoDec * self,
+    gboolean flushing);
+static void gst_omx_video_dec_in_flight_set_flushing (GstOMXVideoDec * self,
+    gboolean flushing);
 
 static OMX_ERRORTYPE gst_omx_video_dec_allocate_output_buffers (GstOMXVideoDec *
     self);
@@ -98,7 +134,25 @@ enum
   PROP_NO_COPY,
   PROP_USE_DMABUF,
   PROP_NO_REORDER,
-  PROP_LOSSY_COMPRESS
+  PROP_LOSSY_COMPRESS,
+  PROP_LOW_LATENCY,
+  PROP_MAX_WIDTH,
+  PROP_MAX_HEIGHT,
+  PROP_DMA_HEAP,
+  PROP_THUMBNAIL,
+  PROP_REORDER_DEPTH,
+  PROP_OUTPUT_QUEUE_SIZE,
+  PROP_INPUT_QUEUE_SIZE,
+  PROP_INPUT_QUEUE_BYTES,
+  PROP_LATENCY_CALIBRATION,
+  PROP_PREVIEW_WIDTH,
+  PROP_PREVIEW_HEIGHT,
+  PROP_MAX_FRAMES_IN_FLIGHT,
+  PROP_MAX_LATENCY,
+  PROP_IN_FLIGHT_POLICY,
+  PROP_RECOVER_ON_ERROR,
+  PROP_MAX_RECOVERIES,
+  PROP_STATS
 };
 
 /* class initialization */
@@ -114,6 +168,32 @@ G_DEFINE_ABSTRACT_TYPE_WITH_CODE (GstOMXVideoDec, gst_omx_video_dec,
 /* Default fps for input files that does not support fps */
 #define DEFAULT_FRAME_PER_SECOND  30
 
+#define DEFAULT_DMA_HEAP "system"
+#define DEFAULT_REORDER_DEPTH -1
+#define MAX_REORDER_DEPTH 16
+#define DEFAULT_OUTPUT_QUEUE_SIZE 0
+#define DEFAULT_INPUT_QUEUE_SIZE 0
+#define DEFAULT_INPUT_QUEUE_BYTES 0
+#define DEFAULT_LATENCY_CALIBRATION FALSE
+#define DEFAULT_PREVIEW_WIDTH 0
+#define DEFAULT_PREVIEW_HEIGHT 0
+#define DEFAULT_MAX_FRAMES_IN_FLIGHT 0
+#define DEFAULT_MAX_LATENCY 0
+#define DEFAULT_IN_FLIGHT_POLICY GST_OMX_VIDEO_DEC_IN_FLIGHT_WAIT
+#define DEFAULT_RECOVER_ON_ERROR FALSE
+#define DEFAULT_MAX_RECOVERIES 3
+/* A drain that may not return is done after this many frame intervals
+ * without output, within the bounds in us */
+#define DRAIN_QUIET_FRAMES 2
+#define DRAIN_QUIET_MIN (10 * G_TIME_SPAN_MILLISECOND)
+#define DRAIN_QUIET_MAX (G_TIME_SPAN_SECOND / 2)
+/* ... and given up on after this long in any case, in us */
+#define DRAIN_TIMEOUT (G_TIME_SPAN_SECOND / 2)
+/* How long handle_frame() waits for output before dropping, in us */
+#define IN_FLIGHT_WAIT_TIMEOUT (G_TIME_SPAN_SECOND)
+/* Frames over which the highest component residency is measured */
+#define LATENCY_CALIBRATION_FRAMES 30
+
 static void
 gst_omx_video_dec_class_init (GstOMXVideoDecClass * klass)
 {
@@ -140,6 +220,8 @@ gst_omx_video_dec_class_init (GstOMXVideoDecClass * klass)
   video_decoder_class->finish = GST_DEBUG_FUNCPTR (gst_omx_video_dec_finish);
   video_decoder_class->decide_allocation =
       GST_DEBUG_FUNCPTR (gst_omx_video_dec_decide_allocation);
+  video_decoder_class->sink_event =
+      GST_DEBUG_FUNCPTR (gst_omx_video_dec_sink_event);
 
   klass->cdata.type = GST_OMX_COMPONENT_TYPE_FILTER;
   klass->cdata.default_src_template_caps =
@@ -171,6 +253,131 @@ gst_omx_video_dec_class_init (GstOMXVideoDecClass * klass)
           "Whether or not to use lossy image compression function",
           FALSE, G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS |
           GST_PARAM_MUTABLE_READY));
+  g_object_class_install_property (gobject_class, PROP_LOW_LATENCY,
+      g_param_spec_boolean ("low-latency", "Low latency",
+          "Minimize the decoding latency: the smallest possible number of "
+          "buffers, and the component doesn't delay frames for reordering "
+          "where it supports that and the reorder stage can take over",
+          FALSE, G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS |
+          GST_PARAM_MUTABLE_READY));
+  g_object_class_install_property (gobject_class, PROP_MAX_WIDTH,
+      g_param_spec_uint ("max-width", "Maximum width",
+          "Maximum expected width of the stream. Together with max-height "
+          "this enables adaptive playback: output buffers are allocated "
+          "once for the maximum size and resolution changes within it don't "
+          "reallocate them. Needs a component with the adaptive-playback "
+          "hack (0 = disabled)",
+          0, G_MAXUINT, 0, G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS |
+          GST_PARAM_MUTABLE_READY));
+  g_object_class_install_property (gobject_class, PROP_MAX_HEIGHT,
+      g_param_spec_uint ("max-height", "Maximum height",
+          "Maximum expected height of the stream, see max-width "
+          "(0 = disabled)",
+          0, G_MAXUINT, 0, G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS |
+          GST_PARAM_MUTABLE_READY));
+  g_object_class_install_property (gobject_class, PROP_DMA_HEAP,
+      g_param_spec_string ("dma-heap", "DMA heap",
+          "Name of the dma-heap in /dev/dma_heap/ to allocate the output "
+          "buffers from when use-dmabuf is enabled and the component can't "
+          "export dmabufs itself. Hardware components without an IOMMU need "
+          "a physically contiguous heap, e.g. linux,cma", DEFAULT_DMA_HEAP,
+          G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS |
+          GST_PARAM_MUTABLE_READY));
+  g_object_class_install_property (gobject_class, PROP_THUMBNAIL,
+      g_param_spec_boolean ("thumbnail", "Thumbnail",
+          "Only decode the first keyframe with the minimum number of buffers, "
+          "output it as soon as it is decoded and then signal EOS",
+          FALSE, G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS |
+          GST_PARAM_MUTABLE_READY));
+  g_object_class_install_property (gobject_class, PROP_REORDER_DEPTH,
+      g_param_spec_int ("reorder-depth", "Reorder depth",
+          "Number of decoded frames to hold back to output them in "
+          "presentation order (-1 = automatic: the reorder depth of the "
+          "stream if the component outputs in decoding order because of "
+          "no-reorder or low-latency, 0 = the stream needs no reordering)",
+          -1, MAX_REORDER_DEPTH, DEFAULT_REORDER_DEPTH,
+          G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS |
+          GST_PARAM_MUTABLE_READY));
+  g_object_class_install_property (gobject_class, PROP_OUTPUT_QUEUE_SIZE,
+      g_param_spec_uint ("output-queue-size", "Output queue size",
+          "Number of decoded frames that can wait for downstream in a "
+          "separate push thread, so that the output port buffers are "
+          "returned to the component right away in copy mode "
+          "(0 = push from the output loop)",
+          0, 64, DEFAULT_OUTPUT_QUEUE_SIZE,
+          G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS |
+          GST_PARAM_MUTABLE_READY));
+  g_object_class_install_property (gobject_class, PROP_INPUT_QUEUE_SIZE,
+      g_param_spec_uint ("input-queue-size", "Input queue size",
+          "Number of compressed frames that can wait for an input port "
+          "buffer in a separate feeder thread, so that the upstream thread "
+          "is not blocked by the component (0 = feed from the upstream "
+          "thread)",
+          0, 256, DEFAULT_INPUT_QUEUE_SIZE,
+          G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS |
+          GST_PARAM_MUTABLE_READY));
+  g_object_class_install_property (gobject_class, PROP_INPUT_QUEUE_BYTES,
+      g_param_spec_uint ("input-queue-bytes", "Input queue bytes",
+          "Maximum size of the compressed frames waiting in the input queue "
+          "(0 = unlimited)",
+          0, G_MAXUINT, DEFAULT_INPUT_QUEUE_BYTES,
+          G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS |
+          GST_PARAM_MUTABLE_READY));
+  g_object_class_install_property (gobject_class, PROP_LATENCY_CALIBRATION,
+      g_param_spec_boolean ("latency-calibration", "Latency calibration",
+          "Report the measured time frames spend in the component as "
+          "latency instead of the one derived from the reorder depth",
+          DEFAULT_LATENCY_CALIBRATION,
+          G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS |
+          GST_PARAM_MUTABLE_READY));
+  g_object_class_install_property (gobject_class, PROP_PREVIEW_WIDTH,
+      g_param_spec_uint ("preview-width", "Preview width",
+          "Width of the scaled pictures on the preview pad, if the component "
+          "has a preview port configured (0 = no preview)",
+          0, G_MAXUINT, DEFAULT_PREVIEW_WIDTH,
+          G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS |
+          GST_PARAM_MUTABLE_READY));
+  g_object_class_install_property (gobject_class, PROP_PREVIEW_HEIGHT,
+      g_param_spec_uint ("preview-height", "Preview height",
+          "Height of the scaled pictures on the preview pad, if the component "
+          "has a preview port configured (0 = no preview)",
+          0, G_MAXUINT, DEFAULT_PREVIEW_HEIGHT,
+          G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS |
+          GST_PARAM_MUTABLE_READY));
+  g_object_class_install_property (gobject_class, PROP_MAX_FRAMES_IN_FLIGHT,
+      g_param_spec_uint ("max-frames-in-flight", "Max frames in flight",
+          "Maximum number of frames passed to the component and not output "
+          "yet (0 = unlimited)",
+          0, G_MAXUINT, DEFAULT_MAX_FRAMES_IN_FLIGHT,
+          G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS));
+  g_object_class_install_property (gobject_class, PROP_MAX_LATENCY,
+      g_param_spec_uint64 ("max-latency", "Max latency",
+          "Maximum PTS distance in ns from the oldest frame not output yet "
+          "to a new frame (0 = unlimited)",
+          0, G_MAXUINT64, DEFAULT_MAX_LATENCY,
+          G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS));
+  g_object_class_install_property (gobject_class, PROP_IN_FLIGHT_POLICY,
+      g_param_spec_enum ("in-flight-policy", "In flight policy",
+          "What to do with a new frame over max-frames-in-flight or "
+          "max-latency", GST_TYPE_OMX_VIDEO_DEC_IN_FLIGHT_POLICY,
+          DEFAULT_IN_FLIGHT_POLICY,
+          G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS));
+  g_object_class_install_property (gobject_class, PROP_RECOVER_ON_ERROR,
+      g_param_spec_boolean ("recover-on-error", "Recover on error",
+          "Recreate the component when it fails instead of posting an error, "
+          "the input is dropped until the next keyframe",
+          DEFAULT_RECOVER_ON_ERROR,
+          G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS));
+  g_object_class_install_property (gobject_class, PROP_MAX_RECOVERIES,
+      g_param_spec_uint ("max-recoveries", "Max recoveries",
+          "Maximum number of component recoveries per stream before an "
+          "error is posted (0 = unlimited)",
+          0, G_MAXUINT, DEFAULT_MAX_RECOVERIES,
+          G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS));
+  g_object_class_install_property (gobject_class, PROP_STATS,
+      g_param_spec_boxed ("stats", "Statistics",
+          "Decoder statistics", GST_TYPE_STRUCTURE,
+          G_PARAM_READABLE | G_PARAM_STATIC_STRINGS));
 
 }
 
@@ -187,6 +394,37 @@ gst_omx_video_dec_init (GstOMXVideoDec * self)
 #endif
   self->no_reorder = FALSE;
   self->lossy_compress = FALSE;
+  self->low_latency = FALSE;
+  self->thumbnail = FALSE;
+  self->max_width = 0;
+  self->max_height = 0;
+  self->dma_heap = g_strdup (DEFAULT_DMA_HEAP);
+  self->dmabuf_cache = gst_omx_dmabuf_cache_new ();
+  self->reorder_depth = DEFAULT_REORDER_DEPTH;
+  self->stream_reorder_depth = -1;
+  self->reorder_queue = g_ptr_array_new ();
+  self->output_queue_size = DEFAULT_OUTPUT_QUEUE_SIZE;
+  g_mutex_init (&self->output_lock);
+  g_cond_init (&self->output_cond);
+  g_queue_init (&self->output_queue);
+  self->input_queue_size = DEFAULT_INPUT_QUEUE_SIZE;
+  self->input_queue_max_bytes = DEFAULT_INPUT_QUEUE_BYTES;
+  self->latency_calibration = DEFAULT_LATENCY_CALIBRATION;
+  self->preview_width = DEFAULT_PREVIEW_WIDTH;
+  self->preview_height = DEFAULT_PREVIEW_HEIGHT;
+  gst_segment_init (&self->preview_segment, GST_FORMAT_TIME);
+  self->max_frames_in_flight = DEFAULT_MAX_FRAMES_IN_FLIGHT;
+  self->max_latency = DEFAULT_MAX_LATENCY;
+  self->in_flight_policy = DEFAULT_IN_FLIGHT_POLICY;
+  self->recover_on_error = DEFAULT_RECOVER_ON_ERROR;
+  self->max_recoveries = DEFAULT_MAX_RECOVERIES;
+  g_mutex_init (&self->in_flight_lock);
+  g_cond_init (&self->in_flight_cond);
+  g_mutex_init (&self->preview_lock);
+  g_cond_init (&self->preview_cond);
+  g_mutex_init (&self->input_lock);
+  g_cond_init (&self->input_cond);
+  g_queue_init (&self->input_queue);
   self->has_set_property = FALSE;
 }
 
@@ -292,6 +530,9 @@ gst_omx_video_dec_open (GstVideoDecoder * decoder)
   GST_DEBUG_OBJECT (self, "Opened EGL renderer");
 #endif
 
+  if (!gst_omx_video_dec_preview_open (self))
+    return FALSE;
+
   /* Use hacks to choose default mode, normally default mode is dmabuf */
   if (!(klass->cdata.hacks & GST_OMX_HACK_USE_COPY_MODE_AS_DEFAULT &&
           klass->cdata.hacks & GST_OMX_HACK_USE_NO_COPY_MODE_AS_DEFAULT) &&
@@ -349,25 +590,38 @@ gst_omx_video_dec_shutdown (GstOMXVideoDec * self)
   if (state > OMX_StateLoaded || state == OMX_StateInvalid) {
     if (state > OMX_StateIdle) {
       gst_omx_component_set_state (self->dec, OMX_StateIdle);
+      if (self->preview_scaler)
+        gst_omx_component_set_state (self->preview_scaler, OMX_StateIdle);
       gst_omx_component_get_state (self->dec, 5 * GST_SECOND);
+      if (self->preview_scaler)
+        gst_omx_component_get_state (self->preview_scaler, 5 * GST_SECOND);
     }
     gst_omx_component_set_state (self->dec, OMX_StateLoaded);
+    if (self->preview_scaler)
+      gst_omx_component_set_state (self->preview_scaler, OMX_StateLoaded);
     gst_omx_port_deallocate_buffers (self->dec_in_port);
     gst_omx_video_dec_deallocate_output_buffers (self);
-    if (state > OMX_StateLoaded)
+    if (self->preview_out_port) {
+      gst_omx_video_dec_preview_wait_released (self);
+      gst_omx_port_deallocate_buffers (self->preview_out_port);
+    }
+    if (self->preview_scaler)
+      gst_omx_close_tunnel (self->preview_port, self->scaler_in_port);
+    if (state > OMX_StateLoaded) {
       gst_omx_component_get_state (self->dec, 5 * GST_SECOND);
+      if (self->preview_scaler)
+        gst_omx_component_get_state (self->preview_scaler, 5 * GST_SECOND);
+    }
   }
 
   return TRUE;
 }
 
+/* Frees the components, the preview pad and the dmabuf exports stay for
+ * gst_omx_video_dec_recover() */
 static gboolean
-gst_omx_video_dec_close (GstVideoDecoder * decoder)
+gst_omx_video_dec_free_components (GstOMXVideoDec * self)
 {
-  GstOMXVideoDec *self = GST_OMX_VIDEO_DEC (decoder);
-
-  GST_DEBUG_OBJECT (self, "Closing decoder");
-
   if (!gst_omx_video_dec_shutdown (self))
     return FALSE;
 
@@ -385,8 +639,30 @@ gst_omx_video_dec_close (GstVideoDecoder * decoder)
   self->egl_render = NULL;
 #endif
 
+  gst_omx_video_dec_preview_close (self);
+
   self->started = FALSE;
 
+  return TRUE;
+}
+
+static gboolean
+gst_omx_video_dec_close (GstVideoDecoder * decoder)
+{
+  GstOMXVideoDec *self = GST_OMX_VIDEO_DEC (decoder);
+
+  GST_DEBUG_OBJECT (self, "Closing decoder");
+
+  if (!gst_omx_video_dec_free_components (self))
+    return FALSE;
+
+  if (self->preview_pad) {
+    gst_element_remove_pad (GST_ELEMENT_CAST (self), self->preview_pad);
+    self->preview_pad = NULL;
+  }
+
+  gst_omx_dmabuf_cache_clear (self->dmabuf_cache);
+
   GST_DEBUG_OBJECT (self, "Closed decoder");
 
   return TRUE;
@@ -399,6 +675,17 @@ gst_omx_video_dec_finalize (GObject * object)
 
   g_mutex_clear (&self->drain_lock);
   g_cond_clear (&self->drain_cond);
+  g_free (self->dma_heap);
+  gst_omx_dmabuf_cache_free (self->dmabuf_cache);
+  g_ptr_array_free (self->reorder_queue, TRUE);
+  g_mutex_clear (&self->output_lock);
+  g_cond_clear (&self->output_cond);
+  g_mutex_clear (&self->input_lock);
+  g_cond_clear (&self->input_cond);
+  g_mutex_clear (&self->in_flight_lock);
+  g_cond_clear (&self->in_flight_cond);
+  g_mutex_clear (&self->preview_lock);
+  g_cond_clear (&self->preview_cond);
 
   G_OBJECT_CLASS (gst_omx_video_dec_parent_class)->finalize (object);
 }
@@ -434,6 +721,8 @@ gst_omx_video_dec_change_state (GstElement * element, GstStateChange transition)
       if (self->egl_out_port)
         gst_omx_port_set_flushing (self->egl_out_port, 5 * GST_SECOND, TRUE);
 #endif
+      gst_omx_video_dec_preview_set_flushing (self, TRUE);
+      gst_omx_video_dec_in_flight_set_flushing (self, TRUE);
 
       g_mutex_lock (&self->drain_lock);
       self->draining = FALSE;
@@ -473,6 +762,174 @@ gst_omx_video_dec_change_state (GstElement * element, GstStateChange transition)
   return ret;
 }
 
+/* Whether only a part of the decoded frames is visible */
+static gboolean
+gst_omx_video_dec_has_crop (GstOMXVideoDec * self)
+{
+  OMX_PARAM_PORTDEFINITIONTYPE *port_def = &self->dec_out_port->port_def;
+  OMX_CONFIG_RECTTYPE *crop = &self->crop;
+
+  if (crop->nWidth == 0 || crop->nHeight == 0 ||
+      crop->nLeft + crop->nWidth > port_def->format.video.nFrameWidth ||
+      crop->nTop + crop->nHeight > port_def->format.video.nFrameHeight)
+    return FALSE;
+
+  return crop->nWidth != port_def->format.video.nFrameWidth ||
+      crop->nHeight != port_def->format.video.nFrameHeight;
+}
+
+/* Query the visible region of the decoded frames, the full frame is used if
+ * the component does not report one */
+static void
+gst_omx_video_dec_update_crop (GstOMXVideoDec * self)
+{
+  OMX_PARAM_PORTDEFINITIONTYPE *port_def = &self->dec_out_port->port_def;
+  OMX_CONFIG_RECTTYPE rect;
+  OMX_ERRORTYPE err;
+
+  self->crop_cookie = self->dec_out_port->crop_cookie;
+
+  GST_OMX_INIT_STRUCT (&self->crop);
+  self->crop.nPortIndex = self->dec_out_port->index;
+  self->crop.nWidth = port_def->format.video.nFrameWidth;
+  self->crop.nHeight = port_def->format.video.nFrameHeight;
+
+  GST_OMX_INIT_STRUCT (&rect);
+  rect.nPortIndex = self->dec_out_port->index;
+  err =
+      gst_omx_component_get_config (self->dec,
+      OMX_IndexConfigCommonOutputCrop, &rect);
+  if (err != OMX_ErrorNone) {
+    GST_LOG_OBJECT (self, "No output crop: %s (0x%08x)",
+        gst_omx_error_to_string (err), err);
+    return;
+  }
+
+  if (rect.nLeft < 0 || rect.nTop < 0 || rect.nWidth < 2
+      || rect.nHeight < 2
+      || rect.nLeft + rect.nWidth > port_def->format.video.nFrameWidth
+      || rect.nTop + rect.nHeight > port_def->format.video.nFrameHeight) {
+    GST_WARNING_OBJECT (self, "Ignoring invalid output crop %d,%d %ux%u",
+        (gint) rect.nLeft, (gint) rect.nTop, (guint) rect.nWidth,
+        (guint) rect.nHeight);
+    return;
+  }
+
+  /* Keep the chroma planes of 4:2:0 frames aligned */
+  if (rect.nLeft % 2) {
+    rect.nLeft++;
+    rect.nWidth--;
+  }
+  if (rect.nTop % 2) {
+    rect.nTop++;
+    rect.nHeight--;
+  }
+
+  self->crop = rect;
+  GST_DEBUG_OBJECT (self, "Output crop %d,%d %ux%u", (gint) rect.nLeft,
+      (gint) rect.nTop, (guint) rect.nWidth, (guint) rect.nHeight);
+}
+
+/* GStreamer format of an output port color format, also of the vendor
+ * specific ones of the class */
+static GstVideoFormat
+gst_omx_video_dec_get_format (GstOMXVideoDec * self,
+    OMX_COLOR_FORMATTYPE color_format)
+{
+  GstOMXVideoDecClass *klass = GST_OMX_VIDEO_DEC_GET_CLASS (self);
+  GstOMXVideoVendorFormat format;
+
+  gst_omx_video_resolve_format (klass->cdata.vendor_formats, color_format,
+      &format);
+
+  return format.format;
+}
+
+/* Copy the decoded picture into @outbuf while cropping, unpacking or
+ * detiling it, converting it to the negotiated RGB format and/or
+ * downscaling it to the negotiated size */
+static gboolean
+gst_omx_video_dec_convert_buffer (GstOMXVideoDec * self,
+    GstOMXBuffer * inbuf, GstBuffer * outbuf, GstVideoInfo * vinfo,
+    GstVideoFormat format)
+{
+  OMX_PARAM_PORTDEFINITIONTYPE *port_def = &self->dec_out_port->port_def;
+  const guint nstride = port_def->format.video.nStride;
+  const guint nslice = port_def->format.video.nSliceHeight;
+  guint left = 0, top = 0;
+  GstOMXVideoConvertSource src;
+  GstVideoFrame frame;
+  guint bps, left_bytes, chroma_left_bytes;
+  gboolean ret;
+
+  src.format = format;
+  src.packing = self->out_format.packing;
+  src.skip = 0;
+  src.tiling = self->out_format.tiling;
+  src.width = port_def->format.video.nFrameWidth;
+  src.height = port_def->format.video.nFrameHeight;
+  if (gst_omx_video_dec_has_crop (self)) {
+    left = self->crop.nLeft;
+    top = self->crop.nTop;
+    src.width = self->crop.nWidth;
+    src.height = self->crop.nHeight;
+  }
+
+  /* Byte offsets of the left edge, packed rows start at the enclosing
+   * group of samples */
+  bps = GST_VIDEO_FORMAT_INFO_DEPTH (gst_video_format_get_info (format),
+      0) > 8 ? 2 : 1;
+  switch (src.packing) {
+    case GST_OMX_VIDEO_PACKING_10BIT_40:
+      src.skip = left % 4;
+      left_bytes = chroma_left_bytes = (left / 4) * 5;
+      break;
+    case GST_OMX_VIDEO_PACKING_10BIT_32:
+      src.skip = left % 3;
+      left_bytes = chroma_left_bytes = (left / 3) * 4;
+      break;
+    default:
+      left_bytes = left * bps;
+      chroma_left_bytes = (left / 2) * bps;
+      break;
+  }
+
+  src.data[0] = inbuf->omx_buf->pBuffer + inbuf->omx_buf->nOffset;
+  src.stride[0] = nstride;
+  src.data[1] = src.data[0] + nstride * nslice;
+  if (src.tiling != GST_OMX_VIDEO_TILING_NONE) {
+    /* The detiling kernel finds the visible region itself */
+    src.x = left;
+    src.y = top;
+    src.stride[1] = nstride;
+    src.slice[0] = nslice;
+    src.slice[1] = nslice / 2;
+  } else if (GST_VIDEO_FORMAT_INFO_N_PLANES (gst_video_format_get_info
+          (format)) == 2) {
+    src.stride[1] = nstride;
+    src.data[0] += top * src.stride[0] + left_bytes;
+    src.data[1] += (top / 2) * src.stride[1] + left_bytes;
+  } else {
+    src.stride[1] = nstride / 2;
+    src.data[2] = src.data[1] + (nstride / 2) * (nslice / 2);
+    src.stride[2] = nstride / 2;
+    src.data[0] += top * src.stride[0] + left_bytes;
+    src.data[1] += (top / 2) * src.stride[1] + chroma_left_bytes;
+    src.data[2] += (top / 2) * src.stride[2] + chroma_left_bytes;
+  }
+
+  if (!gst_video_frame_map (&frame, vinfo, outbuf, GST_MAP_WRITE)) {
+    GST_ERROR_OBJECT (self, "Failed to map output frame");
+    return FALSE;
+  }
+
+  ret = gst_omx_video_convert_frame (&src, &frame,
+      self->input_state ? &self->input_state->info.colorimetry : NULL);
+  gst_video_frame_unmap (&frame);
+
+  return ret;
+}
+
 static gboolean
 gst_omx_video_dec_fill_buffer (GstOMXVideoDec * self,
     GstOMXBuffer * inbuf, GstBuffer * outbuf)
@@ -482,10 +939,16 @@ gst_omx_video_dec_fill_buffer (GstOMXVideoDec * self,
   GstVideoInfo *vinfo = &state->info;
   OMX_PARAM_PORTDEFINITIONTYPE *port_def = &self->dec_out_port->port_def;
   gboolean ret = FALSE;
+  GstVideoFormat format;
   GstVideoFrame frame;
 
-  if (vinfo->width != port_def->format.video.nFrameWidth ||
-      vinfo->height != port_def->format.video.nFrameHeight) {
+  gst_omx_buffer_sync_start (inbuf, FALSE);
+
+  if (vinfo->width > port_def->format.video.nFrameWidth ||
+      vinfo->height > port_def->format.video.nFrameHeight ||
+      (gst_omx_video_dec_has_crop (self) &&
+          (vinfo->width > self->crop.nWidth
+              || vinfo->height > self->crop.nHeight))) {
     GST_ERROR_OBJECT (self, "Resolution do not match: port=%ux%u vinfo=%dx%d",
         (guint) port_def->format.video.nFrameWidth,
         (guint) port_def->format.video.nFrameHeight,
@@ -493,6 +956,17 @@ gst_omx_video_dec_fill_buffer (GstOMXVideoDec * self,
     goto done;
   }
 
+  format = self->out_format.format;
+  if (GST_VIDEO_INFO_FORMAT (vinfo) != format ||
+      self->out_format.packing != GST_OMX_VIDEO_PACKING_NONE ||
+      self->out_format.tiling !=
+      gst_omx_video_convert_get_tiling (GST_VIDEO_INFO_FORMAT (vinfo)) ||
+      vinfo->width != port_def->format.video.nFrameWidth ||
+      vinfo->height != port_def->format.video.nFrameHeight) {
+    ret = gst_omx_video_dec_convert_buffer (self, inbuf, outbuf, vinfo, format);
+    goto done;
+  }
+
 /* Try using gst_video_frame_map() before use gst_buffer_map() because
  * gst_buffer_map() could return the different pointer from the
  * buffers received from the sink plugin. If sink plugin return multiple
@@ -542,6 +1016,17 @@ gst_omx_video_dec_fill_buffer (GstOMXVideoDec * self,
         dst_width[2] = GST_VIDEO_INFO_WIDTH (vinfo) / 2;
         dst_height[2] = GST_VIDEO_INFO_HEIGHT (vinfo) / 2;
         break;
+      case GST_VIDEO_FORMAT_I420_10LE:
+        dst_width[0] = GST_VIDEO_INFO_WIDTH (vinfo) * 2;
+        src_stride[1] = nstride / 2;
+        src_size[1] = (src_stride[1] * nslice) / 2;
+        dst_width[1] = GST_VIDEO_INFO_WIDTH (vinfo);
+        dst_height[1] = GST_VIDEO_INFO_HEIGHT (vinfo) / 2;
+        src_stride[2] = nstride / 2;
+        src_size[2] = (src_stride[1] * nslice) / 2;
+        dst_width[2] = GST_VIDEO_INFO_WIDTH (vinfo);
+        dst_height[2] = GST_VIDEO_INFO_HEIGHT (vinfo) / 2;
+        break;
       case GST_VIDEO_FORMAT_NV12:
         dst_width[0] = GST_VIDEO_INFO_WIDTH (vinfo);
         src_stride[1] = nstride;
@@ -549,6 +1034,15 @@ gst_omx_video_dec_fill_buffer (GstOMXVideoDec * self,
         dst_width[1] = GST_VIDEO_INFO_WIDTH (vinfo);
         dst_height[1] = GST_VIDEO_INFO_HEIGHT (vinfo) / 2;
         break;
+#if GST_CHECK_VERSION(1, 10, 0)
+      case GST_VIDEO_FORMAT_P010_10LE:
+        dst_width[0] = GST_VIDEO_INFO_WIDTH (vinfo) * 2;
+        src_stride[1] = nstride;
+        src_size[1] = src_stride[1] * nslice / 2;
+        dst_width[1] = GST_VIDEO_INFO_WIDTH (vinfo) * 2;
+        dst_height[1] = GST_VIDEO_INFO_HEIGHT (vinfo) / 2;
+        break;
+#endif
       case GST_VIDEO_FORMAT_NV16:
         dst_width[0] = GST_VIDEO_INFO_WIDTH (vinfo);
         src_stride[1] = nstride;
@@ -557,8 +1051,10 @@ gst_omx_video_dec_fill_buffer (GstOMXVideoDec * self,
         dst_height[1] = GST_VIDEO_INFO_HEIGHT (vinfo);
         break;
       default:
-        g_assert_not_reached ();
-        break;
+        GST_ERROR_OBJECT (self, "Can't copy %s frames",
+            gst_video_format_to_string (GST_VIDEO_INFO_FORMAT (vinfo)));
+        gst_video_frame_unmap (&frame);
+        goto done;
     }
 
     src = inbuf->omx_buf->pBuffer + inbuf->omx_buf->nOffset;
@@ -614,11 +1110,143 @@ done:
           OMX_TICKS_PER_SECOND);
   }
 
+  gst_omx_buffer_sync_end (inbuf, FALSE);
+  gst_video_codec_state_unref (state);
+
+  return ret;
+}
+
+/* Adaptive playback needs a maximum size and a component that takes
+ * resolution changes within the allocated buffers */
+static gboolean
+gst_omx_video_dec_is_adaptive (GstOMXVideoDec * self)
+{
+  return self->max_width > 0 && self->max_height > 0 && self->dec
+      && (self->dec->hacks & GST_OMX_HACK_ADAPTIVE_PLAYBACK);
+}
+
+/* low-latency and thumbnail mode keep as few frames in the component as it
+ * allows. The output port has to be disabled or the component Loaded */
+static OMX_ERRORTYPE
+gst_omx_video_dec_use_min_output_buffers (GstOMXVideoDec * self)
+{
+  OMX_PARAM_PORTDEFINITIONTYPE port_def;
+
+  if (!self->low_latency && !self->thumbnail)
+    return OMX_ErrorNone;
+
+  gst_omx_port_get_port_definition (self->dec_out_port, &port_def);
+  if (port_def.nBufferCountActual == port_def.nBufferCountMin)
+    return OMX_ErrorNone;
+
+  GST_DEBUG_OBJECT (self, "Using minimum of %u output buffers",
+      (guint) port_def.nBufferCountMin);
+  port_def.nBufferCountActual = port_def.nBufferCountMin;
+
+  return gst_omx_port_update_port_definition (self->dec_out_port, &port_def);
+}
+
+/* In adaptive mode make the output buffers big enough for the maximum
+ * resolution, so that later resolution changes can reuse them */
+static OMX_ERRORTYPE
+gst_omx_video_dec_reserve_max_resolution (GstOMXVideoDec * self,
+    GstOMXPort * port)
+{
+  OMX_PARAM_PORTDEFINITIONTYPE port_def;
+  GstVideoFormat format;
+  GstVideoInfo info;
+  guint width, height;
+
+  if (!gst_omx_video_dec_is_adaptive (self) || port != self->dec_out_port)
+    return OMX_ErrorNone;
+
+  gst_omx_port_get_port_definition (port, &port_def);
+  format =
+      gst_omx_video_dec_get_format (self, port_def.format.video.eColorFormat);
+  if (format == GST_VIDEO_FORMAT_UNKNOWN)
+    return OMX_ErrorNone;
+
+  width = MAX (self->max_width, port_def.format.video.nFrameWidth);
+  height = MAX (self->max_height, port_def.format.video.nFrameHeight);
+  if (port_def.format.video.nStride > 0)
+    width = MAX (width, (guint) port_def.format.video.nStride);
+  height = MAX (height, port_def.format.video.nSliceHeight);
+
+  gst_video_info_init (&info);
+  gst_video_info_set_format (&info, format, width, height);
+  if (port_def.nBufferSize >= info.size)
+    return OMX_ErrorNone;
+
+  GST_DEBUG_OBJECT (self, "Reserving %" G_GSIZE_FORMAT " bytes per output "
+      "buffer for up to %ux%u", info.size, self->max_width, self->max_height);
+  port_def.nBufferSize = info.size;
+
+  return gst_omx_port_update_port_definition (port, &port_def);
+}
+
+/* Whether the new output port settings fit into the already allocated
+ * output buffers, so that only the caps have to be updated */
+static gboolean
+gst_omx_video_dec_can_resize_in_place (GstOMXVideoDec * self,
+    GstOMXPort * port)
+{
+  OMX_PARAM_PORTDEFINITIONTYPE *port_def = &port->port_def;
+  GstVideoCodecState *state;
+  GstOMXBuffer *buf;
+  gboolean ret;
+
+  if (!gst_omx_video_dec_is_adaptive (self) || port != self->dec_out_port
+      || !gst_omx_port_is_enabled (port) || !port->buffers
+      || port->buffers->len == 0)
+    return FALSE;
+
+  if (port_def->format.video.nFrameWidth > self->max_width
+      || port_def->format.video.nFrameHeight > self->max_height
+      || port_def->nBufferCountActual > port->buffers->len)
+    return FALSE;
+
+  buf = g_ptr_array_index (port->buffers, 0);
+  if (port_def->nBufferSize > buf->omx_buf->nAllocLen)
+    return FALSE;
+
+  state = gst_video_decoder_get_output_state (GST_VIDEO_DECODER (self));
+  if (!state)
+    return FALSE;
+  ret = GST_VIDEO_INFO_FORMAT (&state->info) ==
+      gst_omx_video_dec_get_format (self, port_def->format.video.eColorFormat);
   gst_video_codec_state_unref (state);
 
+  if (ret && self->out_port_pool)
+    ret = gst_omx_buffer_pool_resize (self->out_port_pool,
+        port_def->format.video.nFrameWidth,
+        port_def->format.video.nFrameHeight);
+
   return ret;
 }
 
+/* Whether the output buffers are allocated from a dma-heap and handed to
+ * the component. The Renesas component exports its own buffers through
+ * mmngr instead */
+static gboolean
+gst_omx_video_dec_use_dma_heap (GstOMXVideoDec * self)
+{
+#if defined (HAVE_DMA_HEAP) && !(defined (HAVE_MMNGRBUF) && defined (HAVE_VIDEODEC_EXT))
+  return self->use_dmabuf;
+#else
+  return FALSE;
+#endif
+}
+
+static OMX_ERRORTYPE
+gst_omx_video_dec_allocate_output_port_buffers (GstOMXVideoDec * self,
+    GstOMXPort * port)
+{
+  if (port == self->dec_out_port && gst_omx_video_dec_use_dma_heap (self))
+    return gst_omx_port_allocate_dmabufs (port, self->dma_heap);
+
+  return gst_omx_port_allocate_buffers (port);
+}
+
 static OMX_ERRORTYPE
 gst_omx_video_dec_allocate_output_buffers (GstOMXVideoDec * self)
 {
@@ -638,6 +1266,10 @@ gst_omx_video_dec_allocate_output_buffers (GstOMXVideoDec * self)
   port = self->dec_out_port;
 #endif
 
+  if (gst_omx_video_dec_reserve_max_resolution (self, port) != OMX_ErrorNone)
+    GST_WARNING_OBJECT (self,
+        "Failed to reserve output buffers for the maximum resolution");
+
   pool = gst_video_decoder_get_buffer_pool (GST_VIDEO_DECODER (self));
   if (pool) {
     GstAllocator *allocator;
@@ -657,7 +1289,10 @@ gst_omx_video_dec_allocate_output_buffers (GstOMXVideoDec * self)
     }
 
     /* Need at least 2 buffers for anything meaningful */
-    min = MAX (MAX (min, port->port_def.nBufferCountMin), 4);
+    if (self->low_latency || self->thumbnail)
+      min = MAX (MAX (min, port->port_def.nBufferCountMin), 2);
+    else
+      min = MAX (MAX (min, port->port_def.nBufferCountMin), 4);
     if (max == 0) {
       max = min;
     } else if (max < port->port_def.nBufferCountMin || max < 2) {
@@ -864,7 +1499,7 @@ gst_omx_video_dec_allocate_output_buffers (GstOMXVideoDec * self)
       was_enabled = FALSE;
     }
 
-    err = gst_omx_port_allocate_buffers (port);
+    err = gst_omx_video_dec_allocate_output_port_buffers (self, port);
     if (err != OMX_ErrorNone && min > port->port_def.nBufferCountMin) {
       GST_ERROR_OBJECT (self,
           "Failed to allocate required number of buffers %d, trying less and copying",
@@ -896,7 +1531,7 @@ gst_omx_video_dec_allocate_output_buffers (GstOMXVideoDec * self)
         }
       }
 
-      err = gst_omx_port_allocate_buffers (port);
+      err = gst_omx_video_dec_allocate_output_port_buffers (self, port);
 
       /* Can't provide buffers downstream in this case */
       gst_caps_replace (&caps, NULL);
@@ -948,6 +1583,7 @@ gst_omx_video_dec_allocate_output_buffers (GstOMXVideoDec * self)
       self->out_port_pool = NULL;
     } else {
       GST_OMX_BUFFER_POOL (self->out_port_pool)->allocating = FALSE;
+      gst_omx_dmabuf_cache_trim (self->dmabuf_cache);
     }
   } else if (self->out_port_pool) {
     gst_object_unref (self->out_port_pool);
@@ -994,6 +1630,185 @@ gst_omx_video_dec_deallocate_output_buffers (GstOMXVideoDec * self)
   return err;
 }
 
+static gboolean
+gst_omx_video_dec_peer_accepts_format (GstCaps * peer_caps,
+    GstVideoFormat format)
+{
+  GstCaps *caps;
+  gboolean ret;
+
+  caps = gst_caps_new_simple ("video/x-raw", "format", G_TYPE_STRING,
+      gst_video_format_to_string (format), NULL);
+  ret = gst_caps_can_intersect (peer_caps, caps);
+  gst_caps_unref (caps);
+
+  return ret;
+}
+
+/* In copy mode fill_buffer() writes every output frame, so the decoded
+ * picture can be converted to RGB on the way if downstream does not accept
+ * the port format */
+static GstVideoFormat
+gst_omx_video_dec_get_output_format (GstOMXVideoDec * self,
+    GstCaps * peer_caps, GstVideoFormat format)
+{
+  static const GstVideoFormat rgb_formats[] = {
+    GST_VIDEO_FORMAT_RGB, GST_VIDEO_FORMAT_BGR,
+    GST_VIDEO_FORMAT_RGBx, GST_VIDEO_FORMAT_BGRx
+  };
+  guint i;
+
+  if (gst_omx_video_dec_peer_accepts_format (peer_caps, format))
+    return format;
+
+  for (i = 0; i < G_N_ELEMENTS (rgb_formats); i++) {
+    if (!gst_omx_video_convert_is_supported (format, rgb_formats[i]))
+      continue;
+    if (gst_omx_video_dec_peer_accepts_format (peer_caps, rgb_formats[i])) {
+      GST_DEBUG_OBJECT (self, "Converting %s to %s while copying",
+          gst_video_format_to_string (format),
+          gst_video_format_to_string (rgb_formats[i]));
+      return rgb_formats[i];
+    }
+  }
+
+  return format;
+}
+
+/* Likewise downstream may ask for a smaller picture than the decoded one,
+ * which fill_buffer() then downscales while copying */
+static void
+gst_omx_video_dec_get_output_size (GstOMXVideoDec * self,
+    GstCaps * peer_caps, GstVideoFormat format, guint * width,
+    guint * height)
+{
+  GstCaps *filter, *caps;
+  GstStructure *s;
+  gint w, h;
+
+  filter = gst_caps_new_simple ("video/x-raw", "format", G_TYPE_STRING,
+      gst_video_format_to_string (format), NULL);
+  caps = gst_caps_intersect (peer_caps, filter);
+  gst_caps_unref (filter);
+  if (gst_caps_is_empty (caps))
+    goto done;
+
+  caps = gst_caps_truncate (caps);
+  s = gst_caps_get_structure (caps, 0);
+  if (!gst_structure_has_field (s, "width") ||
+      !gst_structure_has_field (s, "height"))
+    goto done;
+
+  gst_structure_fixate_field_nearest_int (s, "width", *width);
+  gst_structure_fixate_field_nearest_int (s, "height", *height);
+  if (!gst_structure_get_int (s, "width", &w) ||
+      !gst_structure_get_int (s, "height", &h))
+    goto done;
+
+  if (w > 0 && h > 0 && (guint) w <= *width && (guint) h <= *height &&
+      ((guint) w != *width || (guint) h != *height)) {
+    GST_DEBUG_OBJECT (self, "Downscaling %ux%u to %dx%d while copying",
+        *width, *height, w, h);
+    *width = w;
+    *height = h;
+  }
+
+done:
+  gst_caps_unref (caps);
+}
+
+static GstVideoCodecState *
+gst_omx_video_dec_set_output_state (GstOMXVideoDec * self,
+    GstVideoFormat format, guint width, guint height)
+{
+  GstOMXVideoDecClass *klass = GST_OMX_VIDEO_DEC_GET_CLASS (self);
+  gboolean copy = !self->no_copy && !self->use_dmabuf;
+  GstVideoFormat out_format = format;
+  guint out_width, out_height;
+  GstVideoCodecState *state;
+  GstCaps *templ_caps, *peer_caps;
+
+  gst_omx_video_dec_update_crop (self);
+  self->crop_renegotiate = FALSE;
+  self->force_copy = FALSE;
+
+  gst_omx_video_resolve_format (klass->cdata.vendor_formats,
+      self->dec_out_port->port_def.format.video.eColorFormat,
+      &self->out_format);
+
+  templ_caps = gst_pad_get_pad_template_caps (GST_VIDEO_DECODER_SRC_PAD (self));
+  peer_caps =
+      gst_pad_peer_query_caps (GST_VIDEO_DECODER_SRC_PAD (self), templ_caps);
+  gst_caps_unref (templ_caps);
+
+  /* Tiled pictures are passed downstream as they are if it supports the
+   * tiled format, and detiled while copying otherwise */
+  if (gst_omx_video_convert_get_tiling (format) != GST_OMX_VIDEO_TILING_NONE
+      && (copy || !gst_omx_video_dec_peer_accepts_format (peer_caps,
+              format))) {
+    GST_DEBUG_OBJECT (self, "Detiling %s while copying",
+        gst_video_format_to_string (format));
+    out_format = GST_VIDEO_FORMAT_NV12;
+    self->force_copy = !copy;
+  }
+
+  /* Vendor packed or tiled pictures can only be passed downstream
+   * unpacked and detiled */
+  if (!copy &&
+      (self->out_format.packing != GST_OMX_VIDEO_PACKING_NONE
+          || self->out_format.tiling !=
+          gst_omx_video_convert_get_tiling (format))) {
+    GST_DEBUG_OBJECT (self, "Copying vendor specific output port buffers");
+    self->force_copy = TRUE;
+  }
+
+  /* Output only the visible region, unless downstream crops the output
+   * port buffers itself */
+  if (gst_omx_video_dec_has_crop (self) &&
+      gst_omx_video_convert_is_supported (format, out_format)) {
+    if (copy || self->force_copy) {
+      width = self->crop.nWidth;
+      height = self->crop.nHeight;
+    } else if (!self->crop_meta) {
+      width = self->crop.nWidth;
+      height = self->crop.nHeight;
+      self->force_copy = TRUE;
+    }
+  }
+  out_width = width;
+  out_height = height;
+
+  if (copy && out_format == format &&
+      self->out_format.tiling == GST_OMX_VIDEO_TILING_NONE &&
+      gst_omx_video_convert_is_supported (format, format)) {
+    out_format = gst_omx_video_dec_get_output_format (self, peer_caps, format);
+    if (gst_omx_video_convert_can_scale (format))
+      gst_omx_video_dec_get_output_size (self, peer_caps, out_format,
+          &out_width, &out_height);
+  }
+  gst_caps_unref (peer_caps);
+
+  state = gst_video_decoder_set_output_state (GST_VIDEO_DECODER (self),
+      out_format, out_width, out_height, self->input_state);
+
+  if (GST_VIDEO_FORMAT_INFO_IS_RGB (gst_video_format_get_info (out_format))
+      && out_format != format) {
+    /* The converted frames are plain sRGB */
+    gst_video_colorimetry_from_string (&state->info.colorimetry,
+        GST_VIDEO_COLORIMETRY_SRGB);
+    state->info.chroma_site = GST_VIDEO_CHROMA_SITE_UNKNOWN;
+  }
+
+  if (out_width != width || out_height != height) {
+    /* Keep the display aspect ratio of the decoded picture */
+    gst_util_fraction_multiply (state->info.par_n, state->info.par_d,
+        width * out_height, height * out_width, &state->info.par_n,
+        &state->info.par_d);
+  }
+
+  return state;
+}
+
 static OMX_ERRORTYPE
 gst_omx_video_dec_reconfigure_output_port (GstOMXVideoDec * self)
 {
@@ -1192,7 +2007,7 @@ gst_omx_video_dec_reconfigure_output_port (GstOMXVideoDec * self)
   g_assert (port_def.format.video.eCompressionFormat == OMX_VIDEO_CodingUnused);
 
   format =
-      gst_omx_video_get_format_from_omx (port_def.format.video.eColorFormat);
+      gst_omx_video_dec_get_format (self, port_def.format.video.eColorFormat);
 
   if (format == GST_VIDEO_FORMAT_UNKNOWN) {
     GST_ERROR_OBJECT (self, "Unsupported color format: %d",
@@ -1209,9 +2024,8 @@ gst_omx_video_dec_reconfigure_output_port (GstOMXVideoDec * self)
       (guint) port_def.format.video.nFrameWidth,
       (guint) port_def.format.video.nFrameHeight);
 
-  state = gst_video_decoder_set_output_state (GST_VIDEO_DECODER (self),
-      format, port_def.format.video.nFrameWidth,
-      port_def.format.video.nFrameHeight, self->input_state);
+  state = gst_omx_video_dec_set_output_state (self, format,
+      port_def.format.video.nFrameWidth, port_def.format.video.nFrameHeight);
 
   if (!gst_video_decoder_negotiate (GST_VIDEO_DECODER (self))) {
     gst_video_codec_state_unref (state);
@@ -1245,74 +2059,1564 @@ done:
   return err;
 }
 
-static void
-gst_omx_video_dec_clean_older_frames (GstOMXVideoDec * self,
-    GstOMXBuffer * buf, GList * frames)
+/* Whether the frame ends before the start of the input segment, e.g. the
+ * frames between the previous keyframe and the target of an accurate seek */
+static gboolean
+gst_omx_video_dec_frame_is_before_segment (GstOMXVideoDec * self,
+    GstVideoCodecFrame * frame)
 {
-  GList *l;
-  GstClockTime timestamp;
+  GstSegment *segment = &GST_VIDEO_DECODER (self)->input_segment;
+  GstClockTime end;
 
-  timestamp = gst_util_uint64_scale (buf->omx_buf->nTimeStamp, GST_SECOND,
-      OMX_TICKS_PER_SECOND);
+  if (segment->format != GST_FORMAT_TIME
+      || !GST_CLOCK_TIME_IS_VALID (segment->start)
+      || !GST_CLOCK_TIME_IS_VALID (frame->pts))
+    return FALSE;
 
-  if (GST_CLOCK_TIME_IS_VALID (timestamp)) {
+  /* Without a duration a frame at the segment start is its first one */
+  if (!GST_CLOCK_TIME_IS_VALID (frame->duration))
+    return frame->pts < segment->start;
+
+  end = frame->pts + frame->duration;
+
+  return end <= segment->start;
+}
+
+/* Whether only keyframes have to be decoded, e.g. while scrubbing */
+static gboolean
+gst_omx_video_dec_is_key_unit_trickmode (GstOMXVideoDec * self)
+{
+#if GST_CHECK_VERSION(1,6,0)
+  GstSegment *segment = &GST_VIDEO_DECODER (self)->input_segment;
+
+  return (segment->flags & GST_SEGMENT_FLAG_TRICKMODE_KEY_UNITS) != 0;
+#else
+  return FALSE;
+#endif
+}
+
+/* Discard a frame that was only fed to the component to keep the
+ * reference chain intact. Late frames were accounted and reported when
+ * they were marked decode-only */
+static GstFlowReturn
+gst_omx_video_dec_drop_decode_only_frame (GstOMXVideoDec * self,
+    GstVideoCodecFrame * frame)
+{
+  GST_LOG_OBJECT (self, "dropping decode-only frame %p (#%d) PTS:%"
+      GST_TIME_FORMAT, frame, frame->system_frame_number,
+      GST_TIME_ARGS (frame->pts));
+
+  gst_video_decoder_release_frame (GST_VIDEO_DECODER (self), frame);
+
+  return GST_FLOW_OK;
+}
+
+/* Tells the application that @frame won't be shown because it is
+ * @deadline late. gst_video_decoder_release_frame() posts no QoS
+ * message, unlike gst_video_decoder_drop_frame() */
+static void
+gst_omx_video_dec_post_qos (GstOMXVideoDec * self, GstVideoCodecFrame * frame,
+    GstClockTimeDiff deadline)
+{
+  GstSegment *segment = &GST_VIDEO_DECODER (self)->input_segment;
+  guint64 processed, dropped;
+  GstMessage *msg;
+
+  GST_OBJECT_LOCK (self);
+  processed = self->qos_processed;
+  dropped = self->qos_skipped + self->qos_decode_only;
+  GST_OBJECT_UNLOCK (self);
+
+  msg = gst_message_new_qos (GST_OBJECT_CAST (self), FALSE,
+      gst_segment_to_running_time (segment, GST_FORMAT_TIME, frame->pts),
+      gst_segment_to_stream_time (segment, GST_FORMAT_TIME, frame->pts),
+      frame->pts, frame->duration);
+  gst_message_set_qos_values (msg, -deadline, 1.0, 1000000);
+  gst_message_set_qos_stats (msg, GST_FORMAT_BUFFERS, processed, dropped);
+  gst_element_post_message (GST_ELEMENT_CAST (self), msg);
+}
+
+#ifdef HAVE_VIDEODEC_EXT
+/* TRUE if the reorder stage can bring the output of a component that
+ * doesn't reorder into presentation order. A reorder-depth of 0 says the
+ * stream needs no reordering, by default the subclasses with a
+ * prepare_frame() hook report the reorder depth of the stream */
+static gboolean
+gst_omx_video_dec_can_reorder (GstOMXVideoDec * self)
+{
+  return self->reorder_depth >= 0
+      || GST_OMX_VIDEO_DEC_GET_CLASS (self)->prepare_frame != NULL;
+}
+#endif
+
+/* TRUE if the component outputs in presentation order, holding back as
+ * many frames as the stream reorders. low-latency only turns this off if
+ * the reorder stage takes over */
+static gboolean
+gst_omx_video_dec_component_reorders (GstOMXVideoDec * self)
+{
+#ifdef HAVE_VIDEODEC_EXT
+  if (self->no_reorder || self->thumbnail)
+    return FALSE;
+
+  return !self->low_latency || !gst_omx_video_dec_can_reorder (self);
+#else
+  return TRUE;
+#endif
+}
+
+/* Frames the reorder stage holds back, 0 if the component outputs in
+ * presentation order */
+static guint
+gst_omx_video_dec_get_reorder_depth (GstOMXVideoDec * self)
+{
+  if (self->reorder_depth >= 0)
+    return self->reorder_depth;
+
+#ifdef HAVE_VIDEODEC_EXT
+  /* The component was told not to reorder, see set_format() */
+  if (!gst_omx_video_dec_component_reorders (self) && !self->thumbnail &&
+      self->stream_reorder_depth > 0)
+    return MIN (self->stream_reorder_depth, MAX_REORDER_DEPTH);
+#endif
+
+  return 0;
+}
+
+static gboolean
+gst_omx_video_dec_reorder_before (GstVideoCodecFrame * a,
+    GstVideoCodecFrame * b)
+{
+  if (a->pts != b->pts)
+    return a->pts < b->pts;
+
+  return a->system_frame_number < b->system_frame_number;
+}
+
+static void
+gst_omx_video_dec_reorder_push (GstOMXVideoDec * self,
+    GstVideoCodecFrame * frame)
+{
+  GPtrArray *heap = self->reorder_queue;
+  guint i, parent;
+
+  g_ptr_array_add (heap, frame);
+  for (i = heap->len - 1; i > 0; i = parent) {
+    parent = (i - 1) / 2;
+    if (!gst_omx_video_dec_reorder_before (heap->pdata[i],
+            heap->pdata[parent]))
+      break;
+    heap->pdata[i] = heap->pdata[parent];
+    heap->pdata[parent] = frame;
+  }
+}
+
+static GstVideoCodecFrame *
+gst_omx_video_dec_reorder_pop (GstOMXVideoDec * self)
+{
+  GPtrArray *heap = self->reorder_queue;
+  GstVideoCodecFrame *frame;
+  gpointer tmp;
+  guint i = 0, child;
+
+  frame = g_ptr_array_remove_index_fast (heap, 0);
+  while ((child = 2 * i + 1) < heap->len) {
+    if (child + 1 < heap->len &&
+        gst_omx_video_dec_reorder_before (heap->pdata[child + 1],
+            heap->pdata[child]))
+      child++;
+    if (!gst_omx_video_dec_reorder_before (heap->pdata[child],
+            heap->pdata[i]))
+      break;
+    tmp = heap->pdata[i];
+    heap->pdata[i] = heap->pdata[child];
+    heap->pdata[child] = tmp;
+    i = child;
+  }
+
+  return frame;
+}
+
+/* Finish @frame through the reorder stage, which outputs the held back
+ * frames by increasing PTS once there are more than the reorder depth */
+static GstFlowReturn
+gst_omx_video_dec_finish_frame (GstOMXVideoDec * self,
+    GstVideoCodecFrame * frame)
+{
+  guint depth = gst_omx_video_dec_get_reorder_depth (self);
+  GstFlowReturn ret = GST_FLOW_OK, tmp;
+
+  if (depth == 0 && self->reorder_queue->len == 0)
+    return gst_video_decoder_finish_frame (GST_VIDEO_DECODER (self), frame);
+
+  gst_omx_video_dec_reorder_push (self, frame);
+  while (self->reorder_queue->len > depth) {
+    tmp = gst_video_decoder_finish_frame (GST_VIDEO_DECODER (self),
+        gst_omx_video_dec_reorder_pop (self));
+    if (ret == GST_FLOW_OK)
+      ret = tmp;
+  }
+
+  return ret;
+}
+
+/* Output all held back frames, at EOS or when draining */
+static GstFlowReturn
+gst_omx_video_dec_reorder_drain (GstOMXVideoDec * self)
+{
+  GstFlowReturn ret = GST_FLOW_OK, tmp;
+
+  while (self->reorder_queue->len > 0) {
+    tmp = gst_video_decoder_finish_frame (GST_VIDEO_DECODER (self),
+        gst_omx_video_dec_reorder_pop (self));
+    if (ret == GST_FLOW_OK)
+      ret = tmp;
+  }
+
+  return ret;
+}
+
+static void
+gst_omx_video_dec_reorder_clear (GstOMXVideoDec * self)
+{
+  guint i;
+
+  for (i = 0; i < self->reorder_queue->len; i++)
+    gst_video_decoder_release_frame (GST_VIDEO_DECODER (self),
+        g_ptr_array_index (self->reorder_queue, i));
+  g_ptr_array_set_size (self->reorder_queue, 0);
+}
+
+static gpointer
+gst_omx_video_dec_push_thread (gpointer data)
+{
+  GstOMXVideoDec *self = data;
+  GstVideoCodecFrame *frame;
+  GstFlowReturn ret;
+  guint seqnum;
+
+  g_mutex_lock (&self->output_lock);
+  for (;;) {
+    while (g_queue_is_empty (&self->output_queue) && !self->output_stop)
+      g_cond_wait (&self->output_cond, &self->output_lock);
+    if (g_queue_is_empty (&self->output_queue))
+      break;
+
+    frame = g_queue_pop_head (&self->output_queue);
+    seqnum = self->output_seqnum;
+    self->output_busy = TRUE;
+    g_mutex_unlock (&self->output_lock);
+
+    /* The seqnum only changes with the stream lock held */
+    GST_VIDEO_DECODER_STREAM_LOCK (self);
+    if (seqnum == self->output_seqnum) {
+      ret = gst_omx_video_dec_finish_frame (self, frame);
+    } else {
+      GST_DEBUG_OBJECT (self, "Dropping frame popped before flush");
+      gst_video_decoder_release_frame (GST_VIDEO_DECODER (self), frame);
+      ret = GST_FLOW_OK;
+    }
+    GST_VIDEO_DECODER_STREAM_UNLOCK (self);
+
+    g_mutex_lock (&self->output_lock);
+    self->output_busy = FALSE;
+    if (ret != GST_FLOW_OK && self->output_flow_ret == GST_FLOW_OK)
+      self->output_flow_ret = ret;
+    g_cond_broadcast (&self->output_cond);
+  }
+  g_mutex_unlock (&self->output_lock);
+
+  return NULL;
+}
+
+static void
+gst_omx_video_dec_output_queue_start (GstOMXVideoDec * self)
+{
+  if (self->output_queue_size == 0 || self->thumbnail)
+    return;
+
+  self->output_stop = FALSE;
+  self->output_flushing = FALSE;
+  self->output_flow_ret = GST_FLOW_OK;
+  self->output_thread = g_thread_new ("omxvideodec-push",
+      gst_omx_video_dec_push_thread, self);
+}
+
+/* Releases the frames taken out of the output queue by the caller, which
+ * must not hold the output lock */
+static void
+gst_omx_video_dec_output_queue_release (GstOMXVideoDec * self, GQueue * frames)
+{
+  GstVideoCodecFrame *frame;
+
+  while ((frame = g_queue_pop_head (frames)))
+    gst_video_decoder_release_frame (GST_VIDEO_DECODER (self), frame);
+}
+
+/* Unblock the output loop waiting for the push thread */
+static void
+gst_omx_video_dec_output_queue_flush_start (GstOMXVideoDec * self)
+{
+  g_mutex_lock (&self->output_lock);
+  self->output_flushing = TRUE;
+  g_cond_broadcast (&self->output_cond);
+  g_mutex_unlock (&self->output_lock);
+}
+
+/* Called with the stream lock once the output loop is stopped */
+static void
+gst_omx_video_dec_output_queue_flush_stop (GstOMXVideoDec * self)
+{
+  GQueue frames;
+
+  g_mutex_lock (&self->output_lock);
+  self->output_seqnum++;
+  frames = self->output_queue;
+  g_queue_init (&self->output_queue);
+  self->output_flow_ret = GST_FLOW_OK;
+  self->output_flushing = FALSE;
+  g_mutex_unlock (&self->output_lock);
+
+  gst_omx_video_dec_output_queue_release (self, &frames);
+}
+
+static void
+gst_omx_video_dec_output_queue_stop (GstOMXVideoDec * self)
+{
+  GQueue frames;
+
+  if (!self->output_thread)
+    return;
+
+  g_mutex_lock (&self->output_lock);
+  self->output_seqnum++;
+  frames = self->output_queue;
+  g_queue_init (&self->output_queue);
+  self->output_stop = TRUE;
+  g_cond_broadcast (&self->output_cond);
+  g_mutex_unlock (&self->output_lock);
+
+  g_thread_join (self->output_thread);
+  self->output_thread = NULL;
+
+  gst_omx_video_dec_output_queue_release (self, &frames);
+}
+
+/* Wait until at most @pending frames are queued or being pushed. Must be
+ * called without the stream lock, the push thread needs it */
+static void
+gst_omx_video_dec_output_queue_wait (GstOMXVideoDec * self, guint pending)
+{
+  if (!self->output_thread)
+    return;
+
+  g_mutex_lock (&self->output_lock);
+  while (self->output_queue.length + (self->output_busy ? 1 : 0) > pending
+      && !self->output_flushing)
+    g_cond_wait (&self->output_cond, &self->output_lock);
+  g_mutex_unlock (&self->output_lock);
+}
+
+/* Hand @frame over to the push thread if there is one. Downstream flow
+ * errors are then returned for a later frame */
+static GstFlowReturn
+gst_omx_video_dec_output_frame (GstOMXVideoDec * self,
+    GstVideoCodecFrame * frame)
+{
+  GstFlowReturn ret;
+
+  if (!self->output_thread)
+    return gst_omx_video_dec_finish_frame (self, frame);
+
+  g_mutex_lock (&self->output_lock);
+  g_queue_push_tail (&self->output_queue, frame);
+  g_cond_broadcast (&self->output_cond);
+  ret = self->output_flow_ret;
+  g_mutex_unlock (&self->output_lock);
+
+  return ret;
+}
+
+static gpointer
+gst_omx_video_dec_feed_thread (gpointer data)
+{
+  GstOMXVideoDec *self = data;
+  GstVideoCodecFrame *frame;
+  GstFlowReturn ret;
+  guint seqnum;
+
+  g_mutex_lock (&self->input_lock);
+  for (;;) {
+    while (g_queue_is_empty (&self->input_queue) && !self->input_stop)
+      g_cond_wait (&self->input_cond, &self->input_lock);
+    if (g_queue_is_empty (&self->input_queue))
+      break;
+
+    frame = g_queue_pop_head (&self->input_queue);
+    self->input_queue_bytes -= gst_buffer_get_size (frame->input_buffer);
+    seqnum = self->input_seqnum;
+    self->input_busy = TRUE;
+    g_cond_broadcast (&self->input_cond);
+    g_mutex_unlock (&self->input_lock);
+
+    /* The seqnum only changes with the stream lock held */
+    GST_VIDEO_DECODER_STREAM_LOCK (self);
+    if (seqnum == self->input_seqnum) {
+      ret = gst_omx_video_dec_feed_frame (self, frame);
+    } else {
+      GST_DEBUG_OBJECT (self, "Dropping frame queued before flush");
+      gst_video_decoder_release_frame (GST_VIDEO_DECODER (self), frame);
+      ret = GST_FLOW_OK;
+    }
+    GST_VIDEO_DECODER_STREAM_UNLOCK (self);
+
+    g_mutex_lock (&self->input_lock);
+    self->input_busy = FALSE;
+    if (ret != GST_FLOW_OK && seqnum == self->input_seqnum
+        && self->input_flow_ret == GST_FLOW_OK)
+      self->input_flow_ret = ret;
+    g_cond_broadcast (&self->input_cond);
+  }
+  g_mutex_unlock (&self->input_lock);
+
+  return NULL;
+}
+
+static void
+gst_omx_video_dec_input_queue_start (GstOMXVideoDec * self)
+{
+  if (self->input_queue_size == 0 || self->thumbnail)
+    return;
+
+  self->input_stop = FALSE;
+  self->input_flushing = FALSE;
+  self->input_flow_ret = GST_FLOW_OK;
+  self->input_thread = g_thread_new ("omxvideodec-feed",
+      gst_omx_video_dec_feed_thread, self);
+}
+
+/* Drops the queued frames and waits for the feeder to give up the frame it
+ * is passing. Called without the stream lock, once the input port is
+ * flushing */
+static void
+gst_omx_video_dec_input_queue_flush_start (GstOMXVideoDec * self)
+{
+  GQueue frames;
+
+  if (!self->input_thread)
+    return;
+
+  g_mutex_lock (&self->input_lock);
+  frames = self->input_queue;
+  g_queue_init (&self->input_queue);
+  self->input_queue_bytes = 0;
+  self->input_flushing = TRUE;
+  g_cond_broadcast (&self->input_cond);
+  while (self->input_busy)
+    g_cond_wait (&self->input_cond, &self->input_lock);
+  g_mutex_unlock (&self->input_lock);
+
+  gst_omx_video_dec_output_queue_release (self, &frames);
+}
+
+/* Called with the stream lock */
+static void
+gst_omx_video_dec_input_queue_flush_stop (GstOMXVideoDec * self)
+{
+  g_mutex_lock (&self->input_lock);
+  self->input_seqnum++;
+  self->input_flow_ret = GST_FLOW_OK;
+  self->input_flushing = FALSE;
+  g_mutex_unlock (&self->input_lock);
+}
+
+static void
+gst_omx_video_dec_input_queue_stop (GstOMXVideoDec * self)
+{
+  if (!self->input_thread)
+    return;
+
+  gst_omx_video_dec_input_queue_flush_start (self);
+
+  g_mutex_lock (&self->input_lock);
+  self->input_stop = TRUE;
+  g_cond_broadcast (&self->input_cond);
+  g_mutex_unlock (&self->input_lock);
+
+  g_thread_join (self->input_thread);
+  self->input_thread = NULL;
+}
+
+/* Waits until the feeder passed all queued frames to the component. Must be
+ * called without the stream lock */
+static void
+gst_omx_video_dec_input_queue_wait (GstOMXVideoDec * self)
+{
+  if (!self->input_thread)
+    return;
+
+  g_mutex_lock (&self->input_lock);
+  while ((!g_queue_is_empty (&self->input_queue) || self->input_busy)
+      && !self->input_flushing)
+    g_cond_wait (&self->input_cond, &self->input_lock);
+  g_mutex_unlock (&self->input_lock);
+}
+
+static gboolean
+gst_omx_video_dec_input_queue_is_full (GstOMXVideoDec * self, gsize size)
+{
+  if (self->input_queue.length >= self->input_queue_size)
+    return TRUE;
+
+  /* A frame larger than the limit still goes into an empty queue */
+  return self->input_queue_max_bytes > 0
+      && !g_queue_is_empty (&self->input_queue)
+      && self->input_queue_bytes + size > self->input_queue_max_bytes;
+}
+
+/* Hands @frame over to the feeder, waiting for room in the queue. Must be
+ * called without the stream lock */
+static GstFlowReturn
+gst_omx_video_dec_input_queue_push (GstOMXVideoDec * self,
+    GstVideoCodecFrame * frame)
+{
+  gsize size = gst_buffer_get_size (frame->input_buffer);
+  GstFlowReturn ret;
+
+  g_mutex_lock (&self->input_lock);
+  while (gst_omx_video_dec_input_queue_is_full (self, size)
+      && !self->input_flushing)
+    g_cond_wait (&self->input_cond, &self->input_lock);
+
+  if (self->input_flushing) {
+    g_mutex_unlock (&self->input_lock);
+    gst_video_decoder_release_frame (GST_VIDEO_DECODER (self), frame);
+    return GST_FLOW_FLUSHING;
+  }
+
+  g_queue_push_tail (&self->input_queue, frame);
+  self->input_queue_bytes += size;
+  g_cond_broadcast (&self->input_cond);
+  ret = self->input_flow_ret;
+  g_mutex_unlock (&self->input_lock);
+
+  return ret;
+}
+
+/* Takes @frame out of the queue if the feeder didn't pick it up yet, the
+ * reference of the queue goes to the caller. Called with the stream lock */
+static gboolean
+gst_omx_video_dec_input_queue_remove (GstOMXVideoDec * self,
+    GstVideoCodecFrame * frame)
+{
+  gboolean removed;
+
+  if (!self->input_thread)
+    return FALSE;
+
+  g_mutex_lock (&self->input_lock);
+  removed = g_queue_remove (&self->input_queue, frame);
+  if (removed) {
+    self->input_queue_bytes -= gst_buffer_get_size (frame->input_buffer);
+    g_cond_broadcast (&self->input_cond);
+  }
+  g_mutex_unlock (&self->input_lock);
+
+  return removed;
+}
+
+/* TRUE if the feeder did not pass all queued frames yet */
+static gboolean
+gst_omx_video_dec_input_queue_is_pending (GstOMXVideoDec * self)
+{
+  gboolean pending;
+
+  if (!self->input_thread)
+    return FALSE;
+
+  g_mutex_lock (&self->input_lock);
+  pending = !g_queue_is_empty (&self->input_queue) || self->input_busy;
+  g_mutex_unlock (&self->input_lock);
+
+  return pending;
+}
+
+/* The frames that were not decoded yet. The ones held back by the reorder
+ * stage already have their output buffer */
+static GList *
+gst_omx_video_dec_get_pending_frames (GstOMXVideoDec * self)
+{
+  GList *frames, *l, *next;
+
+  frames = gst_video_decoder_get_frames (GST_VIDEO_DECODER (self));
+  for (l = frames; l; l = next) {
+    GstVideoCodecFrame *frame = l->data;
+
+    next = l->next;
+    if (frame->output_buffer) {
+      gst_video_codec_frame_unref (frame);
+      frames = g_list_delete_link (frames, l);
+    }
+  }
+
+  return frames;
+}
+
+/* Wakes up handle_frame() waiting for frames in flight to be output */
+static void
+gst_omx_video_dec_in_flight_signal (GstOMXVideoDec * self)
+{
+  g_mutex_lock (&self->in_flight_lock);
+  self->in_flight_cookie++;
+  g_cond_broadcast (&self->in_flight_cond);
+  g_mutex_unlock (&self->in_flight_lock);
+}
+
+static void
+gst_omx_video_dec_in_flight_set_flushing (GstOMXVideoDec * self,
+    gboolean flushing)
+{
+  g_mutex_lock (&self->in_flight_lock);
+  self->in_flight_flushing = flushing;
+  g_cond_broadcast (&self->in_flight_cond);
+  g_mutex_unlock (&self->in_flight_lock);
+}
+
+/* Keeps the frames pending in the input queue and the component within
+ * max-frames-in-flight, and the PTS span from the oldest of them to @frame
+ * within max-latency. Over budget, waits for the loop to output frames or
+ * drops according to the policy. Waiting gives up and drops the oldest
+ * frame when nothing was output for IN_FLIGHT_WAIT_TIMEOUT, as the
+ * component may never output it. A dropped frame that was fed already
+ * stays pending as decode-only, so that its picture still finds it.
+ *
+ * Called with the stream lock. Returns FALSE if @frame was consumed, with
+ * the flow return in @ret */
+static gboolean
+gst_omx_video_dec_limit_in_flight (GstOMXVideoDec * self,
+    GstVideoCodecFrame * frame, GstFlowReturn * ret)
+{
+  GstVideoDecoder *decoder = GST_VIDEO_DECODER (self);
+
+  for (;;) {
+    GList *frames = gst_omx_video_dec_get_pending_frames (self), *l;
+    GstVideoCodecFrame *oldest = NULL;
+    guint n = 0;
+    gboolean over = FALSE, drop_oldest = FALSE, timeout = FALSE;
+    guint cookie;
+    gint64 end_time;
+
+    /* Decode-only frames are not output, they don't count */
+    for (l = frames; l; l = l->next) {
+      GstVideoCodecFrame *tmp = l->data;
+
+      if (GST_VIDEO_CODEC_FRAME_IS_DECODE_ONLY (tmp))
+        continue;
+      if (!oldest)
+        oldest = tmp;
+      n++;
+    }
+
+    g_atomic_int_set (&self->frames_in_flight, n);
+
+    if (oldest && oldest != frame) {
+      if (self->max_frames_in_flight > 0 && n > self->max_frames_in_flight)
+        over = TRUE;
+      if (self->max_latency > 0 && GST_CLOCK_TIME_IS_VALID (frame->pts)
+          && GST_CLOCK_TIME_IS_VALID (oldest->pts)
+          && frame->pts > oldest->pts + self->max_latency)
+        over = TRUE;
+    }
+
+    if (!over) {
+      g_list_free_full (frames,
+          (GDestroyNotify) gst_video_codec_frame_unref);
+      return TRUE;
+    }
+
+    GST_LOG_OBJECT (self, "%u frames in flight since %" GST_TIME_FORMAT
+        ", over budget", n, GST_TIME_ARGS (oldest->pts));
+
+    switch (self->in_flight_policy) {
+      case GST_OMX_VIDEO_DEC_IN_FLIGHT_DROP_NEW:
+        g_list_free_full (frames,
+            (GDestroyNotify) gst_video_codec_frame_unref);
+        GST_OBJECT_LOCK (self);
+        self->in_flight_dropped++;
+        GST_OBJECT_UNLOCK (self);
+        *ret = gst_video_decoder_drop_frame (decoder, frame);
+        return FALSE;
+      case GST_OMX_VIDEO_DEC_IN_FLIGHT_DROP_OLDEST:
+        drop_oldest = TRUE;
+        break;
+      case GST_OMX_VIDEO_DEC_IN_FLIGHT_WAIT:
+      default:
+        break;
+    }
+
+    if (!drop_oldest) {
+      g_mutex_lock (&self->in_flight_lock);
+      cookie = self->in_flight_cookie;
+      g_mutex_unlock (&self->in_flight_lock);
+
+      GST_VIDEO_DECODER_STREAM_UNLOCK (self);
+      g_mutex_lock (&self->in_flight_lock);
+      end_time = g_get_monotonic_time () + IN_FLIGHT_WAIT_TIMEOUT;
+      while (cookie == self->in_flight_cookie && !self->in_flight_flushing) {
+        if (!g_cond_wait_until (&self->in_flight_cond, &self->in_flight_lock,
+                end_time)) {
+          timeout = TRUE;
+          break;
+        }
+      }
+      if (self->in_flight_flushing) {
+        g_mutex_unlock (&self->in_flight_lock);
+        GST_VIDEO_DECODER_STREAM_LOCK (self);
+        g_list_free_full (frames,
+            (GDestroyNotify) gst_video_codec_frame_unref);
+        gst_video_decoder_release_frame (decoder, frame);
+        *ret = GST_FLOW_FLUSHING;
+        return FALSE;
+      }
+      g_mutex_unlock (&self->in_flight_lock);
+      GST_VIDEO_DECODER_STREAM_LOCK (self);
+
+      if (timeout) {
+        GST_WARNING_OBJECT (self, "No output for %u frames in flight",
+            n);
+        drop_oldest = TRUE;
+      }
+    }
+
+    if (drop_oldest) {
+      GST_LOG_OBJECT (self, "Dropping oldest frame in flight %p (#%d)",
+          oldest, oldest->system_frame_number);
+      GST_OBJECT_LOCK (self);
+      self->in_flight_dropped++;
+      GST_OBJECT_UNLOCK (self);
+      if (gst_omx_video_dec_input_queue_remove (self, oldest)) {
+        /* Not fed yet, the queue's reference is released */
+        gst_video_decoder_release_frame (decoder, oldest);
+      } else {
+        /* The component outputs a picture for it, which must still be
+         * matched to this frame. The loop discards it */
+        GST_VIDEO_CODEC_FRAME_SET_DECODE_ONLY (oldest);
+      }
+    }
+    g_list_free_full (frames, (GDestroyNotify) gst_video_codec_frame_unref);
+  }
+}
+
+/* Returns TRUE if the component error is left to handle_frame() to recover
+ * from, instead of being posted */
+static gboolean
+gst_omx_video_dec_schedule_recovery (GstOMXVideoDec * self)
+{
+  if (!self->recover_on_error)
+    return FALSE;
+
+  /* Downstream holds buffers of the failed component */
+  if (self->out_port_pool
+      && g_atomic_int_get (&GST_OMX_BUFFER_POOL (self->out_port_pool)->
+          outstanding) > 0) {
+    GST_ERROR_OBJECT (self, "Can't recover with buffers held downstream");
+    return FALSE;
+  }
+
+  if (self->max_recoveries > 0 && self->recoveries >= self->max_recoveries) {
+    GST_ERROR_OBJECT (self, "Recovered %u times already", self->recoveries);
+    return FALSE;
+  }
+
+  if (!g_atomic_int_get (&self->recover_pending))
+    GST_WARNING_OBJECT (self, "Component in error state %s (0x%08x), "
+        "recovering", gst_omx_component_get_last_error_string (self->dec),
+        gst_omx_component_get_last_error (self->dec));
+  g_atomic_int_set (&self->recover_pending, TRUE);
+
+  return TRUE;
+}
+
+static void
+gst_omx_video_dec_clean_older_frames (GstOMXVideoDec * self,
+    GstOMXBuffer * buf, GList * frames)
+{
+  GList *l;
+  GstClockTime timestamp;
+
+  timestamp = gst_util_uint64_scale (buf->omx_buf->nTimeStamp, GST_SECOND,
+      OMX_TICKS_PER_SECOND);
+
+  if (GST_CLOCK_TIME_IS_VALID (timestamp)) {
     /* We could release all frames stored with pts < timestamp since the
      * decoder will likely output frames in display order */
     for (l = frames; l; l = l->next) {
       GstVideoCodecFrame *tmp = l->data;
 
-      if (tmp->pts < timestamp) {
-        gst_video_decoder_release_frame (GST_VIDEO_DECODER (self), tmp);
-        GST_LOG_OBJECT (self,
-            "discarding ghost frame %p (#%d) PTS:%" GST_TIME_FORMAT " DTS:%"
-            GST_TIME_FORMAT, tmp, tmp->system_frame_number,
-            GST_TIME_ARGS (tmp->pts), GST_TIME_ARGS (tmp->dts));
-      } else {
-        gst_video_codec_frame_unref (tmp);
+      if (tmp->pts < timestamp && GST_VIDEO_CODEC_FRAME_IS_DECODE_ONLY (tmp)) {
+        /* The component honoured OMX_BUFFERFLAG_DECODEONLY */
+        gst_omx_video_dec_drop_decode_only_frame (self, tmp);
+      } else if (tmp->pts < timestamp) {
+        GST_LOG_OBJECT (self,
+            "discarding ghost frame %p (#%d) PTS:%" GST_TIME_FORMAT " DTS:%"
+            GST_TIME_FORMAT, tmp, tmp->system_frame_number,
+            GST_TIME_ARGS (tmp->pts), GST_TIME_ARGS (tmp->dts));
+        gst_video_decoder_release_frame (GST_VIDEO_DECODER (self), tmp);
+      } else {
+        gst_video_codec_frame_unref (tmp);
+      }
+    }
+  } else {
+    /* We will release all frames with invalid timestamp because we don't even
+     * know if they will be output some day. */
+    for (l = frames; l; l = l->next) {
+      GstVideoCodecFrame *tmp = l->data;
+
+      if (!GST_CLOCK_TIME_IS_VALID (tmp->pts)) {
+        gst_video_decoder_release_frame (GST_VIDEO_DECODER (self), tmp);
+        GST_LOG_OBJECT (self,
+            "discarding frame %p (#%d) with invalid PTS:%" GST_TIME_FORMAT
+            " DTS:%" GST_TIME_FORMAT, tmp, tmp->system_frame_number,
+            GST_TIME_ARGS (tmp->pts), GST_TIME_ARGS (tmp->dts));
+      } else {
+        gst_video_codec_frame_unref (tmp);
+      }
+    }
+  }
+
+  g_list_free (frames);
+}
+
+static GstBuffer *
+copy_frame (const GstVideoInfo * info, GstBuffer * outbuf)
+{
+  GstVideoInfo out_info, tmp_info;
+  GstBuffer *tmpbuf;
+  GstVideoFrame out_frame, tmp_frame;
+
+  out_info = *info;
+  tmp_info = *info;
+
+  tmpbuf = gst_buffer_new_and_alloc (out_info.size);
+
+  gst_video_frame_map (&out_frame, &out_info, outbuf, GST_MAP_READ);
+  gst_video_frame_map (&tmp_frame, &tmp_info, tmpbuf, GST_MAP_WRITE);
+  gst_video_frame_copy (&tmp_frame, &out_frame);
+  gst_video_frame_unmap (&out_frame);
+  gst_video_frame_unmap (&tmp_frame);
+
+  gst_buffer_unref (outbuf);
+
+  return tmpbuf;
+}
+
+/* Describe the visible region of an output port buffer for downstream */
+static void
+gst_omx_video_dec_set_crop_meta (GstOMXVideoDec * self, GstBuffer * outbuf)
+{
+  GstVideoCropMeta *meta;
+
+  /* Pool buffers are reused, so also reset a crop meta that is not
+   * needed anymore */
+  meta = gst_buffer_get_video_crop_meta (outbuf);
+  if (!meta) {
+    if (!self->crop_meta || !gst_omx_video_dec_has_crop (self))
+      return;
+    meta = gst_buffer_add_video_crop_meta (outbuf);
+  }
+
+  meta->x = self->crop.nLeft;
+  meta->y = self->crop.nTop;
+  meta->width = self->crop.nWidth;
+  meta->height = self->crop.nHeight;
+}
+
+/* Buffer for copying the decoded picture to. If there is an output port
+ * pool it is also the decoder's pool, so use system memory instead */
+static GstBuffer *
+gst_omx_video_dec_allocate_copy_buffer (GstOMXVideoDec * self)
+{
+  GstVideoCodecState *state;
+  GstBuffer *outbuf;
+
+  if (!self->out_port_pool)
+    return gst_video_decoder_allocate_output_buffer (GST_VIDEO_DECODER (self));
+
+  state = gst_video_decoder_get_output_state (GST_VIDEO_DECODER (self));
+  outbuf = gst_buffer_new_and_alloc (GST_VIDEO_INFO_SIZE (&state->info));
+  gst_video_codec_state_unref (state);
+
+  return outbuf;
+}
+
+/* Preview: a downscaled copy of the decoded pictures from a second output
+ * port of the component, optionally through a scaler component tunnelled
+ * like egl_render. The buffers are pushed on the preview pad from their
+ * own task, wrapping the port buffers without copying them */
+
+static gboolean
+gst_omx_video_dec_preview_enabled (GstOMXVideoDec * self)
+{
+  GstOMXVideoDecClass *klass = GST_OMX_VIDEO_DEC_GET_CLASS (self);
+
+  return klass->cdata.preview_port_index != -1 && self->preview_width > 0
+      && self->preview_height > 0 && !self->thumbnail;
+}
+
+static gboolean
+gst_omx_video_dec_preview_open (GstOMXVideoDec * self)
+{
+  GstOMXVideoDecClass *klass = GST_OMX_VIDEO_DEC_GET_CLASS (self);
+  gint in_port_index, out_port_index;
+
+  if (!gst_omx_video_dec_preview_enabled (self))
+    return TRUE;
+
+  self->preview_port =
+      gst_omx_component_add_port (self->dec, klass->cdata.preview_port_index);
+  if (!self->preview_port)
+    return FALSE;
+  self->preview_out_port = self->preview_port;
+
+  if (!klass->cdata.preview_component_name)
+    return TRUE;
+
+  GST_DEBUG_OBJECT (self, "Opening preview scaler");
+  self->preview_scaler =
+      gst_omx_component_new (GST_OBJECT_CAST (self), klass->cdata.core_name,
+      klass->cdata.preview_component_name, NULL, klass->cdata.hacks);
+
+  if (!self->preview_scaler)
+    return FALSE;
+
+  if (gst_omx_component_get_state (self->preview_scaler,
+          GST_CLOCK_TIME_NONE) != OMX_StateLoaded)
+    return FALSE;
+
+  {
+    /* Scalers have either video or image ports */
+    static const OMX_INDEXTYPE init_index[] =
+        { OMX_IndexParamVideoInit, OMX_IndexParamImageInit };
+    OMX_PORT_PARAM_TYPE param;
+    guint i;
+
+    /* Fallback */
+    in_port_index = 0;
+    out_port_index = 1;
+
+    for (i = 0; i < G_N_ELEMENTS (init_index); i++) {
+      GST_OMX_INIT_STRUCT (&param);
+      if (gst_omx_component_get_parameter (self->preview_scaler,
+              init_index[i], &param) == OMX_ErrorNone && param.nPorts >= 2) {
+        GST_DEBUG_OBJECT (self, "Detected %u ports, starting at %u",
+            (guint) param.nPorts, (guint) param.nStartPortNumber);
+        in_port_index = param.nStartPortNumber + 0;
+        out_port_index = param.nStartPortNumber + 1;
+        break;
+      }
+    }
+  }
+
+  self->scaler_in_port =
+      gst_omx_component_add_port (self->preview_scaler, in_port_index);
+  self->preview_out_port =
+      gst_omx_component_add_port (self->preview_scaler, out_port_index);
+
+  if (!self->scaler_in_port || !self->preview_out_port)
+    return FALSE;
+
+  GST_DEBUG_OBJECT (self, "Opened preview scaler");
+
+  return TRUE;
+}
+
+static void
+gst_omx_video_dec_preview_close (GstOMXVideoDec * self)
+{
+  self->preview_port = NULL;
+  self->scaler_in_port = NULL;
+  self->preview_out_port = NULL;
+  if (self->preview_scaler)
+    gst_omx_component_free (self->preview_scaler);
+  self->preview_scaler = NULL;
+}
+
+static void
+gst_omx_video_dec_preview_set_flushing (GstOMXVideoDec * self,
+    gboolean flushing)
+{
+  if (!self->preview_port)
+    return;
+
+  gst_omx_port_set_flushing (self->preview_port, 5 * GST_SECOND, flushing);
+  if (self->preview_scaler) {
+    gst_omx_port_set_flushing (self->scaler_in_port, 5 * GST_SECOND, flushing);
+    gst_omx_port_set_flushing (self->preview_out_port, 5 * GST_SECOND,
+        flushing);
+  }
+}
+
+/* Sizes the preview port, or the scaler output behind it, and creates the
+ * preview pad. Called while the component is loaded */
+static gboolean
+gst_omx_video_dec_preview_configure (GstOMXVideoDec * self)
+{
+  GstOMXVideoDecClass *klass = GST_OMX_VIDEO_DEC_GET_CLASS (self);
+  OMX_PARAM_PORTDEFINITIONTYPE port_def;
+  OMX_ERRORTYPE err;
+
+  if (!self->preview_port)
+    return TRUE;
+
+  if (self->preview_scaler) {
+    err = gst_omx_setup_tunnel (self->preview_port, self->scaler_in_port);
+    if (err != OMX_ErrorNone) {
+      GST_ERROR_OBJECT (self, "Failed to tunnel the preview scaler: %s "
+          "(0x%08x)", gst_omx_error_to_string (err), err);
+      return FALSE;
+    }
+  }
+
+  gst_omx_port_get_port_definition (self->preview_out_port, &port_def);
+  port_def.format.video.nFrameWidth = self->preview_width;
+  port_def.format.video.nFrameHeight = self->preview_height;
+  if (gst_omx_port_update_port_definition (self->preview_out_port,
+          &port_def) != OMX_ErrorNone)
+    return FALSE;
+
+  if (!self->preview_pad) {
+    GstPadTemplate *templ =
+        gst_element_class_get_pad_template (GST_ELEMENT_CLASS (klass),
+        "preview");
+
+    self->preview_pad = gst_pad_new_from_template (templ, "preview");
+    gst_pad_use_fixed_caps (self->preview_pad);
+    gst_pad_set_active (self->preview_pad, TRUE);
+    gst_element_add_pad (GST_ELEMENT_CAST (self), self->preview_pad);
+  }
+  self->preview_renegotiate = TRUE;
+
+  return TRUE;
+}
+
+/* Called after the decoder was told to go to Idle */
+static gboolean
+gst_omx_video_dec_preview_allocate (GstOMXVideoDec * self)
+{
+  if (!self->preview_port)
+    return TRUE;
+
+  if (self->preview_scaler
+      && gst_omx_component_set_state (self->preview_scaler,
+          OMX_StateIdle) != OMX_ErrorNone)
+    return FALSE;
+
+  return gst_omx_port_allocate_buffers (self->preview_out_port) ==
+      OMX_ErrorNone;
+}
+
+static void gst_omx_video_dec_preview_loop (GstOMXVideoDec * self);
+
+/* Called once the decoder is executing */
+static gboolean
+gst_omx_video_dec_preview_activate (GstOMXVideoDec * self)
+{
+  /* The pad is kept if a recovered component has no preview port */
+  if (!self->preview_pad || !self->preview_port)
+    return TRUE;
+
+  if (self->preview_scaler) {
+    OMX_STATETYPE state;
+
+    state = gst_omx_component_get_state (self->preview_scaler,
+        GST_CLOCK_TIME_NONE);
+    if (state == OMX_StateIdle || state == OMX_StatePause) {
+      if (gst_omx_component_set_state (self->preview_scaler,
+              OMX_StateExecuting) != OMX_ErrorNone)
+        return FALSE;
+      state = gst_omx_component_get_state (self->preview_scaler,
+          GST_CLOCK_TIME_NONE);
+    }
+    if (state != OMX_StateExecuting)
+      return FALSE;
+  }
+
+  GST_OBJECT_LOCK (self);
+  self->preview_eos = FALSE;
+  GST_OBJECT_UNLOCK (self);
+
+  gst_omx_video_dec_preview_set_flushing (self, FALSE);
+  if (gst_omx_port_populate (self->preview_out_port) != OMX_ErrorNone)
+    return FALSE;
+
+  return gst_pad_start_task (self->preview_pad,
+      (GstTaskFunction) gst_omx_video_dec_preview_loop, self, NULL);
+}
+
+static void
+gst_omx_video_dec_preview_stop (GstOMXVideoDec * self)
+{
+  if (!self->preview_pad)
+    return;
+
+  gst_omx_video_dec_preview_set_flushing (self, TRUE);
+  gst_pad_stop_task (self->preview_pad);
+
+  if (self->preview_scaler
+      && gst_omx_component_get_state (self->preview_scaler, 0) > OMX_StateIdle)
+    gst_omx_component_set_state (self->preview_scaler, OMX_StateIdle);
+}
+
+/* The preview task pushes EOS itself once the port stops, so that it
+ * follows the last preview picture */
+static void
+gst_omx_video_dec_preview_eos (GstOMXVideoDec * self)
+{
+  if (!self->preview_pad)
+    return;
+
+  GST_OBJECT_LOCK (self);
+  self->preview_eos = TRUE;
+  GST_OBJECT_UNLOCK (self);
+
+  gst_omx_video_dec_preview_set_flushing (self, TRUE);
+}
+
+static gboolean
+gst_omx_video_dec_preview_sink_event (GstOMXVideoDec * self, GstEvent * event)
+{
+  switch (GST_EVENT_TYPE (event)) {
+    case GST_EVENT_FLUSH_START:
+      gst_pad_push_event (self->preview_pad, gst_event_ref (event));
+      gst_omx_video_dec_preview_set_flushing (self, TRUE);
+      gst_pad_pause_task (self->preview_pad);
+      break;
+    case GST_EVENT_SEGMENT:
+      GST_OBJECT_LOCK (self);
+      gst_event_copy_segment (event, &self->preview_segment);
+      self->preview_need_segment = TRUE;
+      GST_OBJECT_UNLOCK (self);
+      break;
+    default:
+      break;
+  }
+
+  return TRUE;
+}
+
+static gboolean
+gst_omx_video_dec_sink_event (GstVideoDecoder * decoder, GstEvent * event)
+{
+  GstOMXVideoDec *self = GST_OMX_VIDEO_DEC (decoder);
+  gboolean flush_stop = GST_EVENT_TYPE (event) == GST_EVENT_FLUSH_STOP;
+  gboolean ret;
+
+  if (GST_EVENT_TYPE (event) == GST_EVENT_FLUSH_START)
+    gst_omx_video_dec_in_flight_set_flushing (self, TRUE);
+  else if (flush_stop)
+    gst_omx_video_dec_in_flight_set_flushing (self, FALSE);
+
+  if (self->preview_pad)
+    gst_omx_video_dec_preview_sink_event (self, event);
+
+  ret =
+      GST_VIDEO_DECODER_CLASS (gst_omx_video_dec_parent_class)->sink_event
+      (decoder, event);
+
+  if (flush_stop && self->preview_pad) {
+    gst_pad_push_event (self->preview_pad, gst_event_new_flush_stop (TRUE));
+    GST_OBJECT_LOCK (self);
+    self->preview_need_segment = TRUE;
+    GST_OBJECT_UNLOCK (self);
+    if (gst_omx_component_get_state (self->dec, 0) == OMX_StateExecuting)
+      gst_omx_video_dec_preview_activate (self);
+  }
+
+  return ret;
+}
+
+static void
+gst_omx_video_dec_preview_release (GstOMXBuffer * buf)
+{
+  GstOMXVideoDec *self = GST_OMX_VIDEO_DEC (buf->port->comp->parent);
+
+  gst_omx_port_release_buffer (buf->port, buf);
+
+  g_mutex_lock (&self->preview_lock);
+  self->preview_outstanding--;
+  g_cond_broadcast (&self->preview_cond);
+  g_mutex_unlock (&self->preview_lock);
+}
+
+/* Waits until downstream released all preview pictures, which wrap the
+ * memory of the port buffers. Called from the preview task or after it
+ * stopped, before the buffers are deallocated */
+static gboolean
+gst_omx_video_dec_preview_wait_released (GstOMXVideoDec * self)
+{
+  gint64 deadline;
+  gboolean ret = TRUE;
+
+  g_mutex_lock (&self->preview_lock);
+  if (self->preview_outstanding == 0) {
+    g_mutex_unlock (&self->preview_lock);
+    return TRUE;
+  }
+  g_mutex_unlock (&self->preview_lock);
+
+  /* Ask downstream to let go of the pictures it keeps */
+  if (self->preview_pad) {
+    GstQuery *query = gst_query_new_drain ();
+
+    gst_pad_peer_query (self->preview_pad, query);
+    gst_query_unref (query);
+  }
+
+  deadline = g_get_monotonic_time () + 5 * G_TIME_SPAN_SECOND;
+  g_mutex_lock (&self->preview_lock);
+  while (self->preview_outstanding > 0) {
+    if (!g_cond_wait_until (&self->preview_cond, &self->preview_lock,
+            deadline)) {
+      GST_ERROR_OBJECT (self, "Downstream still holds %u preview pictures",
+          self->preview_outstanding);
+      ret = FALSE;
+      break;
+    }
+  }
+  g_mutex_unlock (&self->preview_lock);
+
+  return ret;
+}
+
+/* Sets the plane strides and offsets of @info from the port definition */
+static gboolean
+gst_omx_video_dec_preview_set_layout (GstOMXVideoDec * self,
+    GstVideoInfo * info, OMX_PARAM_PORTDEFINITIONTYPE * port_def)
+{
+  const guint nstride = port_def->format.video.nStride;
+  const guint nslice = MAX (port_def->format.video.nSliceHeight,
+      port_def->format.video.nFrameHeight);
+  guint last;
+
+  /* No stride reported, keep the default layout */
+  if (nstride == 0)
+    return TRUE;
+
+  info->stride[0] = nstride;
+  info->offset[0] = 0;
+
+  switch (GST_VIDEO_INFO_FORMAT (info)) {
+    case GST_VIDEO_FORMAT_I420:
+      info->stride[1] = nstride / 2;
+      info->offset[1] = nstride * nslice;
+      info->stride[2] = nstride / 2;
+      info->offset[2] = info->offset[1] + (nstride / 2) * (nslice / 2);
+      break;
+    case GST_VIDEO_FORMAT_NV12:
+    case GST_VIDEO_FORMAT_NV16:
+      info->stride[1] = nstride;
+      info->offset[1] = nstride * nslice;
+      break;
+    default:
+      if (GST_VIDEO_INFO_N_PLANES (info) > 1) {
+        GST_ERROR_OBJECT (self, "Unsupported preview format %s",
+            gst_video_format_to_string (GST_VIDEO_INFO_FORMAT (info)));
+        return FALSE;
       }
-    }
+      break;
+  }
+
+  last = GST_VIDEO_INFO_N_PLANES (info) - 1;
+  info->size = info->offset[last] +
+      info->stride[last] * GST_VIDEO_INFO_COMP_HEIGHT (info, last);
+
+  return TRUE;
+}
+
+static gboolean
+gst_omx_video_dec_preview_negotiate (GstOMXVideoDec * self)
+{
+  OMX_PARAM_PORTDEFINITIONTYPE port_def;
+  GstVideoFormat format;
+  GstVideoInfo info;
+  GstEvent *event;
+  GstCaps *caps;
+  GstQuery *query;
+  gboolean ret;
+
+  gst_omx_port_get_port_definition (self->preview_out_port, &port_def);
+  format =
+      gst_omx_video_get_format_from_omx (port_def.format.video.eColorFormat);
+  if (format == GST_VIDEO_FORMAT_UNKNOWN) {
+    GST_ERROR_OBJECT (self, "Unsupported preview color format: %d",
+        port_def.format.video.eColorFormat);
+    return FALSE;
+  }
+
+  event = gst_pad_get_sticky_event (self->preview_pad,
+      GST_EVENT_STREAM_START, 0);
+  if (event) {
+    gst_event_unref (event);
   } else {
-    /* We will release all frames with invalid timestamp because we don't even
-     * know if they will be output some day. */
-    for (l = frames; l; l = l->next) {
-      GstVideoCodecFrame *tmp = l->data;
+    gchar *stream_id = gst_pad_create_stream_id (self->preview_pad,
+        GST_ELEMENT_CAST (self), "preview");
 
-      if (!GST_CLOCK_TIME_IS_VALID (tmp->pts)) {
-        gst_video_decoder_release_frame (GST_VIDEO_DECODER (self), tmp);
-        GST_LOG_OBJECT (self,
-            "discarding frame %p (#%d) with invalid PTS:%" GST_TIME_FORMAT
-            " DTS:%" GST_TIME_FORMAT, tmp, tmp->system_frame_number,
-            GST_TIME_ARGS (tmp->pts), GST_TIME_ARGS (tmp->dts));
-      } else {
-        gst_video_codec_frame_unref (tmp);
-      }
+    gst_pad_push_event (self->preview_pad,
+        gst_event_new_stream_start (stream_id));
+    g_free (stream_id);
+  }
+
+  gst_video_info_init (&info);
+  gst_video_info_set_format (&info, format, port_def.format.video.nFrameWidth,
+      port_def.format.video.nFrameHeight);
+  /* The preview follows the decoded pictures, which may be dropped */
+  info.fps_n = 0;
+  info.fps_d = 1;
+
+  caps = gst_video_info_to_caps (&info);
+  GST_DEBUG_OBJECT (self, "Preview caps %" GST_PTR_FORMAT, caps);
+  ret = gst_pad_set_caps (self->preview_pad, caps);
+
+  self->preview_info = info;
+  if (ret && !gst_omx_video_dec_preview_set_layout (self, &self->preview_info,
+          &port_def))
+    ret = FALSE;
+
+  /* Pictures with the default layout need no meta */
+  self->preview_copy = FALSE;
+  if (ret && (memcmp (self->preview_info.stride, info.stride,
+              sizeof (info.stride)) != 0
+          || memcmp (self->preview_info.offset, info.offset,
+              sizeof (info.offset)) != 0)) {
+    query = gst_query_new_allocation (caps, FALSE);
+    if (!gst_pad_peer_query (self->preview_pad, query)
+        || !gst_query_find_allocation_meta (query, GST_VIDEO_META_API_TYPE,
+            NULL)) {
+      GST_DEBUG_OBJECT (self, "Copying preview pictures, downstream doesn't "
+          "support GstVideoMeta");
+      self->preview_copy = TRUE;
     }
+    gst_query_unref (query);
   }
+  gst_caps_unref (caps);
 
-  g_list_free (frames);
+  self->preview_renegotiate = FALSE;
+
+  return ret;
 }
 
+/* Copies a preview picture into a buffer with the default layout, for
+ * downstream without GstVideoMeta support. Takes ownership of @inbuf */
 static GstBuffer *
-copy_frame (const GstVideoInfo * info, GstBuffer * outbuf)
+gst_omx_video_dec_preview_copy (GstOMXVideoDec * self, GstBuffer * inbuf)
 {
-  GstVideoInfo out_info, tmp_info;
-  GstBuffer *tmpbuf;
-  GstVideoFrame out_frame, tmp_frame;
+  GstVideoFrame src, dest;
+  GstVideoInfo info;
+  GstBuffer *outbuf = NULL;
 
-  out_info = *info;
-  tmp_info = *info;
+  gst_video_info_init (&info);
+  gst_video_info_set_format (&info, GST_VIDEO_INFO_FORMAT (&self->preview_info),
+      GST_VIDEO_INFO_WIDTH (&self->preview_info),
+      GST_VIDEO_INFO_HEIGHT (&self->preview_info));
 
-  tmpbuf = gst_buffer_new_and_alloc (out_info.size);
+  if (!gst_video_frame_map (&src, &self->preview_info, inbuf, GST_MAP_READ)) {
+    GST_ERROR_OBJECT (self, "Failed to map the preview picture");
+    goto done;
+  }
 
-  gst_video_frame_map (&out_frame, &out_info, outbuf, GST_MAP_READ);
-  gst_video_frame_map (&tmp_frame, &tmp_info, tmpbuf, GST_MAP_WRITE);
-  gst_video_frame_copy (&tmp_frame, &out_frame);
-  gst_video_frame_unmap (&out_frame);
-  gst_video_frame_unmap (&tmp_frame);
+  outbuf = gst_buffer_new_allocate (NULL, info.size, NULL);
+  if (!gst_video_frame_map (&dest, &info, outbuf, GST_MAP_WRITE)) {
+    GST_ERROR_OBJECT (self, "Failed to map the preview copy");
+    gst_video_frame_unmap (&src);
+    gst_buffer_replace (&outbuf, NULL);
+    goto done;
+  }
 
-  gst_buffer_unref (outbuf);
+  gst_video_frame_copy (&dest, &src);
+  gst_video_frame_unmap (&dest);
+  gst_video_frame_unmap (&src);
+  gst_buffer_copy_into (outbuf, inbuf, GST_BUFFER_COPY_TIMESTAMPS, 0, -1);
 
-  return tmpbuf;
+done:
+  gst_buffer_unref (inbuf);
+
+  return outbuf;
+}
+
+static void
+gst_omx_video_dec_preview_loop (GstOMXVideoDec * self)
+{
+  GstOMXPort *port = self->preview_out_port;
+  GstOMXAcquireBufferReturn acq_return;
+  GstOMXBuffer *buf = NULL;
+  GstFlowReturn flow_ret;
+  GstBuffer *outbuf;
+  GstEvent *segment = NULL;
+  OMX_ERRORTYPE err;
+
+  acq_return = gst_omx_port_acquire_buffer (port, &buf);
+  if (acq_return == GST_OMX_ACQUIRE_BUFFER_ERROR) {
+    goto component_error;
+  } else if (acq_return == GST_OMX_ACQUIRE_BUFFER_FLUSHING) {
+    goto flushing;
+  } else if (acq_return == GST_OMX_ACQUIRE_BUFFER_EOS) {
+    goto eos;
+  } else if (acq_return == GST_OMX_ACQUIRE_BUFFER_RECONFIGURE) {
+    GST_DEBUG_OBJECT (self, "Preview port settings have changed");
+
+    err = gst_omx_port_set_enabled (port, FALSE);
+    if (err != OMX_ErrorNone)
+      goto reconfigure_error;
+    err = gst_omx_port_wait_buffers_released (port, 5 * GST_SECOND);
+    if (err != OMX_ErrorNone)
+      goto reconfigure_error;
+    if (!gst_omx_video_dec_preview_wait_released (self)) {
+      err = OMX_ErrorTimeout;
+      goto reconfigure_error;
+    }
+    err = gst_omx_port_deallocate_buffers (port);
+    if (err != OMX_ErrorNone)
+      goto reconfigure_error;
+    err = gst_omx_port_wait_enabled (port, 1 * GST_SECOND);
+    if (err != OMX_ErrorNone)
+      goto reconfigure_error;
+    err = gst_omx_port_set_enabled (port, TRUE);
+    if (err != OMX_ErrorNone)
+      goto reconfigure_error;
+    err = gst_omx_port_allocate_buffers (port);
+    if (err != OMX_ErrorNone)
+      goto reconfigure_error;
+    err = gst_omx_port_wait_enabled (port, 5 * GST_SECOND);
+    if (err != OMX_ErrorNone)
+      goto reconfigure_error;
+    err = gst_omx_port_populate (port);
+    if (err != OMX_ErrorNone)
+      goto reconfigure_error;
+    err = gst_omx_port_mark_reconfigured (port);
+    if (err != OMX_ErrorNone)
+      goto reconfigure_error;
+
+    self->preview_renegotiate = TRUE;
+    return;
+  }
+
+  if (self->preview_renegotiate && !gst_omx_video_dec_preview_negotiate (self)) {
+    gst_omx_port_release_buffer (port, buf);
+    goto caps_failed;
+  }
+
+  GST_OBJECT_LOCK (self);
+  if (self->preview_need_segment) {
+    segment = gst_event_new_segment (&self->preview_segment);
+    self->preview_need_segment = FALSE;
+  }
+  GST_OBJECT_UNLOCK (self);
+  if (segment)
+    gst_pad_push_event (self->preview_pad, segment);
+
+  if (buf->omx_buf->nFilledLen == 0) {
+    gboolean is_eos = (buf->omx_buf->nFlags & OMX_BUFFERFLAG_EOS) != 0;
+
+    gst_omx_port_release_buffer (port, buf);
+    if (is_eos)
+      goto eos;
+    return;
+  }
+
+  g_mutex_lock (&self->preview_lock);
+  self->preview_outstanding++;
+  g_mutex_unlock (&self->preview_lock);
+  outbuf = gst_buffer_new_wrapped_full (0, buf->omx_buf->pBuffer,
+      buf->omx_buf->nAllocLen, buf->omx_buf->nOffset,
+      buf->omx_buf->nFilledLen, buf,
+      (GDestroyNotify) gst_omx_video_dec_preview_release);
+  GST_BUFFER_PTS (outbuf) =
+      gst_util_uint64_scale (buf->omx_buf->nTimeStamp, GST_SECOND,
+      OMX_TICKS_PER_SECOND);
+  if (self->preview_copy) {
+    outbuf = gst_omx_video_dec_preview_copy (self, outbuf);
+    if (!outbuf) {
+      flow_ret = GST_FLOW_ERROR;
+      goto done;
+    }
+  } else {
+    gst_buffer_add_video_meta_full (outbuf, GST_VIDEO_FRAME_FLAG_NONE,
+        GST_VIDEO_INFO_FORMAT (&self->preview_info),
+        GST_VIDEO_INFO_WIDTH (&self->preview_info),
+        GST_VIDEO_INFO_HEIGHT (&self->preview_info),
+        GST_VIDEO_INFO_N_PLANES (&self->preview_info),
+        self->preview_info.offset, self->preview_info.stride);
+  }
+
+  flow_ret = gst_pad_push (self->preview_pad, outbuf);
+  /* Nobody has to watch the preview */
+  if (flow_ret == GST_FLOW_NOT_LINKED)
+    flow_ret = GST_FLOW_OK;
+done:
+  if (flow_ret != GST_FLOW_OK) {
+    GST_DEBUG_OBJECT (self, "Preview stopped: %s", gst_flow_get_name (flow_ret));
+    if (flow_ret < GST_FLOW_EOS)
+      GST_ELEMENT_ERROR (self, STREAM, FAILED,
+          ("Internal data stream error."), ("preview stopped, reason %s",
+              gst_flow_get_name (flow_ret)));
+    gst_pad_pause_task (self->preview_pad);
+  }
+
+  return;
+
+component_error:
+  {
+    GST_ELEMENT_ERROR (self, LIBRARY, FAILED, (NULL),
+        ("OpenMAX preview component in error state %s (0x%08x)",
+            gst_omx_component_get_last_error_string (port->comp),
+            gst_omx_component_get_last_error (port->comp)));
+    gst_pad_push_event (self->preview_pad, gst_event_new_eos ());
+    gst_pad_pause_task (self->preview_pad);
+    return;
+  }
+
+flushing:
+  {
+    gboolean is_eos;
+
+    GST_OBJECT_LOCK (self);
+    is_eos = self->preview_eos;
+    self->preview_eos = FALSE;
+    GST_OBJECT_UNLOCK (self);
+
+    if (is_eos)
+      goto eos;
+
+    GST_DEBUG_OBJECT (self, "Preview flushing -- stopping task");
+    gst_pad_pause_task (self->preview_pad);
+    return;
+  }
+
+eos:
+  {
+    GST_DEBUG_OBJECT (self, "Preview EOS");
+    gst_pad_push_event (self->preview_pad, gst_event_new_eos ());
+    gst_pad_pause_task (self->preview_pad);
+    return;
+  }
+
+reconfigure_error:
+  {
+    GST_ELEMENT_ERROR (self, LIBRARY, SETTINGS, (NULL),
+        ("Unable to reconfigure preview port"));
+    gst_pad_push_event (self->preview_pad, gst_event_new_eos ());
+    gst_pad_pause_task (self->preview_pad);
+    return;
+  }
+
+caps_failed:
+  {
+    GST_ELEMENT_ERROR (self, LIBRARY, SETTINGS, (NULL),
+        ("Failed to set preview caps"));
+    gst_pad_push_event (self->preview_pad, gst_event_new_eos ());
+    gst_pad_pause_task (self->preview_pad);
+    return;
+  }
 }
 
 static void
@@ -1326,6 +3630,7 @@ gst_omx_video_dec_loop (GstOMXVideoDec * self)
   GstClockTimeDiff deadline;
   OMX_ERRORTYPE err;
   GstOMXVideoDecClass *klass = GST_OMX_VIDEO_DEC_GET_CLASS (self);
+  gboolean output = FALSE;
 
 #if defined (USE_OMX_TARGET_RPI) && defined (HAVE_GST_GL)
   port = self->eglimage ? self->egl_out_port : self->dec_out_port;
@@ -1342,16 +3647,44 @@ gst_omx_video_dec_loop (GstOMXVideoDec * self)
     goto eos;
   }
 
+  if (port == self->dec_out_port
+      && self->crop_cookie != port->crop_cookie) {
+    GST_DEBUG_OBJECT (self, "Output crop changed");
+    gst_omx_video_dec_update_crop (self);
+    /* Unless downstream crops with the crop meta the output size
+     * changes */
+    if (!self->out_port_pool || !self->crop_meta || self->force_copy)
+      self->crop_renegotiate = TRUE;
+  }
+
   if (!gst_pad_has_current_caps (GST_VIDEO_DECODER_SRC_PAD (self)) ||
-      acq_return == GST_OMX_ACQUIRE_BUFFER_RECONFIGURE) {
+      acq_return == GST_OMX_ACQUIRE_BUFFER_RECONFIGURE ||
+      self->crop_renegotiate) {
     GstVideoCodecState *state;
     OMX_PARAM_PORTDEFINITIONTYPE port_def;
     GstVideoFormat format;
+    gboolean resize_in_place = FALSE;
 
     GST_DEBUG_OBJECT (self, "Port settings have changed, updating caps");
 
-    /* Reallocate all buffers */
+    /* Frames of the old configuration go out first */
+    gst_omx_video_dec_output_queue_wait (self, 0);
+
+    /* Adaptive playback: the new frames still fit into the buffers
+     * allocated for the maximum resolution */
     if (acq_return == GST_OMX_ACQUIRE_BUFFER_RECONFIGURE
+        && gst_omx_video_dec_can_resize_in_place (self, port)) {
+      GST_DEBUG_OBJECT (self, "Resizing to %ux%u without reallocation",
+          (guint) port->port_def.format.video.nFrameWidth,
+          (guint) port->port_def.format.video.nFrameHeight);
+      err = gst_omx_port_mark_reconfigured (port);
+      if (err != OMX_ErrorNone)
+        goto reconfigure_error;
+      resize_in_place = TRUE;
+    }
+
+    /* Reallocate all buffers */
+    if (acq_return == GST_OMX_ACQUIRE_BUFFER_RECONFIGURE && !resize_in_place
         && gst_omx_port_is_enabled (port)) {
       err = gst_omx_port_set_enabled (port, FALSE);
       if (err != OMX_ErrorNone)
@@ -1370,9 +3703,17 @@ gst_omx_video_dec_loop (GstOMXVideoDec * self)
         goto reconfigure_error;
     }
 
-    if (acq_return == GST_OMX_ACQUIRE_BUFFER_RECONFIGURE) {
+    if (acq_return == GST_OMX_ACQUIRE_BUFFER_RECONFIGURE && !resize_in_place) {
 #ifdef USE_OMX_TARGET_RCAR
       gboolean was_enabled = TRUE;
+#endif
+
+      if (!gst_omx_port_is_enabled (port)) {
+        err = gst_omx_video_dec_use_min_output_buffers (self);
+        if (err != OMX_ErrorNone)
+          goto reconfigure_error;
+      }
+#ifdef USE_OMX_TARGET_RCAR
       if (!gst_omx_port_is_enabled (port)) {
         guint plane_size;
         gint page_size = getpagesize ();
@@ -1401,6 +3742,10 @@ gst_omx_video_dec_loop (GstOMXVideoDec * self)
               port->port_def.format.video.nSliceHeight);
         }
 
+        err = gst_omx_video_dec_reserve_max_resolution (self, port);
+        if (err != OMX_ErrorNone)
+          goto reconfigure_error;
+
         err = gst_omx_port_set_enabled (port, TRUE);
         if (err != OMX_ErrorNone)
           goto reconfigure_error;
@@ -1408,7 +3753,7 @@ gst_omx_video_dec_loop (GstOMXVideoDec * self)
       }
 
       /* Re-allocate output buffer */
-      err = gst_omx_port_allocate_buffers (port);
+      err = gst_omx_video_dec_allocate_output_port_buffers (self, port);
       if (err != OMX_ErrorNone)
         goto reconfigure_error;
 
@@ -1462,6 +3807,7 @@ gst_omx_video_dec_loop (GstOMXVideoDec * self)
             goto reconfigure_error;
           } else {
             GST_OMX_BUFFER_POOL (self->out_port_pool)->allocating = FALSE;
+            gst_omx_dmabuf_cache_trim (self->dmabuf_cache);
           }
         }
       } else if (self->no_copy == FALSE) {
@@ -1483,8 +3829,8 @@ gst_omx_video_dec_loop (GstOMXVideoDec * self)
           OMX_VIDEO_CodingUnused);
 
       format =
-          gst_omx_video_get_format_from_omx (port_def.format.
-          video.eColorFormat);
+          gst_omx_video_dec_get_format (self,
+          port_def.format.video.eColorFormat);
 
       if (format == GST_VIDEO_FORMAT_UNKNOWN) {
         GST_ERROR_OBJECT (self, "Unsupported color format: %d",
@@ -1502,9 +3848,9 @@ gst_omx_video_dec_loop (GstOMXVideoDec * self)
           (guint) port_def.format.video.nFrameWidth,
           (guint) port_def.format.video.nFrameHeight);
 
-      state = gst_video_decoder_set_output_state (GST_VIDEO_DECODER (self),
-          format, port_def.format.video.nFrameWidth,
-          port_def.format.video.nFrameHeight, self->input_state);
+      state = gst_omx_video_dec_set_output_state (self, format,
+          port_def.format.video.nFrameWidth,
+          port_def.format.video.nFrameHeight);
 
       /* Update the cached data of output port definition after it changes
        * This change reflects the change by negotiating caps with
@@ -1541,6 +3887,10 @@ gst_omx_video_dec_loop (GstOMXVideoDec * self)
   GST_DEBUG_OBJECT (self, "Size of output port buffer: 0x%08x",
       buf->omx_buf->nAllocLen);
 
+  /* Wait for room in the output queue */
+  if (self->output_queue_size > 0)
+    gst_omx_video_dec_output_queue_wait (self, self->output_queue_size - 1);
+
   /* This prevents a deadlock between the srcpad stream
    * lock and the videocodec stream lock, if ::reset()
    * is called at the wrong time
@@ -1555,8 +3905,12 @@ gst_omx_video_dec_loop (GstOMXVideoDec * self)
       (guint) buf->omx_buf->nFlags, (guint64) buf->omx_buf->nTimeStamp);
 
   GST_VIDEO_DECODER_STREAM_LOCK (self);
+  /* The frames are gone once handle_frame() gets the stream lock */
+  gst_omx_video_dec_in_flight_signal (self);
   frame = gst_omx_video_find_nearest_frame (buf,
-      gst_video_decoder_get_frames (GST_VIDEO_DECODER (self)));
+      gst_omx_video_dec_get_pending_frames (self));
+  if (frame)
+    gst_omx_video_dec_calibrate_latency (self, frame);
 
   /* So we have a timestamped OMX buffer and get, or not, corresponding frame.
    * Assuming decoder output frames in display order, frames preceding this
@@ -1564,19 +3918,33 @@ gst_omx_video_dec_loop (GstOMXVideoDec * self)
    * stream, corrupted input data...
    * In any cases, not likely to be seen again. so drop it before they pile up
    * and use all the memory. */
-  if (self->no_reorder == FALSE)
+  if (gst_omx_video_dec_component_reorders (self))
     /* Only clean older frames in reorder mode. Do not clean in
-     * no_reorder mode, as in that mode the output frames are not in
-     * display order */
+     * no_reorder or low_latency mode, as in that mode the output frames
+     * are not in display order */
     gst_omx_video_dec_clean_older_frames (self, buf,
-        gst_video_decoder_get_frames (GST_VIDEO_DECODER (self)));
+        gst_omx_video_dec_get_pending_frames (self));
 
-  if (frame
+  if (frame && !GST_VIDEO_CODEC_FRAME_IS_SYNC_POINT (frame)
+      && gst_omx_video_dec_is_key_unit_trickmode (self)) {
+    /* Only keyframes are shown in key-unit trick mode */
+    GST_LOG_OBJECT (self, "Not outputting delta frame in trick mode");
+    gst_video_decoder_release_frame (GST_VIDEO_DECODER (self), frame);
+    frame = NULL;
+  } else if (frame && GST_VIDEO_CODEC_FRAME_IS_DECODE_ONLY (frame)) {
+    /* The component ignored OMX_BUFFERFLAG_DECODEONLY and produced a
+     * picture anyway. Give the buffer back without copying it out */
+    flow_ret = gst_omx_video_dec_drop_decode_only_frame (self, frame);
+    frame = NULL;
+  } else if (frame
       && (deadline = gst_video_decoder_get_max_decode_time
           (GST_VIDEO_DECODER (self), frame)) < 0) {
     GST_WARNING_OBJECT (self,
         "Frame is too late, dropping (deadline %" GST_TIME_FORMAT ")",
         GST_TIME_ARGS (-deadline));
+    GST_OBJECT_LOCK (self);
+    self->qos_dropped++;
+    GST_OBJECT_UNLOCK (self);
     flow_ret = gst_video_decoder_drop_frame (GST_VIDEO_DECODER (self), frame);
     frame = NULL;
   } else if (!frame && (buf->omx_buf->nFilledLen > 0 || buf->eglimage)) {
@@ -1589,7 +3957,7 @@ gst_omx_video_dec_loop (GstOMXVideoDec * self)
 
     GST_ERROR_OBJECT (self, "No corresponding frame found");
 
-    if (self->out_port_pool) {
+    if (self->out_port_pool && !self->force_copy) {
       gint i, n;
       GstBufferPoolAcquireParams params = { 0, };
 
@@ -1615,11 +3983,11 @@ gst_omx_video_dec_loop (GstOMXVideoDec * self)
         outbuf =
             copy_frame (&GST_OMX_BUFFER_POOL (self->out_port_pool)->video_info,
             outbuf);
+      gst_omx_video_dec_set_crop_meta (self, outbuf);
 
       buf = NULL;
     } else {
-      outbuf =
-          gst_video_decoder_allocate_output_buffer (GST_VIDEO_DECODER (self));
+      outbuf = gst_omx_video_dec_allocate_copy_buffer (self);
       if (!gst_omx_video_dec_fill_buffer (self, buf, outbuf)) {
         gst_buffer_unref (outbuf);
         gst_omx_port_release_buffer (port, buf);
@@ -1628,8 +3996,9 @@ gst_omx_video_dec_loop (GstOMXVideoDec * self)
     }
 
     flow_ret = gst_pad_push (GST_VIDEO_DECODER_SRC_PAD (self), outbuf);
+    output = TRUE;
   } else if (buf->omx_buf->nFilledLen > 0 || buf->eglimage) {
-    if (self->out_port_pool) {
+    if (self->out_port_pool && !self->force_copy) {
       gint i, n;
       GstBuffer *outbuf;
       GstBufferPoolAcquireParams params = { 0, };
@@ -1659,17 +4028,25 @@ gst_omx_video_dec_loop (GstOMXVideoDec * self)
         outbuf =
             copy_frame (&GST_OMX_BUFFER_POOL (self->out_port_pool)->video_info,
             outbuf);
+      gst_omx_video_dec_set_crop_meta (self, outbuf);
 
       frame->output_buffer = outbuf;
 
-      flow_ret =
-          gst_video_decoder_finish_frame (GST_VIDEO_DECODER (self), frame);
+      flow_ret = gst_omx_video_dec_output_frame (self, frame);
       frame = NULL;
       buf = NULL;
+      output = TRUE;
     } else {
-      if ((flow_ret =
-              gst_video_decoder_allocate_output_frame (GST_VIDEO_DECODER
-                  (self), frame)) == GST_FLOW_OK) {
+      /* Cropped copy of an output port buffer */
+      if (self->out_port_pool) {
+        frame->output_buffer = gst_omx_video_dec_allocate_copy_buffer (self);
+        flow_ret = GST_FLOW_OK;
+      } else
+        flow_ret =
+            gst_video_decoder_allocate_output_frame (GST_VIDEO_DECODER (self),
+            frame);
+
+      if (flow_ret == GST_FLOW_OK) {
         /* FIXME: This currently happens because of a race condition too.
          * We first need to reconfigure the output port and then the input
          * port if both need reconfiguration.
@@ -1682,9 +4059,9 @@ gst_omx_video_dec_loop (GstOMXVideoDec * self)
           gst_omx_port_release_buffer (port, buf);
           goto invalid_buffer;
         }
-        flow_ret =
-            gst_video_decoder_finish_frame (GST_VIDEO_DECODER (self), frame);
+        flow_ret = gst_omx_video_dec_output_frame (self, frame);
         frame = NULL;
+        output = TRUE;
       }
     }
   } else if (frame != NULL) {
@@ -1702,6 +4079,12 @@ gst_omx_video_dec_loop (GstOMXVideoDec * self)
       goto release_error;
   }
 
+  /* The thumbnail is out, don't wait for the component to signal EOS */
+  if (self->thumbnail && output && flow_ret == GST_FLOW_OK) {
+    GST_DEBUG_OBJECT (self, "Thumbnail decoded");
+    flow_ret = GST_FLOW_EOS;
+  }
+
   self->downstream_flow_ret = flow_ret;
 
   if (flow_ret != GST_FLOW_OK)
@@ -1713,6 +4096,20 @@ gst_omx_video_dec_loop (GstOMXVideoDec * self)
 
 component_error:
   {
+    if (gst_omx_video_dec_schedule_recovery (self)) {
+      gst_pad_pause_task (GST_VIDEO_DECODER_SRC_PAD (self));
+      self->started = FALSE;
+
+      /* The EOS buffer of a drain won't come out anymore */
+      g_mutex_lock (&self->drain_lock);
+      if (self->draining) {
+        self->draining = FALSE;
+        g_cond_broadcast (&self->drain_cond);
+      }
+      g_mutex_unlock (&self->drain_lock);
+      return;
+    }
+
     GST_ELEMENT_ERROR (self, LIBRARY, FAILED, (NULL),
         ("OpenMAX component in error state %s (0x%08x)",
             gst_omx_component_get_last_error_string (self->dec),
@@ -1735,6 +4132,19 @@ flushing:
 
 eos:
   {
+    GstFlowReturn reorder_ret;
+
+    /* The queued frames and the ones held back for reordering go out
+     * first */
+    gst_omx_video_dec_output_queue_wait (self, 0);
+    GST_VIDEO_DECODER_STREAM_LOCK (self);
+    reorder_ret = gst_omx_video_dec_reorder_drain (self);
+    GST_VIDEO_DECODER_STREAM_UNLOCK (self);
+    g_mutex_lock (&self->output_lock);
+    if (reorder_ret == GST_FLOW_OK)
+      reorder_ret = self->output_flow_ret;
+    g_mutex_unlock (&self->output_lock);
+
     g_mutex_lock (&self->drain_lock);
     if (self->draining) {
       GstQuery *query = gst_query_new_drain ();
@@ -1756,6 +4166,8 @@ eos:
     g_mutex_unlock (&self->drain_lock);
 
     GST_VIDEO_DECODER_STREAM_LOCK (self);
+    if (reorder_ret != GST_FLOW_OK && reorder_ret != GST_FLOW_EOS)
+      flow_ret = reorder_ret;
     self->downstream_flow_ret = flow_ret;
 
     /* Here we fallback and pause the task for the EOS case */
@@ -1774,6 +4186,7 @@ flow_error:
 
       gst_pad_push_event (GST_VIDEO_DECODER_SRC_PAD (self),
           gst_event_new_eos ());
+      gst_omx_video_dec_preview_eos (self);
       gst_pad_pause_task (GST_VIDEO_DECODER_SRC_PAD (self));
       self->started = FALSE;
     } else if (flow_ret < GST_FLOW_EOS) {
@@ -1851,6 +4264,41 @@ gst_omx_video_dec_start (GstVideoDecoder * decoder)
   self->last_upstream_ts = 0;
   self->downstream_flow_ret = GST_FLOW_OK;
 
+  GST_OBJECT_LOCK (self);
+  self->qos_processed = 0;
+  self->qos_decode_only = 0;
+  self->qos_skipped = 0;
+  self->qos_dropped = 0;
+  GST_OBJECT_UNLOCK (self);
+
+  self->thumbnail_fed = FALSE;
+  self->stream_reorder_depth = -1;
+  self->low_latency_warned = FALSE;
+
+  self->measured_latency = 0;
+  self->latency_window_max = 0;
+  self->latency_window_frames = 0;
+  self->latency_min = GST_CLOCK_TIME_NONE;
+  self->latency_max = GST_CLOCK_TIME_NONE;
+
+  GST_OBJECT_LOCK (self);
+  self->in_flight_dropped = 0;
+  GST_OBJECT_UNLOCK (self);
+  g_atomic_int_set (&self->frames_in_flight, 0);
+  gst_omx_video_dec_in_flight_set_flushing (self, FALSE);
+
+  self->recoveries = 0;
+  g_atomic_int_set (&self->recover_pending, FALSE);
+
+  GST_OBJECT_LOCK (self);
+  self->drain_count = 0;
+  self->drain_time_last = 0;
+  self->drain_time_max = 0;
+  GST_OBJECT_UNLOCK (self);
+
+  gst_omx_video_dec_output_queue_start (self);
+  gst_omx_video_dec_input_queue_start (self);
+
   return TRUE;
 }
 
@@ -1871,7 +4319,13 @@ gst_omx_video_dec_stop (GstVideoDecoder * decoder)
   gst_omx_port_set_flushing (self->egl_out_port, 5 * GST_SECOND, TRUE);
 #endif
 
+  gst_omx_video_dec_in_flight_set_flushing (self, TRUE);
+  gst_omx_video_dec_input_queue_stop (self);
+  gst_omx_video_dec_output_queue_flush_start (self);
   gst_pad_stop_task (GST_VIDEO_DECODER_SRC_PAD (decoder));
+  gst_omx_video_dec_output_queue_stop (self);
+  gst_omx_video_dec_reorder_clear (self);
+  gst_omx_video_dec_preview_stop (self);
 
   if (gst_omx_component_get_state (self->dec, 0) > OMX_StateIdle)
     gst_omx_component_set_state (self->dec, OMX_StateIdle);
@@ -1892,6 +4346,8 @@ gst_omx_video_dec_stop (GstVideoDecoder * decoder)
 #if defined (USE_OMX_TARGET_RPI) && defined (HAVE_GST_GL)
   gst_omx_component_get_state (self->egl_render, 1 * GST_SECOND);
 #endif
+  if (self->preview_scaler)
+    gst_omx_component_get_state (self->preview_scaler, 1 * GST_SECOND);
 
   gst_buffer_replace (&self->codec_data, NULL);
 
@@ -1910,7 +4366,7 @@ gst_omx_video_dec_negotiate (GstOMXVideoDec * self)
   OMX_VIDEO_PARAM_PORTFORMATTYPE param;
   OMX_ERRORTYPE err;
   GstCaps *comp_supported_caps;
-  GList *negotiation_map = NULL, *l;
+  GList *negotiation_map = NULL, *detiled_map = NULL, *l;
   GstCaps *templ_caps, *intersection;
   GstVideoFormat format;
   GstStructure *s;
@@ -1928,7 +4384,24 @@ gst_omx_video_dec_negotiate (GstOMXVideoDec * self)
 
   negotiation_map =
       gst_omx_video_get_supported_colorformats (self->dec_out_port,
-      self->input_state);
+      self->input_state, GST_OMX_VIDEO_DEC_GET_CLASS (self)->cdata.
+      vendor_formats);
+
+  /* Tiled formats can also be output detiled, as a last resort */
+  for (l = negotiation_map; l; l = l->next) {
+    GstOMXVideoNegotiationMap *m = l->data;
+
+    if (gst_omx_video_convert_get_tiling (m->format) !=
+        GST_OMX_VIDEO_TILING_NONE) {
+      GstOMXVideoNegotiationMap *detiled =
+          g_slice_new (GstOMXVideoNegotiationMap);
+
+      detiled->format = GST_VIDEO_FORMAT_NV12;
+      detiled->type = m->type;
+      detiled_map = g_list_append (detiled_map, detiled);
+    }
+  }
+  negotiation_map = g_list_concat (negotiation_map, detiled_map);
 
   comp_supported_caps = gst_omx_video_get_caps_for_map (negotiation_map);
 
@@ -1965,36 +4438,144 @@ gst_omx_video_dec_negotiate (GstOMXVideoDec * self)
     return FALSE;
   }
 
-  GST_OMX_INIT_STRUCT (&param);
-  param.nPortIndex = self->dec_out_port->index;
+  GST_OMX_INIT_STRUCT (&param);
+  param.nPortIndex = self->dec_out_port->index;
+
+  for (l = negotiation_map; l; l = l->next) {
+    GstOMXVideoNegotiationMap *m = l->data;
+
+    if (m->format == format) {
+      param.eColorFormat = m->type;
+      break;
+    }
+  }
+
+  GST_DEBUG_OBJECT (self, "Negotiating color format %s (%d)", format_str,
+      param.eColorFormat);
+
+  /* We must find something here */
+  g_assert (l != NULL);
+  g_list_free_full (negotiation_map,
+      (GDestroyNotify) gst_omx_video_negotiation_map_free);
+
+  err =
+      gst_omx_component_set_parameter (self->dec,
+      OMX_IndexParamVideoPortFormat, &param);
+  if (err != OMX_ErrorNone) {
+    GST_ERROR_OBJECT (self, "Failed to set video port format: %s (0x%08x)",
+        gst_omx_error_to_string (err), err);
+  }
+
+  gst_caps_unref (intersection);
+  return (err == OMX_ErrorNone);
+}
+
+/* Bring the component back from Idle after stop() without reconfiguring
+ * it */
+static gboolean
+gst_omx_video_dec_resume (GstOMXVideoDec * self)
+{
+  GST_DEBUG_OBJECT (self, "Resuming component");
+
+  if (gst_omx_component_set_state (self->dec,
+          OMX_StateExecuting) != OMX_ErrorNone)
+    return FALSE;
+
+  if (gst_omx_component_get_state (self->dec,
+          GST_CLOCK_TIME_NONE) != OMX_StateExecuting)
+    return FALSE;
+
+  gst_omx_port_set_flushing (self->dec_in_port, 5 * GST_SECOND, FALSE);
+  gst_omx_port_set_flushing (self->dec_out_port, 5 * GST_SECOND, FALSE);
+
+  if (gst_omx_port_populate (self->dec_out_port) != OMX_ErrorNone)
+    return FALSE;
+
+  if (!gst_omx_video_dec_preview_activate (self))
+    return FALSE;
+
+  self->downstream_flow_ret = GST_FLOW_OK;
+
+  return TRUE;
+}
 
-  for (l = negotiation_map; l; l = l->next) {
-    GstOMXVideoNegotiationMap *m = l->data;
+/* The minimum latency is the time a frame spends in the component plus the
+ * frames the reorder stage holds back. The former is measured with
+ * latency-calibration, or else one frame for decoding plus the frames the
+ * component holds back. A frame may also wait behind all input port
+ * buffers, which gives the maximum latency */
+static void
+gst_omx_video_dec_update_latency (GstOMXVideoDec * self, GstVideoInfo * info)
+{
+  GstClockTime duration, min, max;
+  guint frames;
 
-    if (m->format == format) {
-      param.eColorFormat = m->type;
-      break;
-    }
+  if (info->fps_n > 0 && info->fps_d > 0)
+    duration = gst_util_uint64_scale (GST_SECOND, info->fps_d, info->fps_n);
+  else
+    duration = gst_util_uint64_scale (GST_SECOND, 1, DEFAULT_FRAME_PER_SECOND);
+
+  frames = gst_omx_video_dec_get_reorder_depth (self);
+  if (self->measured_latency > 0) {
+    min = self->measured_latency + frames * duration;
+  } else {
+    frames++;
+    if (gst_omx_video_dec_component_reorders (self)
+        && self->stream_reorder_depth > 0)
+      frames += self->stream_reorder_depth;
+    min = frames * duration;
   }
+  max = min + self->dec_in_port->port_def.nBufferCountActual * duration;
 
-  GST_DEBUG_OBJECT (self, "Negotiating color format %s (%d)", format_str,
-      param.eColorFormat);
+  if (min == self->latency_min && max == self->latency_max)
+    return;
+  self->latency_min = min;
+  self->latency_max = max;
 
-  /* We must find something here */
-  g_assert (l != NULL);
-  g_list_free_full (negotiation_map,
-      (GDestroyNotify) gst_omx_video_negotiation_map_free);
+  GST_DEBUG_OBJECT (self, "Reporting latency of %" GST_TIME_FORMAT " - %"
+      GST_TIME_FORMAT, GST_TIME_ARGS (min), GST_TIME_ARGS (max));
+  gst_video_decoder_set_latency (GST_VIDEO_DECODER (self), min, max);
+}
 
-  err =
-      gst_omx_component_set_parameter (self->dec,
-      OMX_IndexParamVideoPortFormat, &param);
-  if (err != OMX_ErrorNone) {
-    GST_ERROR_OBJECT (self, "Failed to set video port format: %s (0x%08x)",
-        gst_omx_error_to_string (err), err);
+/* Measures how long @frame stayed in the component. The highest residency
+ * of each window of frames becomes the latency, when it changed by more
+ * than a quarter frame. Called with the stream lock */
+static void
+gst_omx_video_dec_calibrate_latency (GstOMXVideoDec * self,
+    GstVideoCodecFrame * frame)
+{
+  guint32 fed = GPOINTER_TO_UINT (gst_video_codec_frame_get_user_data (frame));
+  GstClockTime residency, duration, diff;
+  GstVideoInfo *info;
+
+  if (!self->latency_calibration || fed == 0 || !self->input_state)
+    return;
+
+  /* The microseconds wrap around, their difference doesn't */
+  residency = (GstClockTime) ((guint32) g_get_monotonic_time () - fed) *
+      GST_USECOND;
+  self->latency_window_max = MAX (self->latency_window_max, residency);
+  if (++self->latency_window_frames < LATENCY_CALIBRATION_FRAMES)
+    return;
+
+  info = &self->input_state->info;
+  if (info->fps_n > 0 && info->fps_d > 0)
+    duration = gst_util_uint64_scale (GST_SECOND, info->fps_d, info->fps_n);
+  else
+    duration = gst_util_uint64_scale (GST_SECOND, 1, DEFAULT_FRAME_PER_SECOND);
+
+  diff = self->latency_window_max > self->measured_latency ?
+      self->latency_window_max - self->measured_latency :
+      self->measured_latency - self->latency_window_max;
+  if (diff > duration / 4) {
+    GST_DEBUG_OBJECT (self, "Measured component residency %" GST_TIME_FORMAT,
+        GST_TIME_ARGS (self->latency_window_max));
+    self->measured_latency = self->latency_window_max;
+    gst_omx_video_dec_update_latency (self, info);
   }
 
-  gst_caps_unref (intersection);
-  return (err == OMX_ErrorNone);
+  self->latency_window_max = 0;
+  self->latency_window_frames = 0;
 }
 
 static gboolean
@@ -2005,6 +4586,7 @@ gst_omx_video_dec_set_format (GstVideoDecoder * decoder,
   GstOMXVideoDecClass *klass;
   GstVideoInfo *info = &state->info;
   gboolean is_format_change = FALSE;
+  gboolean is_size_change = FALSE;
   gboolean needs_disable = FALSE;
   OMX_PARAM_PORTDEFINITIONTYPE port_def;
 
@@ -2018,8 +4600,8 @@ gst_omx_video_dec_set_format (GstVideoDecoder * decoder,
   /* Check if the caps change is a real format change or if only irrelevant
    * parts of the caps have changed or nothing at all.
    */
-  is_format_change |= port_def.format.video.nFrameWidth != info->width;
-  is_format_change |= port_def.format.video.nFrameHeight != info->height;
+  is_size_change |= port_def.format.video.nFrameWidth != info->width;
+  is_size_change |= port_def.format.video.nFrameHeight != info->height;
   is_format_change |= (port_def.format.video.xFramerate == 0
       && info->fps_n != 0)
       || (port_def.format.video.xFramerate !=
@@ -2032,6 +4614,33 @@ gst_omx_video_dec_set_format (GstVideoDecoder * decoder,
   needs_disable =
       gst_omx_component_get_state (self->dec,
       GST_CLOCK_TIME_NONE) != OMX_StateLoaded;
+
+  /* In adaptive mode a resolution change within the maximum size is picked
+   * up by the component from the bitstream, the output port settings
+   * change is then handled without reallocation by the loop */
+  if (needs_disable && is_size_change && !is_format_change
+      && gst_omx_video_dec_is_adaptive (self)
+      && info->width <= self->max_width && info->height <= self->max_height) {
+    GST_DEBUG_OBJECT (self, "Adaptive resolution change to %dx%d",
+        info->width, info->height);
+    /* Components that can't change the enabled port keep the old size,
+     * which is only informational for them */
+    port_def.format.video.nFrameWidth = info->width;
+    port_def.format.video.nFrameHeight = info->height;
+    if (gst_omx_port_update_port_definition (self->dec_in_port,
+            &port_def) != OMX_ErrorNone)
+      GST_DEBUG_OBJECT (self, "Component didn't take the new input size");
+    if (self->input_state)
+      gst_video_codec_state_unref (self->input_state);
+    self->input_state = gst_video_codec_state_ref (state);
+
+    /* Reused for a stream of another size, see below */
+    if (gst_omx_component_get_state (self->dec, 0) == OMX_StateIdle)
+      return gst_omx_video_dec_resume (self);
+
+    return TRUE;
+  }
+  is_format_change |= is_size_change;
   /* If the component is not in Loaded state and a real format change happens
    * we have to disable the port and re-allocate all buffers. If no real
    * format change happened we can just exit here.
@@ -2042,6 +4651,12 @@ gst_omx_video_dec_set_format (GstVideoDecoder * decoder,
     if (self->input_state)
       gst_video_codec_state_unref (self->input_state);
     self->input_state = gst_video_codec_state_ref (state);
+
+    /* Stopped and reused for another stream with the same format, keep
+     * the component and its buffers */
+    if (gst_omx_component_get_state (self->dec, 0) == OMX_StateIdle)
+      return gst_omx_video_dec_resume (self);
+
     return TRUE;
   }
 
@@ -2143,6 +4758,8 @@ gst_omx_video_dec_set_format (GstVideoDecoder * decoder,
     port_def.format.video.xFramerate = 0;
   else
     port_def.format.video.xFramerate = (info->fps_n << 16) / (info->fps_d);
+  if (self->low_latency || self->thumbnail)
+    port_def.nBufferCountActual = port_def.nBufferCountMin;
 
   GST_DEBUG_OBJECT (self, "Setting inport port definition");
 
@@ -2163,10 +4780,17 @@ gst_omx_video_dec_set_format (GstVideoDecoder * decoder,
     GST_OMX_INIT_STRUCT (&sReorder);
     sReorder.nPortIndex = self->dec_out_port->index;    /* default */
 
-    if (self->no_reorder != FALSE)
-      sReorder.bReorder = OMX_FALSE;
-    else
+    if (gst_omx_video_dec_component_reorders (self))
       sReorder.bReorder = OMX_TRUE;
+    else
+      sReorder.bReorder = OMX_FALSE;
+
+    if (self->low_latency && !gst_omx_video_dec_can_reorder (self)
+        && !self->low_latency_warned) {
+      GST_WARNING_OBJECT (self, "low-latency mode keeps the reorder delay "
+          "of the component, set reorder-depth to disable it");
+      self->low_latency_warned = TRUE;
+    }
 
     gst_omx_component_set_parameter (self->dec, OMXR_MC_IndexParamVideoReorder,
         &sReorder);
@@ -2194,8 +4818,16 @@ gst_omx_video_dec_set_format (GstVideoDecoder * decoder,
     GST_ERROR_OBJECT (self,
         "lossy-compress mode is invalid now due to MC does not support");
 
+  if (self->low_latency != FALSE && !self->low_latency_warned) {
+    GST_WARNING_OBJECT (self,
+        "low-latency mode can't disable the reorder delay of this component, "
+        "only the buffer counts are reduced");
+    self->low_latency_warned = TRUE;
+  }
 #endif
 
+  gst_omx_video_dec_update_latency (self, info);
+
   GST_DEBUG_OBJECT (self, "Updating outport port definition");
 #ifdef USE_OMX_TARGET_RCAR
   if (!needs_disable) {
@@ -2211,6 +4843,10 @@ gst_omx_video_dec_set_format (GstVideoDecoder * decoder,
   }
   /* To make source code flexible, accept getting port_def param again */
 #endif
+  if (!needs_disable || !gst_omx_port_is_enabled (self->dec_out_port)) {
+    if (gst_omx_video_dec_use_min_output_buffers (self) != OMX_ErrorNone)
+      return FALSE;
+  }
   if (gst_omx_port_update_port_definition (self->dec_out_port,
           NULL) != OMX_ErrorNone)
     return FALSE;
@@ -2229,7 +4865,8 @@ gst_omx_video_dec_set_format (GstVideoDecoder * decoder,
     if ((klass->cdata.hacks & GST_OMX_HACK_NO_DISABLE_OUTPORT)) {
       if (gst_omx_port_set_enabled (self->dec_out_port, TRUE) != OMX_ErrorNone)
         return FALSE;
-      if (gst_omx_port_allocate_buffers (self->dec_out_port) != OMX_ErrorNone)
+      if (gst_omx_video_dec_allocate_output_port_buffers (self,
+              self->dec_out_port) != OMX_ErrorNone)
         return FALSE;
 
       if (gst_omx_port_wait_enabled (self->dec_out_port,
@@ -2251,6 +4888,9 @@ gst_omx_video_dec_set_format (GstVideoDecoder * decoder,
     if (!gst_omx_video_dec_negotiate (self))
       GST_LOG_OBJECT (self, "Negotiation failed, will get output format later");
 
+    if (!gst_omx_video_dec_preview_configure (self))
+      return FALSE;
+
     if (!(klass->cdata.hacks & GST_OMX_HACK_NO_DISABLE_OUTPORT)) {
       /* Disable output port */
       if (gst_omx_port_set_enabled (self->dec_out_port, FALSE) != OMX_ErrorNone)
@@ -2275,7 +4915,8 @@ gst_omx_video_dec_set_format (GstVideoDecoder * decoder,
       /* Need to allocate buffers to reach Idle state */
       if (gst_omx_port_allocate_buffers (self->dec_in_port) != OMX_ErrorNone)
         return FALSE;
-      if (gst_omx_port_allocate_buffers (self->dec_out_port) != OMX_ErrorNone)
+      if (gst_omx_video_dec_allocate_output_port_buffers (self,
+              self->dec_out_port) != OMX_ErrorNone)
         return FALSE;
     }
 
@@ -2285,6 +4926,9 @@ gst_omx_video_dec_set_format (GstVideoDecoder * decoder,
           gst_omx_buffer_pool_new (GST_ELEMENT_CAST (self), self->dec,
           self->dec_out_port);
 
+    if (!gst_omx_video_dec_preview_allocate (self))
+      return FALSE;
+
     if (gst_omx_component_get_state (self->dec,
             GST_CLOCK_TIME_NONE) != OMX_StateIdle)
       return FALSE;
@@ -2310,6 +4954,9 @@ gst_omx_video_dec_set_format (GstVideoDecoder * decoder,
   if (gst_omx_port_populate (self->dec_out_port) != OMX_ErrorNone)
     return FALSE;
 
+  if (!needs_disable && !gst_omx_video_dec_preview_activate (self))
+    return FALSE;
+
   if (gst_omx_component_get_last_error (self->dec) != OMX_ErrorNone) {
     GST_ERROR_OBJECT (self, "Component in error state: %s (0x%08x)",
         gst_omx_component_get_last_error_string (self->dec),
@@ -2326,14 +4973,20 @@ gst_omx_video_dec_flush (GstVideoDecoder * decoder)
 {
   GstOMXVideoDec *self = GST_OMX_VIDEO_DEC (decoder);
   OMX_ERRORTYPE err = OMX_ErrorNone;
+  gboolean pause;
 
   GST_DEBUG_OBJECT (self, "Flushing decoder");
 
   if (gst_omx_component_get_state (self->dec, 0) == OMX_StateLoaded)
     return TRUE;
 
+  /* The flush command is valid in Executing too, but not every
+   * component handles it there */
+  pause = !(self->dec->hacks & GST_OMX_HACK_FLUSH_IN_EXECUTING);
+
   /* 0) Pause the components */
-  if (gst_omx_component_get_state (self->dec, 0) == OMX_StateExecuting) {
+  if (pause
+      && gst_omx_component_get_state (self->dec, 0) == OMX_StateExecuting) {
     gst_omx_component_set_state (self->dec, OMX_StatePause);
     gst_omx_component_get_state (self->dec, GST_CLOCK_TIME_NONE);
   }
@@ -2358,17 +5011,26 @@ gst_omx_video_dec_flush (GstVideoDecoder * decoder)
   }
 #endif
 
-  /* 2) Wait until the srcpad loop is stopped,
-   * unlock GST_VIDEO_DECODER_STREAM_LOCK to prevent deadlocks
-   * caused by using this lock from inside the loop function */
+  /* 2) Wait until the srcpad loop is parked, it stops on the flushing
+   * output port. The task is only paused so that its thread is kept
+   * for the next handle_frame(). Unlock GST_VIDEO_DECODER_STREAM_LOCK
+   * to prevent deadlocks caused by using this lock from inside the
+   * loop function */
+  gst_omx_video_dec_output_queue_flush_start (self);
   GST_VIDEO_DECODER_STREAM_UNLOCK (self);
-  gst_pad_stop_task (GST_VIDEO_DECODER_SRC_PAD (decoder));
-  GST_DEBUG_OBJECT (self, "Flushing -- task stopped");
+  gst_omx_video_dec_input_queue_flush_start (self);
+  gst_pad_pause_task (GST_VIDEO_DECODER_SRC_PAD (decoder));
+  GST_DEBUG_OBJECT (self, "Flushing -- task paused");
   GST_VIDEO_DECODER_STREAM_LOCK (self);
+  gst_omx_video_dec_input_queue_flush_stop (self);
+  gst_omx_video_dec_output_queue_flush_stop (self);
+  gst_omx_video_dec_reorder_clear (self);
 
   /* 3) Resume components */
-  gst_omx_component_set_state (self->dec, OMX_StateExecuting);
-  gst_omx_component_get_state (self->dec, GST_CLOCK_TIME_NONE);
+  if (pause) {
+    gst_omx_component_set_state (self->dec, OMX_StateExecuting);
+    gst_omx_component_get_state (self->dec, GST_CLOCK_TIME_NONE);
+  }
 #if defined (USE_OMX_TARGET_RPI) && defined (HAVE_GST_GL)
   if (self->eglimage) {
     gst_omx_component_set_state (self->egl_render, OMX_StateExecuting);
@@ -2402,31 +5064,100 @@ gst_omx_video_dec_flush (GstVideoDecoder * decoder)
   self->last_upstream_ts = 0;
   self->downstream_flow_ret = GST_FLOW_OK;
   self->started = FALSE;
+  self->thumbnail_fed = FALSE;
   GST_DEBUG_OBJECT (self, "Flush finished");
 
   return TRUE;
 }
 
+/* Replaces the failed component by a new one configured for the current
+ * input state. The frames passed to the failed component are lost, the
+ * caller drops the input until the next keyframe.
+ *
+ * Called with the stream lock from handle_frame() for @frame, or from
+ * drain() with no frame */
+static gboolean
+gst_omx_video_dec_recover (GstOMXVideoDec * self, GstVideoCodecFrame * frame)
+{
+  GstVideoDecoder *decoder = GST_VIDEO_DECODER (self);
+  OMX_ERRORTYPE last_error = gst_omx_component_get_last_error (self->dec);
+  gint64 start = g_get_monotonic_time ();
+  GstVideoCodecState *state;
+  GList *frames, *l;
+  gboolean ret;
+
+  g_atomic_int_set (&self->recover_pending, FALSE);
+
+  if (!self->input_state)
+    return FALSE;
+  state = gst_video_codec_state_ref (self->input_state);
+  self->recoveries++;
+
+  GST_VIDEO_DECODER_STREAM_UNLOCK (self);
+  gst_omx_video_dec_stop (decoder);
+  gst_omx_video_dec_free_components (self);
+  GST_VIDEO_DECODER_STREAM_LOCK (self);
+
+  frames = gst_omx_video_dec_get_pending_frames (self);
+  for (l = frames; l; l = l->next) {
+    if (l->data == frame)
+      gst_video_codec_frame_unref (frame);
+    else
+      gst_video_decoder_release_frame (decoder, l->data);
+  }
+  g_list_free (frames);
+
+  gst_omx_video_dec_output_queue_start (self);
+  gst_omx_video_dec_input_queue_start (self);
+  gst_omx_video_dec_in_flight_set_flushing (self, FALSE);
+
+  ret = gst_omx_video_dec_open (decoder)
+      && gst_omx_video_dec_set_format (decoder, state);
+  gst_video_codec_state_unref (state);
+
+  if (!ret) {
+    GST_ERROR_OBJECT (self, "Failed to recreate the component");
+    return FALSE;
+  }
+
+  GST_INFO_OBJECT (self, "Recovered from %s (0x%08x) in %" G_GINT64_FORMAT
+      " us", gst_omx_error_to_string (last_error), last_error,
+      g_get_monotonic_time () - start);
+  gst_element_post_message (GST_ELEMENT_CAST (self),
+      gst_message_new_element (GST_OBJECT_CAST (self),
+          gst_structure_new ("GstOMXRecovery",
+              "error", G_TYPE_STRING, gst_omx_error_to_string (last_error),
+              "recoveries", G_TYPE_UINT, self->recoveries,
+              "recovery-time", G_TYPE_UINT64,
+              (guint64) (g_get_monotonic_time () - start) * GST_USECOND,
+              NULL)));
+
+  return TRUE;
+}
+
 static GstFlowReturn
 gst_omx_video_dec_handle_frame (GstVideoDecoder * decoder,
     GstVideoCodecFrame * frame)
 {
-  GstOMXAcquireBufferReturn acq_ret = GST_OMX_ACQUIRE_BUFFER_ERROR;
   GstOMXVideoDec *self;
   GstOMXVideoDecClass *klass;
-  GstOMXPort *port;
-  GstOMXBuffer *buf;
-  GstBuffer *codec_data = NULL;
-  guint offset = 0, size;
-  GstClockTime timestamp, duration;
-  OMX_ERRORTYPE err;
+  GstClockTimeDiff deadline;
 
   self = GST_OMX_VIDEO_DEC (decoder);
   klass = GST_OMX_VIDEO_DEC_GET_CLASS (self);
 
   GST_DEBUG_OBJECT (self, "Handling frame");
 
-  if (!self->started) {
+  if (g_atomic_int_get (&self->recover_pending)
+      && !gst_omx_video_dec_recover (self, frame)) {
+    GST_ELEMENT_ERROR (self, LIBRARY, FAILED, (NULL),
+        ("Failed to recover from OpenMAX component error"));
+    gst_video_decoder_drop_frame (decoder, frame);
+    return GST_FLOW_ERROR;
+  }
+
+  /* A keyframe waiting in the input queue counts as started */
+  if (!self->started && !gst_omx_video_dec_input_queue_is_pending (self)) {
     if (!GST_VIDEO_CODEC_FRAME_IS_SYNC_POINT (frame)) {
       gst_video_decoder_drop_frame (GST_VIDEO_DECODER (self), frame);
       return GST_FLOW_OK;
@@ -2441,15 +5172,35 @@ gst_omx_video_dec_handle_frame (GstVideoDecoder * decoder,
       GST_CLOCK_TIME_IS_VALID (frame->dts))
     frame->pts = frame->dts;
 
-  timestamp = frame->pts;
-  duration = frame->duration;
-
   if (self->downstream_flow_ret != GST_FLOW_OK) {
     gst_video_codec_frame_unref (frame);
     return self->downstream_flow_ret;
   }
 
+  if (self->thumbnail) {
+    /* Everything after the thumbnail keyframe is not needed */
+    if (self->thumbnail_fed) {
+      gst_video_decoder_release_frame (decoder, frame);
+      return GST_FLOW_EOS;
+    }
+
+    if (!GST_VIDEO_CODEC_FRAME_IS_SYNC_POINT (frame)) {
+      GST_LOG_OBJECT (self, "Skipping delta frame in thumbnail mode");
+      gst_video_decoder_release_frame (decoder, frame);
+      return GST_FLOW_OK;
+    }
+  }
+
+  /* In key-unit trick mode delta frames never reach the component */
+  if (!GST_VIDEO_CODEC_FRAME_IS_SYNC_POINT (frame)
+      && gst_omx_video_dec_is_key_unit_trickmode (self)) {
+    GST_LOG_OBJECT (self, "Skipping delta frame in trick mode");
+    gst_video_decoder_release_frame (decoder, frame);
+    return GST_FLOW_OK;
+  }
+
   if (klass->prepare_frame) {
+    gint reorder_depth = self->stream_reorder_depth;
     GstFlowReturn ret;
 
     ret = klass->prepare_frame (self, frame);
@@ -2459,8 +5210,94 @@ gst_omx_video_dec_handle_frame (GstVideoDecoder * decoder,
       gst_video_codec_frame_unref (frame);
       return ret;
     }
+
+    if (self->stream_reorder_depth != reorder_depth && self->input_state)
+      gst_omx_video_dec_update_latency (self, &self->input_state->info);
+  }
+
+  /* Frames before the segment start are only needed as references for the
+   * following ones, don't let the component output them */
+  if (gst_omx_video_dec_frame_is_before_segment (self, frame)) {
+    GST_LOG_OBJECT (self, "Decoding frame before segment start");
+    GST_VIDEO_CODEC_FRAME_SET_DECODE_ONLY (frame);
+  }
+
+  /* QoS: if the frame will be late anyway, skip it completely when nothing
+   * references it, otherwise only decode it and drop the picture */
+  if (self->started && !GST_VIDEO_CODEC_FRAME_IS_DECODE_ONLY (frame)) {
+    GST_OBJECT_LOCK (self);
+    self->qos_processed++;
+    GST_OBJECT_UNLOCK (self);
+
+    deadline = gst_video_decoder_get_max_decode_time (decoder, frame);
+    if (deadline < 0 && GST_OMX_VIDEO_DEC_FRAME_IS_DISPOSABLE (frame)
+        && !GST_VIDEO_CODEC_FRAME_IS_SYNC_POINT (frame)) {
+      GST_LOG_OBJECT (self, "Skipping late non-reference frame (deadline %"
+          GST_TIME_FORMAT ")", GST_TIME_ARGS (-deadline));
+      GST_OBJECT_LOCK (self);
+      self->qos_skipped++;
+      GST_OBJECT_UNLOCK (self);
+      gst_omx_video_dec_post_qos (self, frame, deadline);
+      gst_video_decoder_release_frame (decoder, frame);
+      return self->downstream_flow_ret;
+    } else if (deadline < 0) {
+      GST_LOG_OBJECT (self, "Decoding late frame without output (deadline %"
+          GST_TIME_FORMAT ")", GST_TIME_ARGS (-deadline));
+      GST_VIDEO_CODEC_FRAME_SET_DECODE_ONLY (frame);
+      GST_OBJECT_LOCK (self);
+      self->qos_decode_only++;
+      GST_OBJECT_UNLOCK (self);
+      gst_omx_video_dec_post_qos (self, frame, deadline);
+    }
+  }
+
+  if (self->max_frames_in_flight > 0 || self->max_latency > 0) {
+    GstFlowReturn ret;
+
+    if (!gst_omx_video_dec_limit_in_flight (self, frame, &ret))
+      return ret;
+  }
+
+  if (self->input_thread) {
+    GstFlowReturn ret;
+
+    /* Only wait for room in the queue, the feeder waits for the
+     * component */
+    GST_VIDEO_DECODER_STREAM_UNLOCK (self);
+    ret = gst_omx_video_dec_input_queue_push (self, frame);
+    GST_VIDEO_DECODER_STREAM_LOCK (self);
+
+    if (ret != GST_FLOW_OK)
+      return ret;
+
+    return self->downstream_flow_ret;
   }
 
+  return gst_omx_video_dec_feed_frame (self, frame);
+}
+
+/* Passes @frame to the input port, called with the stream lock from
+ * handle_frame or the feeder thread */
+static GstFlowReturn
+gst_omx_video_dec_feed_frame (GstOMXVideoDec * self,
+    GstVideoCodecFrame * frame)
+{
+  GstOMXAcquireBufferReturn acq_ret = GST_OMX_ACQUIRE_BUFFER_ERROR;
+  GstOMXPort *port;
+  GstOMXBuffer *buf;
+  GstBuffer *codec_data = NULL;
+  guint offset = 0, size;
+  GstClockTime timestamp, duration;
+  OMX_ERRORTYPE err;
+
+  timestamp = frame->pts;
+  duration = frame->duration;
+
+  /* Never 0, which means no timestamp */
+  if (self->latency_calibration)
+    gst_video_codec_frame_set_user_data (frame,
+        GUINT_TO_POINTER ((guint32) g_get_monotonic_time () | 1), NULL);
+
   port = self->dec_in_port;
 
   size = gst_buffer_get_size (frame->input_buffer);
@@ -2587,40 +5424,9 @@ gst_omx_video_dec_handle_frame (GstVideoDecoder * decoder,
     buf->omx_buf->nFilledLen =
         MIN (size - offset, buf->omx_buf->nAllocLen - buf->omx_buf->nOffset);
 
-    if (GST_IS_OMX_WMV_DEC (self) && GST_OMX_WMV_DEC (self)->advanced_profile) {
-      guint8 *pd_sc;            //start code of picture data
-      GstMapInfo map;
-      gboolean right_struct = FALSE;
-      OMX_U32 omx_offset = buf->omx_buf->nOffset;
-
-      if (!gst_buffer_map (frame->input_buffer, &map, GST_MAP_READ)) {
-        GST_ERROR_OBJECT (self, "Failed to create a gstbuffer mapping");
-        return GST_FLOW_ERROR;
-      }
-      if (map.data[0] == 0x00 && map.data[1] == 0x00 && map.data[2] == 0x01
-          && (map.data[3] == 0x0d || map.data[3] == 0x0e))
-        right_struct = TRUE;
-      gst_buffer_unmap (frame->input_buffer, &map);
-
-      if (!right_struct) {
-        pd_sc = (guint8 *) g_malloc (4);
-        pd_sc[0] = 0x00;
-        pd_sc[1] = 0x00;
-        pd_sc[2] = 0x01;
-        pd_sc[3] = 0x0d;
-
-        memcpy (buf->omx_buf->pBuffer + buf->omx_buf->nOffset, pd_sc, 4);
-        omx_offset += 4;
-
-        g_free (pd_sc);
-      }
-      gst_buffer_extract (frame->input_buffer, offset,
-          buf->omx_buf->pBuffer + omx_offset, buf->omx_buf->nFilledLen);
-    } else {
-      gst_buffer_extract (frame->input_buffer, offset,
-          buf->omx_buf->pBuffer + buf->omx_buf->nOffset,
-          buf->omx_buf->nFilledLen);
-    }
+    gst_buffer_extract (frame->input_buffer, offset,
+        buf->omx_buf->pBuffer + buf->omx_buf->nOffset,
+        buf->omx_buf->nFilledLen);
 
     if (timestamp != GST_CLOCK_TIME_NONE) {
       self->last_upstream_ts = timestamp;
@@ -2650,22 +5456,27 @@ gst_omx_video_dec_handle_frame (GstVideoDecoder * decoder,
     if (offset == 0 && GST_VIDEO_CODEC_FRAME_IS_SYNC_POINT (frame))
       buf->omx_buf->nFlags |= OMX_BUFFERFLAG_SYNCFRAME;
 
-    /* TODO: Set flags
-     *   - OMX_BUFFERFLAG_DECODEONLY for buffers that are outside
-     *     the segment
-     */
+    if (GST_VIDEO_CODEC_FRAME_IS_DECODE_ONLY (frame))
+      buf->omx_buf->nFlags |= OMX_BUFFERFLAG_DECODEONLY;
 
     offset += buf->omx_buf->nFilledLen;
 
     if (offset == size)
       buf->omx_buf->nFlags |= OMX_BUFFERFLAG_ENDOFFRAME;
 
+    /* Makes the component output the picture right away */
+    if (offset == size && self->thumbnail)
+      buf->omx_buf->nFlags |= OMX_BUFFERFLAG_EOS;
+
     self->started = TRUE;
     err = gst_omx_port_release_buffer (port, buf);
     if (err != OMX_ErrorNone)
       goto release_error;
   }
 
+  if (self->thumbnail)
+    self->thumbnail_fed = TRUE;
+
   gst_video_codec_frame_unref (frame);
 
   GST_DEBUG_OBJECT (self, "Passed frame to component");
@@ -2701,6 +5512,11 @@ too_large_codec_data:
 component_error:
   {
     gst_video_codec_frame_unref (frame);
+    if (gst_omx_video_dec_schedule_recovery (self)) {
+      self->started = FALSE;
+      return GST_FLOW_OK;
+    }
+
     GST_ELEMENT_ERROR (self, LIBRARY, FAILED, (NULL),
         ("OpenMAX component in error state %s (0x%08x)",
             gst_omx_component_get_last_error_string (self->dec),
@@ -2741,6 +5557,25 @@ gst_omx_video_dec_finish (GstVideoDecoder * decoder)
   return gst_omx_video_dec_drain (self);
 }
 
+/* How long the output may stay quiet before a drain that may not return
+ * is considered done: a few times the measured component latency or the
+ * frame duration, whichever is longer */
+static gint64
+gst_omx_video_dec_drain_quiet_period (GstOMXVideoDec * self)
+{
+  GstClockTime interval = self->measured_latency;
+  GstVideoInfo *info = self->input_state ? &self->input_state->info : NULL;
+
+  if (info && info->fps_n > 0)
+    interval = MAX (interval, gst_util_uint64_scale (GST_SECOND, info->fps_d,
+            info->fps_n));
+  if (interval == 0)
+    return DRAIN_QUIET_MAX;
+
+  return CLAMP ((gint64) (DRAIN_QUIET_FRAMES * interval / GST_USECOND),
+      DRAIN_QUIET_MIN, DRAIN_QUIET_MAX);
+}
+
 static GstFlowReturn
 gst_omx_video_dec_drain (GstOMXVideoDec * self)
 {
@@ -2748,11 +5583,20 @@ gst_omx_video_dec_drain (GstOMXVideoDec * self)
   GstOMXBuffer *buf;
   GstOMXAcquireBufferReturn acq_ret;
   OMX_ERRORTYPE err;
+  GstClockTime drain_time;
+  gint64 start;
 
   GST_DEBUG_OBJECT (self, "Draining component");
 
   klass = GST_OMX_VIDEO_DEC_GET_CLASS (self);
 
+  /* The queued frames are passed to the component before the EOS buffer */
+  if (gst_omx_video_dec_input_queue_is_pending (self)) {
+    GST_VIDEO_DECODER_STREAM_UNLOCK (self);
+    gst_omx_video_dec_input_queue_wait (self);
+    GST_VIDEO_DECODER_STREAM_LOCK (self);
+  }
+
   if (!self->started) {
     GST_DEBUG_OBJECT (self, "Component not started yet");
     return GST_FLOW_OK;
@@ -2799,22 +5643,68 @@ gst_omx_video_dec_drain (GstOMXVideoDec * self)
 
   GST_DEBUG_OBJECT (self, "Waiting until component is drained");
 
+  start = g_get_monotonic_time ();
   if (G_UNLIKELY (self->dec->hacks & GST_OMX_HACK_DRAIN_MAY_NOT_RETURN)) {
-    gint64 wait_until = g_get_monotonic_time () + G_TIME_SPAN_SECOND / 2;
+#if defined (USE_OMX_TARGET_RPI) && defined (HAVE_GST_GL)
+    GstOMXPort *out_port =
+        self->eglimage ? self->egl_out_port : self->dec_out_port;
+#else
+    GstOMXPort *out_port = self->dec_out_port;
+#endif
+    gint64 quiet = gst_omx_video_dec_drain_quiet_period (self);
+    gint64 deadline = start + DRAIN_TIMEOUT;
 
-    if (!g_cond_wait_until (&self->drain_cond, &self->drain_lock, wait_until))
-      GST_WARNING_OBJECT (self, "Drain timed out");
-    else
-      GST_DEBUG_OBJECT (self, "Drained component");
+    /* Without EOS the drain is done once the component returned all input
+     * buffers and didn't output anything for the quiet period. A component
+     * that keeps the EOS buffer is given up on at the deadline */
+    while (self->draining) {
+      gint64 last_output;
 
+      if (g_cond_wait_until (&self->drain_cond, &self->drain_lock,
+              MIN (g_get_monotonic_time () + quiet, deadline)))
+        continue;
+
+      if (g_get_monotonic_time () >= deadline) {
+        GST_WARNING_OBJECT (self, "Drain timed out");
+        break;
+      }
+
+      if (gst_omx_port_get_used_buffers (self->dec_in_port, NULL) > 0)
+        continue;
+      gst_omx_port_get_used_buffers (out_port, &last_output);
+      if (g_get_monotonic_time () - last_output >= quiet) {
+        GST_WARNING_OBJECT (self, "Drain did not return, no output for %"
+            G_GINT64_FORMAT " us", quiet);
+        break;
+      }
+    }
   } else {
     g_cond_wait (&self->drain_cond, &self->drain_lock);
-    GST_DEBUG_OBJECT (self, "Drained component");
   }
+  drain_time = (g_get_monotonic_time () - start) * GST_USECOND;
+  GST_DEBUG_OBJECT (self, "Drained component in %" GST_TIME_FORMAT,
+      GST_TIME_ARGS (drain_time));
 
   g_mutex_unlock (&self->drain_lock);
   GST_VIDEO_DECODER_STREAM_LOCK (self);
 
+  /* The component failed before it returned the EOS buffer, the frames
+   * in it are lost */
+  if (g_atomic_int_get (&self->recover_pending)) {
+    GST_WARNING_OBJECT (self, "Component failed while draining");
+    if (!gst_omx_video_dec_recover (self, NULL)) {
+      GST_ELEMENT_ERROR (self, LIBRARY, FAILED, (NULL),
+          ("Failed to recover from OpenMAX component error"));
+      return GST_FLOW_ERROR;
+    }
+  }
+
+  GST_OBJECT_LOCK (self);
+  self->drain_count++;
+  self->drain_time_last = drain_time;
+  self->drain_time_max = MAX (self->drain_time_max, drain_time);
+  GST_OBJECT_UNLOCK (self);
+
   self->started = FALSE;
 
   return GST_FLOW_OK;
@@ -2826,6 +5716,7 @@ gst_omx_video_dec_decide_allocation (GstVideoDecoder * bdec, GstQuery * query)
   GstBufferPool *pool;
   GstStructure *config;
   GstOMXVideoDec *self;
+  gboolean crop_meta;
 
 #if defined (USE_OMX_TARGET_RPI) && defined (HAVE_GST_GL)
   {
@@ -2868,7 +5759,34 @@ gst_omx_video_dec_decide_allocation (GstVideoDecoder * bdec, GstQuery * query)
 #endif
   /* Set up buffer pool and notify it to parent class */
   self = GST_OMX_VIDEO_DEC (bdec);
-  if (self->out_port_pool) {
+
+  crop_meta =
+      gst_query_find_allocation_meta (query, GST_VIDEO_CROP_META_API_TYPE,
+      NULL);
+  if (crop_meta != self->crop_meta) {
+    GST_DEBUG_OBJECT (self, "Downstream %s crop meta",
+        crop_meta ? "supports" : "does not support");
+    self->crop_meta = crop_meta;
+    /* The output size depends on who crops the output port buffers */
+    if ((self->no_copy || self->use_dmabuf)
+        && gst_omx_video_dec_has_crop (self))
+      self->crop_renegotiate = TRUE;
+  }
+  if (self->out_port_pool
+      && gst_buffer_pool_is_active (self->out_port_pool)) {
+    /* Renegotiation after an adaptive resolution change, the pool keeps
+     * its buffers and only the size of the frames in them changed */
+    if (gst_query_get_n_allocation_pools (query) > 0)
+      gst_query_set_nth_allocation_pool (query, 0, self->out_port_pool,
+          self->dec_out_port->port_def.nBufferSize,
+          self->dec_out_port->port_def.nBufferCountActual,
+          self->dec_out_port->port_def.nBufferCountActual);
+    else
+      gst_query_add_allocation_pool (query, self->out_port_pool,
+          self->dec_out_port->port_def.nBufferSize,
+          self->dec_out_port->port_def.nBufferCountActual,
+          self->dec_out_port->port_def.nBufferCountActual);
+  } else if (self->out_port_pool) {
     GstCaps *caps;
     gboolean update_pool = FALSE;
     if (gst_query_get_n_allocation_pools (query) > 0) {
@@ -2897,6 +5815,7 @@ gst_omx_video_dec_decide_allocation (GstVideoDecoder * bdec, GstQuery * query)
       self->out_port_pool = NULL;
     } else {
       GST_OMX_BUFFER_POOL (self->out_port_pool)->allocating = FALSE;
+      gst_omx_dmabuf_cache_trim (self->dmabuf_cache);
     }
     if (update_pool)
       gst_query_set_nth_allocation_pool (query, 0, self->out_port_pool,
@@ -2955,12 +5874,97 @@ gst_omx_video_dec_set_property (GObject * object, guint prop_id,
     case PROP_LOSSY_COMPRESS:
       self->lossy_compress = g_value_get_boolean (value);
       break;
+    case PROP_LOW_LATENCY:
+      self->low_latency = g_value_get_boolean (value);
+      break;
+    case PROP_MAX_WIDTH:
+      self->max_width = g_value_get_uint (value);
+      break;
+    case PROP_MAX_HEIGHT:
+      self->max_height = g_value_get_uint (value);
+      break;
+    case PROP_THUMBNAIL:
+      self->thumbnail = g_value_get_boolean (value);
+      break;
+    case PROP_REORDER_DEPTH:
+      self->reorder_depth = g_value_get_int (value);
+      break;
+    case PROP_OUTPUT_QUEUE_SIZE:
+      self->output_queue_size = g_value_get_uint (value);
+      break;
+    case PROP_INPUT_QUEUE_SIZE:
+      self->input_queue_size = g_value_get_uint (value);
+      break;
+    case PROP_INPUT_QUEUE_BYTES:
+      self->input_queue_max_bytes = g_value_get_uint (value);
+      break;
+    case PROP_LATENCY_CALIBRATION:
+      self->latency_calibration = g_value_get_boolean (value);
+      break;
+    case PROP_PREVIEW_WIDTH:
+      self->preview_width = g_value_get_uint (value);
+      break;
+    case PROP_PREVIEW_HEIGHT:
+      self->preview_height = g_value_get_uint (value);
+      break;
+    case PROP_MAX_FRAMES_IN_FLIGHT:
+      self->max_frames_in_flight = g_value_get_uint (value);
+      break;
+    case PROP_MAX_LATENCY:
+      self->max_latency = g_value_get_uint64 (value);
+      break;
+    case PROP_IN_FLIGHT_POLICY:
+      self->in_flight_policy = g_value_get_enum (value);
+      break;
+    case PROP_RECOVER_ON_ERROR:
+      self->recover_on_error = g_value_get_boolean (value);
+      break;
+    case PROP_MAX_RECOVERIES:
+      self->max_recoveries = g_value_get_uint (value);
+      break;
+    case PROP_DMA_HEAP:
+      g_free (self->dma_heap);
+      self->dma_heap = g_value_dup_string (value);
+      break;
     default:
       G_OBJECT_WARN_INVALID_PROPERTY_ID (object, prop_id, pspec);
       break;
   }
 }
 
+static GstStructure *
+gst_omx_video_dec_create_stats (GstOMXVideoDec * self)
+{
+  GstStructure *s;
+
+  GST_OBJECT_LOCK (self);
+  s = gst_structure_new ("application/x-omx-video-dec-stats",
+      "qos-decode-only", G_TYPE_UINT64, self->qos_decode_only,
+      "qos-skipped", G_TYPE_UINT64, self->qos_skipped,
+      "qos-dropped", G_TYPE_UINT64, self->qos_dropped,
+      "dmabuf-exports", G_TYPE_UINT64, self->dmabuf_cache->n_exports,
+      "dmabuf-exports-reused", G_TYPE_UINT64, self->dmabuf_cache->n_reused,
+      "frames-in-flight", G_TYPE_UINT,
+      (guint) g_atomic_int_get (&self->frames_in_flight),
+      "in-flight-dropped", G_TYPE_UINT64, self->in_flight_dropped,
+      "recoveries", G_TYPE_UINT, self->recoveries,
+      "drains", G_TYPE_UINT64, self->drain_count,
+      "drain-time-last", G_TYPE_UINT64, self->drain_time_last,
+      "drain-time-max", G_TYPE_UINT64, self->drain_time_max, NULL);
+  g_mutex_lock (&self->output_lock);
+  gst_structure_set (s, "output-queue-level", G_TYPE_UINT,
+      self->output_queue.length, NULL);
+  g_mutex_unlock (&self->output_lock);
+  g_mutex_lock (&self->input_lock);
+  gst_structure_set (s, "input-queue-level", G_TYPE_UINT,
+      self->input_queue.length, "input-queue-level-bytes", G_TYPE_UINT64,
+      self->input_queue_bytes, NULL);
+  g_mutex_unlock (&self->input_lock);
+  GST_OBJECT_UNLOCK (self);
+
+  return s;
+}
+
 static void
 gst_omx_video_dec_get_property (GObject * object, guint prop_id,
     GValue * value, GParamSpec * pspec)
@@ -2980,6 +5984,60 @@ gst_omx_video_dec_get_property (GObject * object, guint prop_id,
     case PROP_LOSSY_COMPRESS:
       g_value_set_boolean (value, self->lossy_compress);
       break;
+    case PROP_LOW_LATENCY:
+      g_value_set_boolean (value, self->low_latency);
+      break;
+    case PROP_MAX_WIDTH:
+      g_value_set_uint (value, self->max_width);
+      break;
+    case PROP_MAX_HEIGHT:
+      g_value_set_uint (value, self->max_height);
+      break;
+    case PROP_THUMBNAIL:
+      g_value_set_boolean (value, self->thumbnail);
+      break;
+    case PROP_REORDER_DEPTH:
+      g_value_set_int (value, self->reorder_depth);
+      break;
+    case PROP_OUTPUT_QUEUE_SIZE:
+      g_value_set_uint (value, self->output_queue_size);
+      break;
+    case PROP_INPUT_QUEUE_SIZE:
+      g_value_set_uint (value, self->input_queue_size);
+      break;
+    case PROP_INPUT_QUEUE_BYTES:
+      g_value_set_uint (value, self->input_queue_max_bytes);
+      break;
+    case PROP_LATENCY_CALIBRATION:
+      g_value_set_boolean (value, self->latency_calibration);
+      break;
+    case PROP_PREVIEW_WIDTH:
+      g_value_set_uint (value, self->preview_width);
+      break;
+    case PROP_PREVIEW_HEIGHT:
+      g_value_set_uint (value, self->preview_height);
+      break;
+    case PROP_MAX_FRAMES_IN_FLIGHT:
+      g_value_set_uint (value, self->max_frames_in_flight);
+      break;
+    case PROP_MAX_LATENCY:
+      g_value_set_uint64 (value, self->max_latency);
+      break;
+    case PROP_IN_FLIGHT_POLICY:
+      g_value_set_enum (value, self->in_flight_policy);
+      break;
+    case PROP_RECOVER_ON_ERROR:
+      g_value_set_boolean (value, self->recover_on_error);
+      break;
+    case PROP_MAX_RECOVERIES:
+      g_value_set_uint (value, self->max_recoveries);
+      break;
+    case PROP_DMA_HEAP:
+      g_value_set_string (value, self->dma_heap);
+      break;
+    case PROP_STATS:
+      g_value_take_boxed (value, gst_omx_video_dec_create_stats (self));
+      break;
     default:
       G_OBJECT_WARN_INVALID_PROPERTY_ID (object, prop_id, pspec);
       break;
@@ -31,6 +31,8 @@
 #include <gst/video/gstvideodecoder.h>
 
 #include "gstomx.h"
+#include "gstomxbufferpool.h"
+#include "gstomxvideo.h"
 
 G_BEGIN_DECLS
 
@@ -50,6 +52,13 @@ G_BEGIN_DECLS
 typedef struct _GstOMXVideoDec GstOMXVideoDec;
 typedef struct _GstOMXVideoDecClass GstOMXVideoDecClass;
 
+typedef enum
+{
+  GST_OMX_VIDEO_DEC_IN_FLIGHT_WAIT,
+  GST_OMX_VIDEO_DEC_IN_FLIGHT_DROP_OLDEST,
+  GST_OMX_VIDEO_DEC_IN_FLIGHT_DROP_NEW
+} GstOMXVideoDecInFlightPolicy;
+
 struct _GstOMXVideoDec
 {
   GstVideoDecoder parent;
@@ -91,10 +100,158 @@ struct _GstOMXVideoDec
   gboolean no_reorder;
   /* Set TRUE to use lossy image compression  */
   gboolean lossy_compress;
+  gboolean low_latency;
+  /* TRUE once it was reported that low-latency can't take effect */
+  gboolean low_latency_warned;
+
+  /* Thumbnail mode: decode the first keyframe only */
+  gboolean thumbnail;
+  gboolean thumbnail_fed;
+
+  /* Adaptive playback, output buffers are allocated for this size */
+  guint max_width;
+  guint max_height;
+
+  /* dma-heap for use-dmabuf on targets without mmngr */
+  gchar *dma_heap;
+
+  /* mmngr dmabuf exports of the output buffers, reused by new pools */
+  GstOMXDmabufCache *dmabuf_cache;
+
+  /* Visible region of the decoded frames */
+  OMX_CONFIG_RECTTYPE crop;
+  gint crop_cookie;
+  /* TRUE if downstream supports GstVideoCropMeta */
+  gboolean crop_meta;
+  /* TRUE if the output port buffers are copied because downstream can't
+   * crop them or their layout is vendor specific */
+  gboolean force_copy;
+  /* Color format of the output port, resolved when negotiating */
+  GstOMXVideoVendorFormat out_format;
+  /* TRUE if the output caps have to be updated for a new crop */
+  gboolean crop_renegotiate;
   /* Set TRUE if set_property() runs */
   gboolean has_set_property;
+
+  /* Set by the prepare_frame() hook of a subclass from the stream headers:
+   * how many frames the output may have to be reordered by, -1 if unknown */
+  gint stream_reorder_depth;
+
+  /* Decoded frames held back to be output in presentation order, a min-heap
+   * on the PTS */
+  gint reorder_depth;
+  GPtrArray *reorder_queue;
+
+  /* Decoded frames handed from the output loop to the push thread, so that
+   * the output port buffers don't wait for downstream */
+  guint output_queue_size;
+  GThread *output_thread;
+  GMutex output_lock;
+  GCond output_cond;
+  GQueue output_queue;
+  /* TRUE while the push thread finishes a frame */
+  gboolean output_busy;
+  gboolean output_flushing;
+  gboolean output_stop;
+  /* Incremented on flush, frames popped before are dropped */
+  guint output_seqnum;
+  GstFlowReturn output_flow_ret;
+
+  /* Compressed frames handed from handle_frame to the feeder thread, so
+   * that upstream is not blocked waiting for input port buffers */
+  guint input_queue_size;
+  guint input_queue_max_bytes;
+  GThread *input_thread;
+  GMutex input_lock;
+  GCond input_cond;
+  GQueue input_queue;
+  guint64 input_queue_bytes;
+  /* TRUE while the feeder passes a frame to the component */
+  gboolean input_busy;
+  gboolean input_flushing;
+  gboolean input_stop;
+  /* Incremented on flush, frames popped before are dropped */
+  guint input_seqnum;
+  GstFlowReturn input_flow_ret;
+
+  /* Latency measured from the component residency of the frames, 0 until
+   * a window of frames was measured */
+  gboolean latency_calibration;
+  GstClockTime measured_latency;
+  GstClockTime latency_window_max;
+  guint latency_window_frames;
+  /* Last reported latency */
+  GstClockTime latency_min;
+  GstClockTime latency_max;
+
+  /* Downscaled preview from a second output port, optionally through a
+   * tunnelled scaler component. preview_out_port is the port the preview
+   * pictures are taken from */
+  guint preview_width, preview_height;
+  GstOMXPort *preview_port;
+  GstOMXComponent *preview_scaler;
+  GstOMXPort *scaler_in_port;
+  GstOMXPort *preview_out_port;
+  GstPad *preview_pad;
+  /* TRUE if the preview caps have to be set again */
+  gboolean preview_renegotiate;
+  /* Layout of the preview port buffers, copied out if downstream can't
+   * take a GstVideoMeta for it */
+  GstVideoInfo preview_info;
+  gboolean preview_copy;
+  /* Input segment, OBJECT_LOCK */
+  GstSegment preview_segment;
+  gboolean preview_need_segment;
+  /* TRUE if the preview task has to push EOS once flushing, OBJECT_LOCK */
+  gboolean preview_eos;
+  /* Preview pictures wrapping port buffers that downstream didn't release
+   * yet, the port buffers are only deallocated once they are back */
+  GMutex preview_lock;
+  GCond preview_cond;
+  guint preview_outstanding;
+
+  /* Bound on the frames passed on and not output yet */
+  guint max_frames_in_flight;
+  GstClockTime max_latency;
+  GstOMXVideoDecInFlightPolicy in_flight_policy;
+  GMutex in_flight_lock;
+  GCond in_flight_cond;
+  /* Bumped when the loop outputs, IN_FLIGHT_LOCK */
+  guint in_flight_cookie;
+  gboolean in_flight_flushing;
+  /* Frames in flight at the last input, atomic */
+  gint frames_in_flight;
+  guint64 in_flight_dropped;
+
+  /* Component recreation on errors */
+  gboolean recover_on_error;
+  guint max_recoveries;
+  guint recoveries;
+  /* Set by the threads seeing the error, handle_frame() recovers, atomic */
+  gint recover_pending;
+
+  /* Drain statistics */
+  guint64 drain_count;
+  GstClockTime drain_time_last;
+  GstClockTime drain_time_max;
+
+  /* QoS statistics */
+  guint64 qos_processed;
+  guint64 qos_decode_only;
+  guint64 qos_skipped;
+  guint64 qos_dropped;
 };
 
+/* Set by the prepare_frame() hook of a subclass on frames that no other
+ * frame references, which can be skipped under QoS */
+#define GST_OMX_VIDEO_DEC_FRAME_FLAG_DISPOSABLE (1 << 16)
+#define GST_OMX_VIDEO_DEC_FRAME_IS_DISPOSABLE(frame) \
+    GST_VIDEO_CODEC_FRAME_FLAG_IS_SET (frame, \
+        GST_OMX_VIDEO_DEC_FRAME_FLAG_DISPOSABLE)
+#define GST_OMX_VIDEO_DEC_FRAME_SET_DISPOSABLE(frame) \
+    GST_VIDEO_CODEC_FRAME_FLAG_SET (frame, \
+        GST_OMX_VIDEO_DEC_FRAME_FLAG_DISPOSABLE)
+
 struct _GstOMXVideoDecClass
 {
   GstVideoDecoderClass parent_class;
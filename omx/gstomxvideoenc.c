@@ -136,6 +136,9 @@ static GstCaps *gst_omx_video_enc_getcaps (GstVideoEncoder * encoder,
 
 static GstFlowReturn gst_omx_video_enc_drain (GstOMXVideoEnc * self,
     gboolean at_eos);
+static void gst_omx_video_enc_update_latency (GstOMXVideoEnc * self);
+static void gst_omx_video_enc_calibrate_latency (GstOMXVideoEnc * self,
+    GstVideoCodecFrame * frame);
 
 static GstFlowReturn gst_omx_video_enc_handle_output_frame (GstOMXVideoEnc *
     self, GstOMXPort * port, GstOMXBuffer * buf, GstVideoCodecFrame * frame);
@@ -150,9 +153,18 @@ enum
   PROP_QUANT_B_FRAMES,
   PROP_SCAN_TYPE,
   PROP_NO_COPY,
-  PROP_USE_DMABUF
+  PROP_USE_DMABUF,
+  PROP_LATENCY_CALIBRATION,
+  PROP_RECOVER_ON_ERROR,
+  PROP_MAX_RECOVERIES
 };
 
+#define DEFAULT_RECOVER_ON_ERROR FALSE
+#define DEFAULT_MAX_RECOVERIES 3
+
+/* Frames over which the highest component residency is measured */
+#define LATENCY_CALIBRATION_FRAMES 30
+
 /* FIXME: Better defaults */
 #define GST_OMX_VIDEO_ENC_CONTROL_RATE_DEFAULT (0xffffffff)
 #define GST_OMX_VIDEO_ENC_TARGET_BITRATE_DEFAULT (0xffffffff)
@@ -235,6 +247,24 @@ gst_omx_video_enc_class_init (GstOMXVideoEncClass * klass)
           "Whether or not to use dmabuf method",
           FALSE, G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS |
           GST_PARAM_MUTABLE_READY));
+  g_object_class_install_property (gobject_class, PROP_LATENCY_CALIBRATION,
+      g_param_spec_boolean ("latency-calibration", "Latency calibration",
+          "Report the measured time frames spend in the component as "
+          "latency instead of one frame duration",
+          FALSE, G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS |
+          GST_PARAM_MUTABLE_READY));
+  g_object_class_install_property (gobject_class, PROP_RECOVER_ON_ERROR,
+      g_param_spec_boolean ("recover-on-error", "Recover on error",
+          "Recreate the component when it fails instead of posting an error, "
+          "the frames in the component are lost",
+          DEFAULT_RECOVER_ON_ERROR,
+          G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS));
+  g_object_class_install_property (gobject_class, PROP_MAX_RECOVERIES,
+      g_param_spec_uint ("max-recoveries", "Max recoveries",
+          "Maximum number of component recoveries per stream before an "
+          "error is posted (0 = unlimited)",
+          0, G_MAXUINT, DEFAULT_MAX_RECOVERIES,
+          G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS));
 
   element_class->change_state =
       GST_DEBUG_FUNCPTR (gst_omx_video_enc_change_state);
@@ -273,6 +303,9 @@ gst_omx_video_enc_init (GstOMXVideoEnc * self)
   self->scan_type = GST_OMX_VIDEO_ENC_SCAN_TYPE_DEFAULT;
   self->no_copy = FALSE;
   self->use_dmabuf = FALSE;
+  self->latency_calibration = FALSE;
+  self->recover_on_error = DEFAULT_RECOVER_ON_ERROR;
+  self->max_recoveries = DEFAULT_MAX_RECOVERIES;
   self->priv =
       G_TYPE_INSTANCE_GET_PRIVATE (self, GST_TYPE_OMX_VIDEO_ENC,
       GstOMXVideoEncPrivate);
@@ -583,6 +616,15 @@ gst_omx_video_enc_set_property (GObject * object, guint prop_id,
     case PROP_USE_DMABUF:
       self->use_dmabuf = g_value_get_boolean (value);
       break;
+    case PROP_LATENCY_CALIBRATION:
+      self->latency_calibration = g_value_get_boolean (value);
+      break;
+    case PROP_RECOVER_ON_ERROR:
+      self->recover_on_error = g_value_get_boolean (value);
+      break;
+    case PROP_MAX_RECOVERIES:
+      self->max_recoveries = g_value_get_uint (value);
+      break;
     default:
       G_OBJECT_WARN_INVALID_PROPERTY_ID (object, prop_id, pspec);
       break;
@@ -620,6 +662,15 @@ gst_omx_video_enc_get_property (GObject * object, guint prop_id, GValue * value,
     case PROP_USE_DMABUF:
       g_value_set_boolean (value, self->use_dmabuf);
       break;
+    case PROP_LATENCY_CALIBRATION:
+      g_value_set_boolean (value, self->latency_calibration);
+      break;
+    case PROP_RECOVER_ON_ERROR:
+      g_value_set_boolean (value, self->recover_on_error);
+      break;
+    case PROP_MAX_RECOVERIES:
+      g_value_set_uint (value, self->max_recoveries);
+      break;
     default:
       G_OBJECT_WARN_INVALID_PROPERTY_ID (object, prop_id, pspec);
       break;
@@ -780,6 +831,34 @@ gst_omx_video_enc_handle_output_frame (GstOMXVideoEnc * self, GstOMXPort * port,
   return flow_ret;
 }
 
+/* Returns TRUE if the component error is left to handle_frame() to recover
+ * from, instead of being posted */
+static gboolean
+gst_omx_video_enc_schedule_recovery (GstOMXVideoEnc * self)
+{
+  if (!self->recover_on_error)
+    return FALSE;
+
+  /* Upstream holds buffers of the failed component */
+  if (self->in_port_pool) {
+    GST_ERROR_OBJECT (self, "Can't recover with buffers proposed upstream");
+    return FALSE;
+  }
+
+  if (self->max_recoveries > 0 && self->recoveries >= self->max_recoveries) {
+    GST_ERROR_OBJECT (self, "Recovered %u times already", self->recoveries);
+    return FALSE;
+  }
+
+  if (!g_atomic_int_get (&self->recover_pending))
+    GST_WARNING_OBJECT (self, "Component in error state %s (0x%08x), "
+        "recovering", gst_omx_component_get_last_error_string (self->enc),
+        gst_omx_component_get_last_error (self->enc));
+  g_atomic_int_set (&self->recover_pending, TRUE);
+
+  return TRUE;
+}
+
 static void
 gst_omx_video_enc_loop (GstOMXVideoEnc * self)
 {
@@ -902,6 +981,8 @@ gst_omx_video_enc_loop (GstOMXVideoEnc * self)
   if (buf->omx_buf->nFilledLen > 0) {
     frame = gst_omx_video_find_nearest_frame (buf,
         gst_video_encoder_get_frames (GST_VIDEO_ENCODER (self)));
+    if (frame)
+      gst_omx_video_enc_calibrate_latency (self, frame);
 
     g_assert (klass->handle_output_frame);
     flow_ret =
@@ -927,6 +1008,20 @@ gst_omx_video_enc_loop (GstOMXVideoEnc * self)
 
 component_error:
   {
+    if (gst_omx_video_enc_schedule_recovery (self)) {
+      gst_pad_pause_task (GST_VIDEO_ENCODER_SRC_PAD (self));
+      self->started = FALSE;
+
+      /* The EOS buffer of a drain won't come out anymore */
+      g_mutex_lock (&self->drain_lock);
+      if (self->draining) {
+        self->draining = FALSE;
+        g_cond_broadcast (&self->drain_cond);
+      }
+      g_mutex_unlock (&self->drain_lock);
+      return;
+    }
+
     GST_ELEMENT_ERROR (self, LIBRARY, FAILED, (NULL),
         ("OpenMAX component in error state %s (0x%08x)",
             gst_omx_component_get_last_error_string (self->enc),
@@ -1041,6 +1136,15 @@ gst_omx_video_enc_start (GstVideoEncoder * encoder)
   self->eos = FALSE;
   self->downstream_flow_ret = GST_FLOW_OK;
 
+  self->measured_latency = 0;
+  self->latency_window_max = 0;
+  self->latency_window_frames = 0;
+  self->latency_min = GST_CLOCK_TIME_NONE;
+  self->latency_max = GST_CLOCK_TIME_NONE;
+
+  self->recoveries = 0;
+  g_atomic_int_set (&self->recover_pending, FALSE);
+
   return TRUE;
 }
 
@@ -1079,6 +1183,70 @@ gst_omx_video_enc_stop (GstVideoEncoder * encoder)
   return TRUE;
 }
 
+/* The minimum latency is the time a frame spends in the component, measured
+ * with latency-calibration or else one frame. A frame may also wait behind
+ * all input port buffers, which gives the maximum latency */
+static void
+gst_omx_video_enc_update_latency (GstOMXVideoEnc * self)
+{
+  GstVideoInfo *info = &self->input_state->info;
+  GstClockTime duration, min, max;
+
+  /* Without a framerate only measured latency can be reported */
+  if (info->fps_n > 0 && info->fps_d > 0)
+    duration = gst_util_uint64_scale (GST_SECOND, info->fps_d, info->fps_n);
+  else if (self->measured_latency > 0)
+    duration = 0;
+  else
+    return;
+
+  min = self->measured_latency > 0 ? self->measured_latency : duration;
+  max = min + self->enc_in_port->port_def.nBufferCountActual * duration;
+
+  if (min == self->latency_min && max == self->latency_max)
+    return;
+  self->latency_min = min;
+  self->latency_max = max;
+
+  GST_DEBUG_OBJECT (self, "Reporting latency of %" GST_TIME_FORMAT " - %"
+      GST_TIME_FORMAT, GST_TIME_ARGS (min), GST_TIME_ARGS (max));
+  gst_video_encoder_set_latency (GST_VIDEO_ENCODER (self), min, max);
+}
+
+/* Measures how long @frame stayed in the component. The highest residency
+ * of each window of frames becomes the latency, when it changed by more
+ * than a quarter of the previous one. Called with the stream lock */
+static void
+gst_omx_video_enc_calibrate_latency (GstOMXVideoEnc * self,
+    GstVideoCodecFrame * frame)
+{
+  guint32 fed = GPOINTER_TO_UINT (gst_video_codec_frame_get_user_data (frame));
+  GstClockTime residency, diff;
+
+  if (!self->latency_calibration || fed == 0 || !self->input_state)
+    return;
+
+  /* The microseconds wrap around, their difference doesn't */
+  residency = (GstClockTime) ((guint32) g_get_monotonic_time () - fed) *
+      GST_USECOND;
+  self->latency_window_max = MAX (self->latency_window_max, residency);
+  if (++self->latency_window_frames < LATENCY_CALIBRATION_FRAMES)
+    return;
+
+  diff = self->latency_window_max > self->measured_latency ?
+      self->latency_window_max - self->measured_latency :
+      self->measured_latency - self->latency_window_max;
+  if (diff > self->measured_latency / 4) {
+    GST_DEBUG_OBJECT (self, "Measured component residency %" GST_TIME_FORMAT,
+        GST_TIME_ARGS (self->latency_window_max));
+    self->measured_latency = self->latency_window_max;
+    gst_omx_video_enc_update_latency (self);
+  }
+
+  self->latency_window_max = 0;
+  self->latency_window_frames = 0;
+}
+
 static gboolean
 gst_omx_video_enc_set_format (GstVideoEncoder * encoder,
     GstVideoCodecState * state)
@@ -1147,7 +1315,7 @@ gst_omx_video_enc_set_format (GstVideoEncoder * encoder,
 
     negotiation_map =
         gst_omx_video_get_supported_colorformats (self->enc_in_port,
-        self->input_state);
+        self->input_state, NULL);
     if (!negotiation_map) {
       /* Fallback */
       switch (info->finfo->format) {
@@ -1410,6 +1578,8 @@ gst_omx_video_enc_set_format (GstVideoEncoder * encoder,
     gst_video_codec_state_unref (self->input_state);
   self->input_state = gst_video_codec_state_ref (state);
 
+  gst_omx_video_enc_update_latency (self);
+
   /* Start the srcpad loop again */
   GST_DEBUG_OBJECT (self, "Starting task again");
   self->downstream_flow_ret = GST_FLOW_OK;
@@ -1622,6 +1792,73 @@ done:
   return ret;
 }
 
+/* Replaces the failed component by a new one configured for the current
+ * input state. The frames passed to the failed component are lost, @frame
+ * is encoded as a keyframe.
+ *
+ * Called with the stream lock from handle_frame(), or from drain() with no
+ * frame */
+static gboolean
+gst_omx_video_enc_recover (GstOMXVideoEnc * self, GstVideoCodecFrame * frame)
+{
+  GstVideoEncoder *encoder = GST_VIDEO_ENCODER (self);
+  OMX_ERRORTYPE last_error = gst_omx_component_get_last_error (self->enc);
+  gint64 start = g_get_monotonic_time ();
+  GstVideoCodecState *state;
+  GList *frames, *l;
+  gboolean ret;
+
+  g_atomic_int_set (&self->recover_pending, FALSE);
+
+  if (!self->input_state)
+    return FALSE;
+  state = gst_video_codec_state_ref (self->input_state);
+  self->recoveries++;
+
+  GST_VIDEO_ENCODER_STREAM_UNLOCK (self);
+  gst_omx_video_enc_stop (encoder);
+  gst_omx_video_enc_close (encoder);
+  GST_VIDEO_ENCODER_STREAM_LOCK (self);
+
+  /* Finishing them without output buffer drops them */
+  frames = gst_video_encoder_get_frames (encoder);
+  for (l = frames; l; l = l->next) {
+    GstVideoCodecFrame *tmp = l->data;
+
+    if (tmp != frame)
+      gst_video_encoder_finish_frame (encoder, tmp);
+    else
+      gst_video_codec_frame_unref (tmp);
+  }
+  g_list_free (frames);
+
+  ret = gst_omx_video_enc_open (encoder)
+      && gst_omx_video_enc_set_format (encoder, state);
+  gst_video_codec_state_unref (state);
+
+  if (!ret) {
+    GST_ERROR_OBJECT (self, "Failed to recreate the component");
+    return FALSE;
+  }
+
+  if (frame)
+    GST_VIDEO_CODEC_FRAME_SET_FORCE_KEYFRAME (frame);
+
+  GST_INFO_OBJECT (self, "Recovered from %s (0x%08x) in %" G_GINT64_FORMAT
+      " us", gst_omx_error_to_string (last_error), last_error,
+      g_get_monotonic_time () - start);
+  gst_element_post_message (GST_ELEMENT_CAST (self),
+      gst_message_new_element (GST_OBJECT_CAST (self),
+          gst_structure_new ("GstOMXRecovery",
+              "error", G_TYPE_STRING, gst_omx_error_to_string (last_error),
+              "recoveries", G_TYPE_UINT, self->recoveries,
+              "recovery-time", G_TYPE_UINT64,
+              (guint64) (g_get_monotonic_time () - start) * GST_USECOND,
+              NULL)));
+
+  return TRUE;
+}
+
 static GstFlowReturn
 gst_omx_video_enc_handle_frame (GstVideoEncoder * encoder,
     GstVideoCodecFrame * frame)
@@ -1640,6 +1877,14 @@ gst_omx_video_enc_handle_frame (GstVideoEncoder * encoder,
 
   GST_DEBUG_OBJECT (self, "Handling frame");
 
+  if (g_atomic_int_get (&self->recover_pending)
+      && !gst_omx_video_enc_recover (self, frame)) {
+    GST_ELEMENT_ERROR (self, LIBRARY, FAILED, (NULL),
+        ("Failed to recover from OpenMAX component error"));
+    gst_video_codec_frame_unref (frame);
+    return GST_FLOW_ERROR;
+  }
+
   if (self->eos) {
     GST_WARNING_OBJECT (self, "Got frame after EOS");
     gst_video_codec_frame_unref (frame);
@@ -1651,6 +1896,11 @@ gst_omx_video_enc_handle_frame (GstVideoEncoder * encoder,
     return self->downstream_flow_ret;
   }
 
+  /* Never 0, which means no timestamp */
+  if (self->latency_calibration)
+    gst_video_codec_frame_set_user_data (frame,
+        GUINT_TO_POINTER ((guint32) g_get_monotonic_time () | 1), NULL);
+
   port = self->enc_in_port;
 
   if (self->use_dmabuf) {
@@ -1961,6 +2211,12 @@ flow_error:
 
 component_error:
   {
+    if (gst_omx_video_enc_schedule_recovery (self)) {
+      /* Dropped, the next frame recreates the component */
+      self->started = FALSE;
+      return gst_video_encoder_finish_frame (encoder, frame);
+    }
+
     GST_ELEMENT_ERROR (self, LIBRARY, FAILED, (NULL),
         ("OpenMAX component in error state %s (0x%08x)",
             gst_omx_component_get_last_error_string (self->enc),
@@ -2077,6 +2333,18 @@ gst_omx_video_enc_drain (GstOMXVideoEnc * self, gboolean at_eos)
   g_mutex_unlock (&self->drain_lock);
   GST_VIDEO_ENCODER_STREAM_LOCK (self);
 
+  /* The component failed before it returned the EOS buffer, the frames
+   * in it are lost */
+  if (g_atomic_int_get (&self->recover_pending)) {
+    GST_WARNING_OBJECT (self, "Component failed while draining");
+    if (!gst_omx_video_enc_recover (self, NULL)) {
+      GST_ELEMENT_ERROR (self, LIBRARY, FAILED, (NULL),
+          ("Failed to recover from OpenMAX component error"));
+      return GST_FLOW_ERROR;
+    }
+    self->eos = at_eos;
+  }
+
   self->started = FALSE;
 
   return GST_FLOW_OK;
@@ -2304,7 +2572,7 @@ gst_omx_video_enc_getcaps (GstVideoEncoder * encoder, GstCaps * filter)
 
   negotiation_map =
       gst_omx_video_get_supported_colorformats (self->enc_in_port,
-      self->input_state);
+      self->input_state, NULL);
   comp_supported_caps = gst_omx_video_get_caps_for_map (negotiation_map);
   g_list_free_full (negotiation_map,
       (GDestroyNotify) gst_omx_video_negotiation_map_free);
@@ -86,9 +86,27 @@ struct _GstOMXVideoEnc
   gboolean no_copy;
   /* TRUE to receive dmabuf fd from upstream */
   gboolean use_dmabuf;
+  /* TRUE to report the measured component residency as latency */
+  gboolean latency_calibration;
   GstOMXVideoEncPrivate *priv;
 
   GstFlowReturn downstream_flow_ret;
+
+  /* Latency measured from the component residency of the frames, 0 until
+   * a window of frames was measured */
+  GstClockTime measured_latency;
+  GstClockTime latency_window_max;
+  guint latency_window_frames;
+  /* Last reported latency */
+  GstClockTime latency_min;
+  GstClockTime latency_max;
+
+  /* Component recreation on errors */
+  gboolean recover_on_error;
+  guint max_recoveries;
+  guint recoveries;
+  /* Set by the threads seeing the error, handle_frame() recovers, atomic */
+  gint recover_pending;
 };
 
 struct _GstOMXVideoEncClass
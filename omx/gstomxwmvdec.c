@@ -26,13 +26,23 @@
 #include <gst/gst.h>
 
 #include "gstomxwmvdec.h"
+#include "gstomxvideo.h"
 
 GST_DEBUG_CATEGORY_STATIC (gst_omx_wmv_dec_debug_category);
 #define GST_CAT_DEFAULT gst_omx_wmv_dec_debug_category
 
 #define SEQ_PARAM_BUF_SIZE 24
 
+/* VC-1 bitstream data unit types */
+#define BDU_TYPE_FRAME 0x0d
+#define BDU_TYPE_ENTRY_POINT 0x0e
+#define BDU_TYPE_SEQUENCE 0x0f
+
+/* Prepended to advanced profile frames that don't start with a BDU */
+static const guint8 frame_start_code[] = { 0x00, 0x00, 0x01, BDU_TYPE_FRAME };
+
 /* prototypes */
+static void gst_omx_wmv_dec_finalize (GObject * object);
 static gboolean gst_omx_wmv_dec_is_format_change (GstOMXVideoDec * dec,
     GstOMXPort * port, GstVideoCodecState * state);
 static gboolean gst_omx_wmv_dec_set_format (GstOMXVideoDec * dec,
@@ -57,9 +67,12 @@ G_DEFINE_TYPE_WITH_CODE (GstOMXWMVDec, gst_omx_wmv_dec,
 static void
 gst_omx_wmv_dec_class_init (GstOMXWMVDecClass * klass)
 {
+  GObjectClass *gobject_class = G_OBJECT_CLASS (klass);
   GstElementClass *element_class = GST_ELEMENT_CLASS (klass);
   GstOMXVideoDecClass *videodec_class = GST_OMX_VIDEO_DEC_CLASS (klass);
 
+  gobject_class->finalize = gst_omx_wmv_dec_finalize;
+
   videodec_class->is_format_change =
       GST_DEBUG_FUNCPTR (gst_omx_wmv_dec_is_format_change);
   videodec_class->set_format = GST_DEBUG_FUNCPTR (gst_omx_wmv_dec_set_format);
@@ -81,6 +94,21 @@ gst_omx_wmv_dec_class_init (GstOMXWMVDecClass * klass)
 static void
 gst_omx_wmv_dec_init (GstOMXWMVDec * self)
 {
+  /* Shared read-only by all frames, so prepending it allocates nothing */
+  self->frame_start_code = gst_memory_new_wrapped (GST_MEMORY_FLAG_READONLY,
+      (gpointer) frame_start_code, sizeof (frame_start_code), 0,
+      sizeof (frame_start_code), NULL, NULL);
+}
+
+static void
+gst_omx_wmv_dec_finalize (GObject * object)
+{
+  GstOMXWMVDec *self = GST_OMX_WMV_DEC (object);
+
+  gst_buffer_replace (&self->headers, NULL);
+  gst_memory_unref (self->frame_start_code);
+
+  G_OBJECT_CLASS (gst_omx_wmv_dec_parent_class)->finalize (object);
 }
 
 static gboolean
@@ -90,89 +118,181 @@ gst_omx_wmv_dec_is_format_change (GstOMXVideoDec * dec,
   return FALSE;
 }
 
+/* Offset of the first BDU of type @type, -1 if there is none */
+static gssize
+gst_omx_wmv_dec_find_bdu (const guint8 * data, gsize size, guint8 type)
+{
+  gsize i;
+
+  for (i = 0; i + 4 <= size; i++) {
+    if (data[i] == 0x00 && data[i + 1] == 0x00 && data[i + 2] == 0x01
+        && data[i + 3] == type)
+      return i;
+  }
+
+  return -1;
+}
+
+/* The advanced profile codec_data holds the sequence and entry-point header
+ * BDUs, possibly after some bytes of ASF padding. Returns the headers from
+ * the sequence header on, NULL if there is none */
+static GstBuffer *
+gst_omx_wmv_dec_parse_advanced_headers (GstOMXWMVDec * self,
+    GstBuffer * codec_data)
+{
+  GstBuffer *headers = NULL;
+  GstBitReader br;
+  GstMapInfo map;
+  guint8 *rbsp;
+  gsize rbsp_size;
+  gssize seq, entry;
+  guint32 level = 0, interlace = 0;
+
+  if (!gst_buffer_map (codec_data, &map, GST_MAP_READ))
+    return NULL;
+
+  seq = gst_omx_wmv_dec_find_bdu (map.data, map.size, BDU_TYPE_SEQUENCE);
+  if (seq < 0) {
+    gst_buffer_unmap (codec_data, &map);
+    return NULL;
+  }
+  entry = gst_omx_wmv_dec_find_bdu (map.data + seq, map.size - seq,
+      BDU_TYPE_ENTRY_POINT);
+
+  /* PROFILE (2), LEVEL (3), COLORDIFF_FORMAT (2), FRMRTQ_POSTPROC (3),
+   * BITRTQ_POSTPROC (5), POSTPROCFLAG (1), MAX_CODED_WIDTH (12),
+   * MAX_CODED_HEIGHT (12), PULLDOWN (1), INTERLACE (1) */
+  rbsp = gst_omx_video_nal_to_rbsp (map.data + seq + 4,
+      MIN (map.size - seq - 4, 16), &rbsp_size);
+  gst_bit_reader_init (&br, rbsp, rbsp_size);
+  if (gst_bit_reader_skip (&br, 2)
+      && gst_bit_reader_get_bits_uint32 (&br, &level, 3)
+      && gst_bit_reader_skip (&br, 36))
+    gst_bit_reader_get_bits_uint32 (&br, &interlace, 1);
+  g_free (rbsp);
+
+  GST_DEBUG_OBJECT (self, "Sequence header at %" G_GSSIZE_FORMAT
+      ", level %u, interlace %u, entry-point header %s", seq, level,
+      interlace, entry >= 0 ? "present" : "missing");
+
+  gst_buffer_unmap (codec_data, &map);
+
+  headers = gst_buffer_copy_region (codec_data, GST_BUFFER_COPY_MEMORY, seq,
+      -1);
+
+  return headers;
+}
+
+#ifdef USE_OMX_TARGET_RCAR
+/* Builds the Sequence Layer Data Structure the component expects before the
+ * first frame of a simple/main profile stream, from the STRUCT_C in the
+ * codec_data */
+static GstBuffer *
+gst_omx_wmv_dec_create_sequence_layer (GstOMXWMVDec * self,
+    GstOMXPort * port, GstBuffer * codec_data)
+{
+  OMX_PARAM_PORTDEFINITIONTYPE port_def;
+  guint32 *SeqHdrBuf;
+  guint8 *u8ptr;
+
+  if (gst_buffer_get_size (codec_data) < 4)
+    return NULL;
+
+  gst_omx_port_get_port_definition (port, &port_def);
+
+  SeqHdrBuf = (guint32 *) g_malloc (SEQ_PARAM_BUF_SIZE);
+
+  /* create sequence header */
+  SeqHdrBuf[0] = 0xc5000000;
+  SeqHdrBuf[1] = 0x00000004;
+  u8ptr = (guint8 *) & SeqHdrBuf[2];
+  gst_buffer_extract (codec_data, 0, u8ptr, 4);
+  SeqHdrBuf[3] = port_def.format.video.nFrameHeight;
+  SeqHdrBuf[4] = port_def.format.video.nFrameWidth;
+  SeqHdrBuf[5] = 0x0000000c;
+
+  return gst_buffer_new_wrapped (SeqHdrBuf, SEQ_PARAM_BUF_SIZE);
+}
+#endif
+
+/* The stream headers are parsed once per format, prepare_frame() only
+ * hands them to the base class */
 static gboolean
 gst_omx_wmv_dec_set_format (GstOMXVideoDec * dec, GstOMXPort * port,
     GstVideoCodecState * state)
 {
+  GstOMXWMVDec *self = GST_OMX_WMV_DEC (dec);
   gboolean ret;
   OMX_PARAM_PORTDEFINITIONTYPE port_def;
+  GstStructure *structure;
+  const gchar *fourcc;
+  GstBuffer *headers = NULL;
 
   gst_omx_port_get_port_definition (port, &port_def);
   port_def.format.video.eCompressionFormat = OMX_VIDEO_CodingWMV;
   ret = gst_omx_port_update_port_definition (port, &port_def) == OMX_ErrorNone;
 
+  structure = gst_caps_get_structure (state->caps, 0);
+  fourcc = gst_structure_get_string (structure, "format");
+  self->advanced_profile = fourcc && strncmp (fourcc, "WVC1", 4) == 0;
+
+  if (self->advanced_profile) {
+    GST_DEBUG_OBJECT (self, "Handling for VC-1 stream - Advanced profile");
+    /* B pictures are never referenced, they delay output by one picture */
+    dec->stream_reorder_depth = 1;
+
+    if (state->codec_data) {
+      headers = gst_omx_wmv_dec_parse_advanced_headers (self,
+          state->codec_data);
+      if (!headers)
+        GST_WARNING_OBJECT (self, "No sequence header in codec_data");
+    }
+  } else if (state->codec_data) {
+    guint8 struct_c[4];
+
+    /* MAXBFRAMES follows the first 25 bits of STRUCT_C */
+    if (gst_buffer_extract (state->codec_data, 0, struct_c, 4) == 4)
+      dec->stream_reorder_depth = ((struct_c[3] >> 4) & 0x7) > 0 ? 1 : 0;
+
+#ifdef USE_OMX_TARGET_RCAR
+    headers = gst_omx_wmv_dec_create_sequence_layer (self, port,
+        state->codec_data);
+#endif
+  }
+
+  gst_buffer_replace (&self->headers, headers);
+  if (headers)
+    gst_buffer_unref (headers);
+  self->headers_pending = self->headers != NULL;
+
   return ret;
 }
 
+/* Replaces the codec_data with the prepared headers once per format, and
+ * gives advanced profile frames the start code of a frame BDU if they
+ * don't start with one. The start code memory is prepended, so the base
+ * class copies it together with the payload */
 static GstFlowReturn
 gst_omx_wmv_dec_prepare_frame (GstOMXVideoDec * dec, GstVideoCodecFrame * frame)
 {
-  GstFlowReturn ret = GST_FLOW_OK;
-  GstOMXWMVDec *self;
-  OMX_PARAM_PORTDEFINITIONTYPE port_def;
-  GstCaps *caps;
-  GstStructure *structure;
-  const gchar *fourcc;
+  GstOMXWMVDec *self = GST_OMX_WMV_DEC (dec);
+  guint8 start[4];
 
-  self = GST_OMX_WMV_DEC (dec);
+  if (self->headers_pending) {
+    gst_buffer_replace (&dec->codec_data, self->headers);
+    self->headers_pending = FALSE;
+  }
 
-  gst_omx_port_get_port_definition (dec->dec_in_port, &port_def);
+  if (!self->advanced_profile)
+    return GST_FLOW_OK;
 
-  caps = gst_pad_get_current_caps (GST_VIDEO_DECODER_SINK_PAD (dec));
-  structure = gst_caps_get_structure (caps, 0);
-  fourcc = gst_structure_get_string (structure, "format");
+  if (gst_buffer_extract (frame->input_buffer, 0, start, 4) == 4
+      && start[0] == 0x00 && start[1] == 0x00 && start[2] == 0x01)
+    return GST_FLOW_OK;
 
-  if (strncmp (fourcc, "WVC1", strlen ("WVC1")) == 0) {
-    GST_DEBUG_OBJECT (self, "Handling for VC-1 stream - Advanced profile");
-    self->advanced_profile = TRUE;
-  } else
-    self->advanced_profile = FALSE;
-  gst_caps_unref (caps);
-#ifdef USE_OMX_TARGET_RCAR
-  if (dec->codec_data) {
-    GstMapInfo info;
-    GstBuffer *codec_data;
-    guint32 *SeqHdrBuf;
-    guint8 *u8ptr;
-
-    if (!self->advanced_profile) {
-      /* Get Sequence Layer Data Structure send to MC before pushing frame
-       * in case Simple/Main profile
-       */
-      if (!gst_buffer_map (dec->codec_data, &info, GST_MAP_READ)) {
-        GST_ERROR_OBJECT (dec, "Failed to create a gstbuffer mapping");
-        return GST_FLOW_ERROR;
-      }
-      SeqHdrBuf = (guint32 *) g_malloc (SEQ_PARAM_BUF_SIZE);
-      if (SeqHdrBuf == NULL) {
-        GST_ERROR_OBJECT (dec, "Failed to g_malloc");
-        return GST_FLOW_ERROR;
-      }
-
-      /* create sequence header */
-      SeqHdrBuf[0] = 0xc5000000;
-      SeqHdrBuf[1] = 0x00000004;
-      u8ptr = (guint8 *) & SeqHdrBuf[2];
-      u8ptr[0] = info.data[0];
-      u8ptr[1] = info.data[1];
-      u8ptr[2] = info.data[2];
-      u8ptr[3] = info.data[3];
-      SeqHdrBuf[3] = port_def.format.video.nFrameHeight;
-      SeqHdrBuf[4] = port_def.format.video.nFrameWidth;
-      SeqHdrBuf[5] = 0x0000000c;
-
-      gst_buffer_unmap (dec->codec_data, &info);
-
-      codec_data = gst_buffer_new_wrapped (SeqHdrBuf, SEQ_PARAM_BUF_SIZE);
-
-      if (!gst_buffer_replace (&dec->codec_data, codec_data)) {
-        GST_ERROR_OBJECT (self, "Failed to replace analysed codec_data");
-        return GST_FLOW_ERROR;
-      }
-      gst_buffer_unref (codec_data);
-    }
-  }
-#endif
+  frame->input_buffer = gst_buffer_make_writable (frame->input_buffer);
+  gst_buffer_prepend_memory (frame->input_buffer,
+      gst_memory_ref (self->frame_start_code));
 
-  return ret;
+  return GST_FLOW_OK;
 }
@@ -47,6 +47,14 @@ struct _GstOMXWMVDec
 {
   GstOMXVideoDec parent;
   gboolean advanced_profile;
+
+  /* Stream headers prepared from the codec_data by set_format(), passed to
+   * the component instead of it */
+  GstBuffer *headers;
+  gboolean headers_pending;
+
+  /* Start code of a frame BDU */
+  GstMemory *frame_start_code;
 };
 
 struct _GstOMXWMVDecClass